@@ -0,0 +1,262 @@
+/*
+ * game.c - the nuggets game engine: one game on one map, driven in process.
+ *  Keeps the grid and its players, and maps keys to grid moves.
+ *
+ * see game.h for details of each function
+ *
+ * foobarbaz, May 2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory.h>
+#include "grid.h"
+#include "game.h"
+
+struct game {
+	grid_t *grid;	// holds the players (by slot) and the spectator
+	game_config_t config;
+	int num_players;	// slots used so far
+};
+
+const game_config_t game_default_config = {
+	.max_players = 26,
+	.total_gold = 300,
+	.min_piles = 10,
+	.max_piles = 20,
+	.max_display = 0,
+	.viewport_rows = 40,
+	.viewport_cols = 120,
+};
+
+static const char PlayerTags[27] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+static player_t *player_new(game_t *game, const char *name, char tag); //allocate a player and its display
+static void player_free(game_t *game, player_t *player); //free a player, its display and known table
+
+/**************** game_create ****************/
+game_t *
+game_create(const char *mapfile, int seed, const game_config_t *config){
+	grid_t *grid = grid_new((char *)mapfile, seed, config->min_piles, config->max_piles, config->total_gold, config->max_players);
+	if (grid == NULL) {
+		return NULL;
+	}
+	game_t *game = malloc(sizeof(game_t));
+	assertp(game, "Error allocating memory to game\n");
+	game->grid = grid;
+	game->config = *config;
+	game->num_players = 0;
+	// a map too large for one display is shown through a viewport around each player
+	if (config->max_display > 0 && (grid->num_cols + 1) * grid->num_rows >= config->max_display) {
+		grid_set_viewport(grid, config->viewport_rows, config->viewport_cols);
+	}
+	return game;
+}
+
+/**************** game_set_pool ****************/
+void
+game_set_pool(game_t *game, pool_t *pool){
+	game->grid->pool = pool;
+}
+
+/**************** player_new ****************/
+// The spectator is a player too, named "spectator", so it is freed the same way.
+static player_t *
+player_new(game_t *game, const char *name, char tag){
+	player_t *player = malloc(sizeof(player_t));
+	assertp(player, "Error allocating memory to player\n");
+	player->player_name = malloc(strlen(name) + 1);
+	assertp(player->player_name, "Error allocating memory to player name\n");
+	strcpy(player->player_name, name);
+	player->player_tag = tag;
+	player->gold_obtained = 0;
+	player->display = malloc(game_display_size(game));
+	assertp(player->display, "Error allocating memory to player display\n");
+	player->display[0] = '\0';
+	player->known = NULL;
+	player->row = 0;
+	player->col = 0;
+	player->player_quit = false;
+	return player;
+}
+
+/**************** player_free ****************/
+static void
+player_free(game_t *game, player_t *player){
+	free(player->player_name);
+	free(player->display);
+	grid_known_delete(game->grid, player->known);	// NULL for the spectator
+	free(player);
+}
+
+/**************** game_join ****************/
+int
+game_join(game_t *game, const char *name){
+	if (game->num_players == game->config.max_players) {
+		return -1;
+	}
+	int slot = game->num_players;
+	player_t *player = player_new(game, name, PlayerTags[slot]);
+	// known tiles are allocated as the player explores
+	player->known = grid_known_new(game->grid);
+	game->grid->players[slot] = player;
+	// place the player on a random empty room spot
+	grid_add_player(game->grid, player);
+	game->num_players++;
+	return slot;
+}
+
+/**************** game_spectate ****************/
+void
+game_spectate(game_t *game){
+	if (game->grid->spectator == NULL) {
+		game->grid->spectator = player_new(game, "spectator", '\0');
+	}
+}
+
+/**************** game_unspectate ****************/
+void
+game_unspectate(game_t *game){
+	if (game->grid->spectator != NULL) {
+		player_free(game, game->grid->spectator);
+		game->grid->spectator = NULL;
+	}
+}
+
+/**************** game_key ****************/
+// Lowercase keys move one step; capitals run until something is in the way.
+// A positive row is down and a positive col is right.
+int
+game_key(game_t *game, int slot, char key){
+	// a player that quit is off the grid and must not move or quit again
+	if (!game_active(game, slot)) {
+		return -1;
+	}
+	player_t *player = game->grid->players[slot];
+	grid_t *grid = game->grid;
+	switch (key) {
+		case 'h': return grid_move(grid, player, 0, -1);
+		case 'j': return grid_move(grid, player, 1, 0);
+		case 'k': return grid_move(grid, player, -1, 0);
+		case 'l': return grid_move(grid, player, 0, 1);
+		case 'y': return grid_move(grid, player, -1, -1);
+		case 'u': return grid_move(grid, player, -1, 1);
+		case 'b': return grid_move(grid, player, 1, -1);
+		case 'n': return grid_move(grid, player, 1, 1);
+		case 'H': return grid_move_to_end(grid, player, 0, -1);
+		case 'J': return grid_move_to_end(grid, player, 1, 0);
+		case 'K': return grid_move_to_end(grid, player, -1, 0);
+		case 'L': return grid_move_to_end(grid, player, 0, 1);
+		case 'Y': return grid_move_to_end(grid, player, -1, -1);
+		case 'U': return grid_move_to_end(grid, player, -1, 1);
+		case 'B': return grid_move_to_end(grid, player, 1, -1);
+		case 'N': return grid_move_to_end(grid, player, 1, 1);
+		case 'Q':
+			// the player stays in its slot, so its tag is never reused
+			grid_remove_player(grid, player);
+			player->player_quit = true;
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+/**************** game_travel ****************/
+int
+game_travel(game_t *game, int slot){
+	if (!game_active(game, slot)) {
+		return -1;
+	}
+	return grid_move_toward_gold(game->grid, game->grid->players[slot]);
+}
+
+/**************** game_render ****************/
+void
+game_render(game_t *game, int slot, char *buf){
+	grid_render(game->grid, slot, buf);
+}
+
+/**************** game_render_changes ****************/
+void
+game_render_changes(game_t *game, uint64_t *since, char *buf){
+	grid_render_changes(game->grid, since, buf);
+}
+
+/**************** game_render_all ****************/
+void
+game_render_all(game_t *game){
+	grid_display_board(game->grid);
+}
+
+/**************** game_display ****************/
+const char *
+game_display(game_t *game, int slot){
+	player_t *player = (slot == GameSpectator) ? game->grid->spectator : game->grid->players[slot];
+	return player->display;
+}
+
+/**************** game_display_size ****************/
+int
+game_display_size(game_t *game){
+	return game->grid->view_rows * (game->grid->view_cols + 1) + 1;
+}
+
+/**************** game_view_rows ****************/
+int
+game_view_rows(game_t *game){
+	return game->grid->view_rows;
+}
+
+/**************** game_view_cols ****************/
+int
+game_view_cols(game_t *game){
+	return game->grid->view_cols;
+}
+
+/**************** game_num_players ****************/
+int
+game_num_players(game_t *game){
+	return game->num_players;
+}
+
+/**************** game_active ****************/
+bool
+game_active(game_t *game, int slot){
+	return !game->grid->players[slot]->player_quit;
+}
+
+/**************** game_tag ****************/
+char
+game_tag(game_t *game, int slot){
+	return game->grid->players[slot]->player_tag;
+}
+
+/**************** game_name ****************/
+const char *
+game_name(game_t *game, int slot){
+	return game->grid->players[slot]->player_name;
+}
+
+/**************** game_purse ****************/
+int
+game_purse(game_t *game, int slot){
+	return game->grid->players[slot]->gold_obtained;
+}
+
+/**************** game_gold_remaining ****************/
+int
+game_gold_remaining(game_t *game){
+	return game->grid->gold_remaining;
+}
+
+/**************** game_destroy ****************/
+void
+game_destroy(game_t *game){
+	game_unspectate(game);
+	for (int i = 0; i < game->num_players; i++) {
+		player_free(game, game->grid->players[i]);
+	}
+	grid_delete(game->grid);
+	free(game);
+}
@@ -0,0 +1,84 @@
+/*
+ * game.h - the nuggets game engine: one game on one map, driven in process.
+ *  Players are numbered by slot, from 0 in the order they join; the
+ *  spectator's view is slot GameSpectator. Nothing here touches the
+ *  network: server.c adapts it to the protocol, and benchmarks, bots
+ *  and replays can call it directly. Built into libnuggets.a with grid.c.
+ *
+ * foobarbaz, May 2019
+ */
+
+#ifndef __GAME_H
+#define __GAME_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <pool.h>
+
+//slot of the spectator's view
+#define GameSpectator -1
+
+//one game; opaque to users of the engine
+typedef struct game game_t;
+
+//rules of a game
+typedef struct game_config {
+	int max_players;	// at most 26
+	int total_gold;
+	int min_piles;	// gold is split into between min_piles and max_piles piles
+	int max_piles;
+	int max_display;	// most characters a display may take; a larger map is shown through a viewport. 0 for no limit
+	int viewport_rows;	// size of that viewport
+	int viewport_cols;
+} game_config_t;
+
+//the rules the server plays by
+extern const game_config_t game_default_config;
+
+//creates a game on the map in mapfile (text or compiled), with gold placed from seed;
+//returns NULL, having printed why, if the map cannot be loaded or is too small
+game_t *game_create(const char *mapfile, int seed, const game_config_t *config);
+//renders displays on pool's threads from now on; NULL renders inline
+void game_set_pool(game_t *game, pool_t *pool);
+//adds a player named name at a random free room spot; returns its slot, or -1 if the game is full
+int game_join(game_t *game, const char *name);
+//gives the game a spectator, whose view game_render_all then renders too; does nothing if it has one
+void game_spectate(game_t *game);
+//takes the spectator away
+void game_unspectate(game_t *game);
+//applies key from the player in slot: a move (hjklyubn, or capitalized to run) or Q to leave;
+//returns the gold collected, or -1 if the key is not valid or the player has quit
+int game_key(game_t *game, int slot, char key);
+//moves the player in slot one step along a shortest path to the nearest gold, waiting instead
+//if another player is in the way; returns the gold collected, or -1 if no gold can be reached
+//or the player has quit.
+//The distances are shared by every player and updated as gold is picked up
+int game_travel(game_t *game, int slot);
+//renders the view of slot (a player or GameSpectator) into buf, which holds game_display_size chars
+void game_render(game_t *game, int slot, char *buf);
+//brings the spectator's view in buf up to date from the grid's journal, redrawing only the
+//cells changed since *since, which it advances; buf must hold the view last rendered this
+//way, or *since be 0 to render it whole
+void game_render_changes(game_t *game, uint64_t *since, char *buf);
+//renders every active player's view and the spectator's, in parallel if there is a pool
+void game_render_all(game_t *game);
+//returns the view of slot last rendered by game_render_all
+const char *game_display(game_t *game, int slot);
+//returns the chars a display takes, including the terminating null
+int game_display_size(game_t *game);
+//returns the rows and columns of every display
+int game_view_rows(game_t *game);
+int game_view_cols(game_t *game);
+//returns the number of players that joined, including those that left
+int game_num_players(game_t *game);
+//returns whether the player in slot is still in the game
+bool game_active(game_t *game, int slot);
+//returns the tag, name and gold of the player in slot
+char game_tag(game_t *game, int slot);
+const char *game_name(game_t *game, int slot);
+int game_purse(game_t *game, int slot);
+//returns the gold left to collect; the game is over when it is 0
+int game_gold_remaining(game_t *game);
+//frees the game and its players
+void game_destroy(game_t *game);
+
+#endif // __GAME_H
@@ -1,42 +1,146 @@
 /* 
  * grid.c - the grid for the nuggets game.
  *  Handles display and removal of items on map
+ *  Compile with -DUNIT_TEST for a standalone unit test; see below.
  *
  * foobarbaz, April 2019
  */
 
+#define _DEFAULT_SOURCE		// for mmap
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "grid.h"
 #include <math.h>
 #include <memory.h>
 
-//Cell struct for holding traits for places on map
-typedef struct cell {
-	char tag;
-	int gold;
-	char default_char;
-	bool is_walkable;
-	int row;
-	int col;
-} cell_t;
-
+//Layout of a compiled map (see grid_compile); sections are arrays with
+//an entry per cell in cell-number order (tile by tile) unless noted, at
+//8-byte aligned offsets from the start of the file, in the compiling
+//machine's byte order. The characters start on a page boundary, so
+//each tile's characters fill one page and are read in only when touched.
+typedef struct map_header {
+	char magic[8];	// MapMagic
+	uint32_t version;	// MapVersion
+	uint32_t rows;
+	uint32_t cols;
+	uint32_t num_walkable;	// walkable cells
+	uint32_t num_dots;	// room ('.') cells
+	uint32_t vis_words;	// 64-bit words per row of the visibility table; 0 if absent
+	uint64_t chars;	// char: the map's characters, ' ' past the map's edges
+	uint64_t walkable;	// uint64_t bitmap: bit i set if cell i is walkable
+	uint64_t walk_index;	// int32_t: rank of each walkable cell, -1 for others
+	uint64_t dots;	// uint32_t[num_dots]: cell number of each room cell, row by row
+	uint64_t visibility;	// uint64_t[num_walkable][vis_words]: bit j of row w set if cell j is visible from walkable cell w; 0 if absent
+} map_header_t;
+
+static const char MapMagic[8] = "NUGMAPC";
+static const uint32_t MapVersion = 2;
+static const size_t MapPageSize = 4096;	// alignment of the characters
+
+//A compiled map mapped into memory, shared read-only with every other
+//process using the same file
+typedef struct grid_map {
+	const char *base;	// the whole file
+	size_t size;
+	const map_header_t *header;
+	const uint64_t *walkable;
+	const int32_t *walk_index;
+	const uint32_t *dots;
+	const uint64_t *visibility;	// NULL if the map has none
+} grid_map_t;
+
+//Mutable state of the cells of one tile, created when something is
+//first placed in the tile
+struct cell_tile {
+	char tags[GridTileCells];	// tag of each cell
+	int gold[GridTileCells];	// gold of each cell
+};
+
+//Ring buffer of the latest grid events; once full, each new event
+//overwrites the oldest
+typedef struct grid_journal {
+	grid_event_t events[GridJournalCapacity];
+	uint64_t next_seq;	// sequence number of the next event; the first is 1
+} grid_journal_t;
+
+//Steps from every cell to the nearest of a set of source cells, over
+//walkable cells by the 8-way steps players take; FieldFar where no source
+//can be reached. Each cell also notes which source it is nearest to, so
+//removing a source only searches again the cells that were nearest to it.
+struct grid_field {
+	uint32_t *dist;	// per cell
+	int32_t *source;	// per cell: the nearest source, -1 if none
+	int *queue;	// scratch for the searches, a cell per cell
+};
+
+//A cell bordering the cells a removed source was nearest to, and its steps
+typedef struct field_seed {
+	uint32_t dist;
+	int cell;
+} field_seed_t;
+
+//entries of free_cells in each of its chunks
+#define FreeChunk 1024
+//free_pos of a room cell missing from dots
+#define FreeUnlisted -2
+
+#define FieldFar UINT32_MAX
+//row and column steps of the 8 moves, in the order of the keys h j k l y u b n
+static const int FieldSteps[8][2] = {
+	{0, -1}, {1, 0}, {-1, 0}, {0, 1}, {-1, -1}, {-1, 1}, {1, -1}, {1, 1},
+};
 
 // Function Prototypes
-static void generate_cells(cell_t **cells, FILE* map);
-static cell_t cell_new(char default_char, int row, int col);
-static int calculate_rows(FILE* fp);
-static int calculate_cols(FILE* fp);
+static bool load_map(grid_t *grid, const char *filename); //read the map into the grid's cells
+static bool generate_cells(grid_t *grid, const char *text, size_t size); //fill the cells from the map text
+static bool load_compiled(grid_t *grid, const char *base, size_t size); //fill the cells from a compiled map
+static bool compiled_valid(grid_t *grid, const char *base); //check the contents of a compiled map's sections
+static void planes_new(grid_t *grid, bool mapped); //allocate the terrain planes if not taken from a compiled map
+static inline int cell_at(const grid_t *grid, int row, int col); //number of the cell at a location
+static inline int cell_row(const grid_t *grid, int cell); //row of a cell number
+static inline int cell_col(const grid_t *grid, int cell); //column of a cell number
+static inline bool cell_walkable(const grid_t *grid, int cell); //whether a player may stand in a cell
+static inline bool char_walkable(char c); //whether a map character is walkable
+static inline char tag_at(const grid_t *grid, int cell); //live tag of a cell
+static inline int gold_at(const grid_t *grid, int cell); //live gold of a cell
+static void set_tag(grid_t *grid, int cell, char tag); //change the tag of a cell
+static void set_gold(grid_t *grid, int cell, int gold); //change the gold of a cell
+static bool known_get(const grid_t *grid, uint64_t **known, int cell); //whether a player knows a cell
+static void known_set(grid_t *grid, uint64_t **known, int cell); //mark a cell known to a player
+static void view_origin(grid_t *grid, int row, int col, int *top, int *left); //top left of the view centered on a location
+static bool write_section(FILE *fp, uint64_t *offset, uint64_t *start, const void *data, size_t size, size_t align); //append an aligned section
 static int calculate_dots(grid_t *grid);
-static cell_t* get_cell(grid_t *grid, int dot_number);
+static void dot_index(grid_t *grid); //list the room cells
+static int dot_rank(grid_t *grid, int row, int col); //place in the list of room cells of the first at or after a location
+static void split_gold(grid_t *grid, int total_gold, int num_piles, int *piles); //split gold into random piles
+static void random_seed(grid_t *grid, uint64_t seed); //seed the grid's random number generator
+static uint32_t random_next(grid_t *grid); //next 32 random bits from the grid's generator
+static int random_below(grid_t *grid, int bound); //uniform random integer in [0, bound)
 static void grid_populate_gold(grid_t* grid, int min_gold_piles, int max_gold_piles, int total_gold); //populate grid with gold
-static cell_t* get_empty_cell(grid_t *grid, int dot_number);
-static int calculate_empty_spots(grid_t *grid); 
+static void free_index_new(grid_t *grid); //index the room cells that are free
+static void free_update(grid_t *grid, int cell); //add or remove a cell from the free cells after it changed
+static int free_get(grid_t *grid, int i); //the free cell at an index
+static void free_set(grid_t *grid, int i, int cell); //change the free cell at an index
+static int32_t *free_positions(grid_t *grid, int tile); //indexes of a tile's cells in the free cells
 static bool grid_in_bounds(grid_t *grid, int row, int col); //make sure grid is in bounds 
 static bool is_horizontal_wall(grid_t *grid, double x, int y); //check whether the current x,y location has horizontal boundary 
 static bool is_vertical_wall(grid_t *grid, int x, double y); //check whether the current x,y location hasvertical boundary 
-static bool grid_isVisible(grid_t *grid, int x1, int y1, int x2, int y2 ); //check whether the current x2,y2 location is visible to starting x1,y1
+static void render_task(void *arg, const int i); //render the display of player i, or of the spectator
+static void render_view(grid_t *grid, player_t *player, int slot); //render one display
+static void redraw_cell(grid_t *grid, int top, int left, int row, int col, char *display); //redraw one cell of the spectator's view
+static void journal_append(grid_t *grid, grid_event_type_t type, char tag, int from_row, int from_col, int row, int col, int gold); //record a mutation
+static grid_field_t *gold_field(grid_t *grid); //the gold field, computed on first use
+static int field_expand(grid_t *grid, grid_field_t *field, int cell, int tail); //queue the neighbors a cell brings closer to a source
+static void field_remove_source(grid_t *grid, grid_field_t *field, int source); //update a field after a source is removed
+static int seed_compare(const void *a, const void *b); //order seeds by steps
+static void field_delete(grid_field_t *field); //free a field
 
 /**************** grid_new ****************/
 grid_t*
@@ -44,203 +148,792 @@ grid_new(char* filename, int seed, int min_gold_piles, int max_gold_piles, int t
 
 	grid_t *grid = malloc(sizeof(grid_t));	// Allocates memory for grid
 	assertp(grid, "Error allocating memory to grid\n");
-
-	FILE* map = fopen(filename, "r");	// Assume that server is doing this error checking
-	grid->num_rows = calculate_rows(map);	// rows
-	grid->num_cols = calculate_cols(map);	// Colums
-
-	grid->gold_remaining = total_gold;	// intialize gold_remaining
-
-	// Allocate the array of cells:
-	cell_t ** cells = (cell_t **)malloc(grid->num_rows * sizeof(cell_t *));
-	assertp(cells, "Error allocating memory to cells\n");
-
-	for (int i = 0; i < grid->num_rows; ++i){
-		cells[i] = (cell_t *)malloc(grid->num_cols * sizeof(cell_t));
-		assertp(cells[i], "Error allocating memory to a cell row\n");
+	grid->map = NULL;
+	grid->planes = NULL;
+	grid->dots = NULL;
+	grid->free_cells = NULL;
+	grid->free_pos = NULL;
+	grid->gold_field = NULL;
+
+	if (!load_map(grid, filename)) {	// sets the size and the terrain planes
+		free(grid);
+		return NULL;
 	}
+	grid->view_rows = grid->num_rows;	// the whole map is shown unless the server narrows it
+	grid->view_cols = grid->num_cols;
+	grid->tiles = calloc(grid->num_tiles, sizeof(cell_tile_t *));	// all empty
+	assertp(grid->tiles, "Error allocating memory to tiles\n");
 
-	grid->cells = cells;
-	generate_cells(grid->cells, map); // Function populates the cell datastructure
+	grid->gold_remaining = total_gold;	// intialize gold_remaining
 	grid->MaxPlayers = MaxPlayers;
 	grid->players = calloc(MaxPlayers, sizeof(player_t));	// Allocates memory for array of players 
 	assertp(grid->players, "Error Allocating memory to player array\n");
 
 	grid->spectator = NULL;
-	
-	srand((unsigned)seed);
+	grid->pool = NULL;
+
+	grid->journal = malloc(sizeof(grid_journal_t));
+	assertp(grid->journal, "Error allocating memory to grid journal\n");
+	grid->journal->next_seq = 1;
+
+	random_seed(grid, (uint64_t)seed);	// each grid has its own generator, so games sharing a process stay reproducible
 
 	// we check if there is a potential for us to not have enough spaces to populate gold and users.
 	// if this is the case, we tell the server, free the grid, and exit.
 	if (calculate_dots(grid) < (MaxPlayers + max_gold_piles)) {
 		printf("Insufficient room spots to populate gold and users!\n");
 		grid_delete(grid);
-		fclose(map);
 		return NULL;
 	}
 
+	free_index_new(grid);	// every room cell is free until gold goes down
 	grid_populate_gold(grid, min_gold_piles, max_gold_piles, total_gold);	// puts gold in various piles
 
-	fclose(map);
 	return grid;
 }
 
+/**************** load_map ****************/
+// Maps the whole map file into memory and builds the cells from it.
+// Returns false, having printed why, if the file cannot be read or is
+// not a rectangular map.
+static bool
+load_map(grid_t *grid, const char *filename){
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		printf("Map file %s is not readable!\n", filename);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		printf("Map file %s is empty!\n", filename);
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	const char *text = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);	// the mapping keeps the file open
+	if (text == MAP_FAILED) {
+		printf("Map file %s could not be mapped!\n", filename);
+		return false;
+	}
+
+	// a compiled map stays mapped for the grid's lifetime
+	if (size >= sizeof(map_header_t) && memcmp(text, MapMagic, sizeof(MapMagic)) == 0) {
+		if (load_compiled(grid, text, size)) {
+			return true;
+		}
+		printf("Map file %s is not a valid compiled map!\n", filename);
+		munmap((void *)text, size);
+		return false;
+	}
+
+	madvise((void *)text, size, MADV_SEQUENTIAL);
+	bool ok = generate_cells(grid, text, size);
+	munmap((void *)text, size);
+	return ok;
+}
+
+/**************** load_compiled ****************/
+// Checks a compiled map's header and sections against its size, and the
+// contents that are used as indexes against the planes, then keeps the
+// mapping in grid->map and points the terrain planes into it.
+static bool
+load_compiled(grid_t *grid, const char *base, size_t size){
+	const map_header_t *header = (const map_header_t *)base;
+	if (header->version != MapVersion || header->rows == 0 || header->cols == 0
+			|| header->rows > INT_MAX / GridTileSize || header->cols > INT_MAX / GridTileSize) {
+		return false;
+	}
+	uint64_t tile_rows = (header->rows + GridTileSize - 1) / GridTileSize;
+	uint64_t tile_cols = (header->cols + GridTileSize - 1) / GridTileSize;
+	uint64_t cells = tile_rows * tile_cols * GridTileCells;
+	if (cells > INT_MAX) {	// cell numbers are ints
+		return false;
+	}
+	grid->num_rows = header->rows;
+	grid->num_cols = header->cols;
+	grid->tile_rows = tile_rows;
+	grid->tile_cols = tile_cols;
+	grid->num_tiles = tile_rows * tile_cols;
+	uint64_t bitmap_words = cells / 64;
+	//each section must lie within the file
+	struct { uint64_t offset; uint64_t length; } sections[] = {
+		{ header->chars, cells },
+		{ header->walkable, bitmap_words * sizeof(uint64_t) },
+		{ header->walk_index, cells * sizeof(int32_t) },
+		{ header->dots, (uint64_t)header->num_dots * sizeof(uint32_t) },
+		{ header->visibility, (uint64_t)header->num_walkable * header->vis_words * sizeof(uint64_t) },
+	};
+	for (int i = 0; i < sizeof(sections) / sizeof(sections[0]); i++) {
+		if (sections[i].offset % 8 != 0 || sections[i].offset > size || sections[i].length > size - sections[i].offset) {
+			return false;
+		}
+	}
+	if (header->chars % MapPageSize != 0) {
+		return false;
+	}
+	if (header->vis_words != 0 && header->vis_words != bitmap_words) {
+		return false;
+	}
+	if (!compiled_valid(grid, base)) {
+		return false;
+	}
+
+	grid_map_t *map = malloc(sizeof(grid_map_t));
+	assertp(map, "Error allocating memory to grid map\n");
+	map->base = base;
+	map->size = size;
+	map->header = header;
+	map->walkable = (const uint64_t *)(base + header->walkable);
+	map->walk_index = (const int32_t *)(base + header->walk_index);
+	map->dots = (const uint32_t *)(base + header->dots);
+	map->visibility = (header->vis_words == 0) ? NULL : (const uint64_t *)(base + header->visibility);
+
+	//terrain and walkability are read straight from the mapping
+	grid->terrain = base + header->chars;
+	grid->walkable = map->walkable;
+	grid->map = map;
+	planes_new(grid, true);
+	return true;
+}
+
+/**************** compiled_valid ****************/
+// The sections are known to lie within the file. Each dot must be a room
+// cell inside the map, after the one before it in row-major order, as
+// dot_rank searches them; free_positions skips room cells left out.
+// walk_index values pick rows of the visibility table, so they are
+// checked only when there is one. Only the dots are read otherwise, so
+// tiles away from the rooms stay on disk.
+static bool
+compiled_valid(grid_t *grid, const char *base){
+	const map_header_t *header = (const map_header_t *)base;
+	const char *chars = base + header->chars;
+	const uint64_t *walkable = (const uint64_t *)(base + header->walkable);
+	const uint32_t *dots = (const uint32_t *)(base + header->dots);
+	uint32_t cells = grid->num_tiles * GridTileCells;
+
+	long previous = -1;
+	for (uint32_t i = 0; i < header->num_dots; i++) {
+		uint32_t dot = dots[i];
+		if (dot >= cells || chars[dot] != '.' || !((walkable[dot / 64] >> (dot % 64)) & 1)) {
+			return false;
+		}
+		int row = cell_row(grid, dot), col = cell_col(grid, dot);
+		long place = (long)row * grid->num_cols + col;
+		if (row >= grid->num_rows || col >= grid->num_cols || place <= previous) {
+			return false;
+		}
+		previous = place;
+	}
+
+	if (header->vis_words != 0) {
+		const int32_t *walk_index = (const int32_t *)(base + header->walk_index);
+		for (uint32_t i = 0; i < cells; i++) {
+			if (walk_index[i] < -1 || (walk_index[i] >= 0 && (uint32_t)walk_index[i] >= header->num_walkable)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**************** grid_compile ****************/
+bool
+grid_compile(char *filename, char *outname, bool visibility){
+	grid_t *grid = calloc(1, sizeof(grid_t));	// just the cells; nothing else is set up
+	assertp(grid, "Error allocating memory to grid\n");
+	if (!load_map(grid, filename)) {
+		free(grid);
+		return false;
+	}
+	if (grid->map != NULL) {	// visibility is computed from the cells below, never from a table
+		grid->map->visibility = NULL;
+	}
+
+	uint32_t cells = grid->num_tiles * GridTileCells;
+	uint32_t bitmap_words = cells / 64;
+	int32_t *walk_index = malloc(cells * sizeof(int32_t));
+	uint32_t *dots = malloc(cells * sizeof(uint32_t));
+	uint32_t *viewers = malloc(cells * sizeof(uint32_t));	// cell number of each walkable cell
+	assertp(walk_index, "Error allocating memory to compiled map\n");
+	assertp(dots, "Error allocating memory to compiled map\n");
+	assertp(viewers, "Error allocating memory to compiled map\n");
+
+	map_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MapMagic, sizeof(MapMagic));
+	header.version = MapVersion;
+	header.rows = grid->num_rows;
+	header.cols = grid->num_cols;
+	for (uint32_t i = 0; i < cells; i++) {
+		walk_index[i] = -1;
+		if (cell_walkable(grid, i)) {
+			walk_index[i] = header.num_walkable;
+			viewers[header.num_walkable++] = i;
+		}
+	}
+	//room cells are listed row by row, the order dot_index lists them in
+	for (int row = 0; row < grid->num_rows; row++) {
+		for (int col = 0; col < grid->num_cols; col++) {
+			if (grid->terrain[cell_at(grid, row, col)] == '.') {
+				dots[header.num_dots++] = cell_at(grid, row, col);
+			}
+		}
+	}
+
+	uint64_t *table = NULL;
+	if (visibility) {
+		header.vis_words = bitmap_words;
+		table = calloc((size_t)header.num_walkable * bitmap_words, sizeof(uint64_t));
+		assertp(table, "Error allocating memory to visibility table\n");
+		for (uint32_t w = 0; w < header.num_walkable; w++) {
+			int px = cell_row(grid, viewers[w]);
+			int py = cell_col(grid, viewers[w]);
+			uint64_t *bits = table + (size_t)w * bitmap_words;
+			for (int row = 0; row < grid->num_rows; row++) {
+				for (int col = 0; col < grid->num_cols; col++) {
+					if (grid_isVisible(grid, px, py, row, col)) {
+						int i = cell_at(grid, row, col);
+						bits[i / 64] |= (uint64_t)1 << (i % 64);
+					}
+				}
+			}
+		}
+	}
+
+	//the header goes first, rewritten once the section offsets are known
+	bool ok = false;
+	FILE *fp = fopen(outname, "w");
+	if (fp != NULL) {
+		uint64_t offset = 0;
+		uint64_t start;
+		ok = write_section(fp, &offset, &start, &header, sizeof(header), 8);
+		ok = ok && write_section(fp, &offset, &header.chars, grid->terrain, cells, MapPageSize);
+		ok = ok && write_section(fp, &offset, &header.walkable, grid->walkable, bitmap_words * sizeof(uint64_t), 8);
+		ok = ok && write_section(fp, &offset, &header.walk_index, walk_index, cells * sizeof(int32_t), 8);
+		ok = ok && write_section(fp, &offset, &header.dots, dots, header.num_dots * sizeof(uint32_t), 8);
+		if (table != NULL) {
+			ok = ok && write_section(fp, &offset, &header.visibility, table, (size_t)header.num_walkable * bitmap_words * sizeof(uint64_t), 8);
+		}
+		ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+		ok = (fclose(fp) == 0) && ok;
+	}
+	if (!ok) {
+		printf("Could not write compiled map %s!\n", outname);
+	}
+
+	free(walk_index);
+	free(dots);
+	free(viewers);
+	free(table);
+	grid_delete(grid);
+	return ok;
+}
+
+/**************** write_section ****************/
+// Pads the file from *offset to a multiple of align, then writes size
+// bytes there; sets *start to where they start and advances *offset.
+static bool
+write_section(FILE *fp, uint64_t *offset, uint64_t *start, const void *data, size_t size, size_t align){
+	for (; *offset % align != 0; (*offset)++) {
+		if (fputc(0, fp) == EOF) {
+			return false;
+		}
+	}
+	if (size > 0 && fwrite(data, size, 1, fp) != 1) {
+		return false;
+	}
+	*start = *offset;
+	*offset += size;
+	return true;
+}
+
 /****************  generate_cells ****************/
-// This function populates the cell struct
-static void 
-generate_cells(cell_t **cells, FILE* map){
-	//set file pointer to beginning of map file
-	rewind(map);
-	//initialize row and column
-	int row = 0;
-	int col = 0;
-	char c;
-	//loop through map
-	while ((c = fgetc(map)) != EOF) {
-		fflush(stdout); //clear the standard output and move it to console
-		if (c == '\n') { //if the current character is a new line, increment row and reset col
-			row++;
-			col = 0;
-		}else{ //otherwise, create a new cell at the location with the current character and incrememnt col
-			cell_t n_cell = cell_new(c, row, col);
-			memcpy(&cells[row][col], &n_cell, sizeof(cell_t)); // Copies the generated cell into cells 2D array
-			col++;
-		}
-	}
-	rewind(map); //reset file pointer back to beginning of map
-}
-
-
-
-/**************** cell_new ****************/
-static cell_t 
-cell_new(char default_char, int row, int col){
-	//initialize cell object with the default character
-	cell_t cell; 
-	cell.default_char = default_char;
-	//if the default chaacter is a # or period set the is_walkable property of the cell to true
-	if (default_char == '#'|| default_char == '.') {
-		cell.is_walkable = true;
-	} else{ //otherwise, set it to false
-		cell.is_walkable = false;
-	}
-	cell.row = row; //update the cell row and col to the respective parameters
-	cell.col = col;
-	cell.gold = 0; //initialize gold count to 0
-	cell.tag = '\0'; //initialize tag to null
-	return cell; //return the cell
-
-}
-
-/**************** calculate_rows ****************/
-// This is the same as the lines_in_file function from file.h
-static int
-calculate_rows(FILE* fp)
-{	
-	if (fp == NULL) { //if the file is null return 0
-		return 0;
+// Fills the cells from the map text in one pass. The first line sets the
+// width; since every line must match it, the height follows from the size.
+// The last line need not end in a newline.
+static bool
+generate_cells(grid_t *grid, const char *text, size_t size){
+	const char *end = text + size;
+	const char *newline = memchr(text, '\n', size);
+	size_t num_cols = (newline == NULL) ? size : (size_t)(newline - text);
+	if (num_cols == 0) {
+		printf("Map has an empty first row!\n");
+		return false;
+	}
+	size_t num_rows = (size + num_cols) / (num_cols + 1);	// a full last row may lack its newline
+	if (num_rows * (num_cols + 1) != size && num_rows * (num_cols + 1) - 1 != size) {
+		printf("Map rows are not all %zu characters wide!\n", num_cols);
+		return false;
 	}
 
-	rewind(fp); //reset file pointer back to beginning of file
+	grid->num_rows = num_rows;
+	grid->num_cols = num_cols;
+	grid->tile_rows = (num_rows + GridTileSize - 1) / GridTileSize;
+	grid->tile_cols = (num_cols + GridTileSize - 1) / GridTileSize;
+	grid->num_tiles = grid->tile_rows * grid->tile_cols;
+	planes_new(grid, false);
+	char *terrain = (char *)grid->terrain;	// planes_new allocated these writable
+	uint64_t *walkable = (uint64_t *)grid->walkable;
+	const char *line = text;
+	for (size_t row = 0; row < num_rows; row++) {
+		//the size matches, but every line must also end where the first did
+		const char *line_end = memchr(line, '\n', end - line);
+		if (line_end == NULL) {
+			line_end = end;
+		}
+		if ((size_t)(line_end - line) != num_cols) {
+			printf("Map row %zu is %zu characters wide, not %zu!\n", row, (size_t)(line_end - line), num_cols);
+			free(grid->planes);
+			grid->planes = NULL;
+			return false;
+		}
 
-	int nlines = 0; //initialize a count for rows and character holder to iterate the file
-	char c = '\0';
-	while ( (c = fgetc(fp)) != EOF) { //loop through the file
-		if (c == '\n') { //if a newline, increment the row count
-			nlines++;
+		for (size_t col = 0; col < num_cols; col += GridTileSize) { //copy the part of the line in each tile
+			size_t width = (num_cols - col < GridTileSize) ? num_cols - col : GridTileSize;
+			memcpy(terrain + cell_at(grid, row, col), line + col, width);
 		}
+		for (size_t col = 0; col < num_cols; col++) {
+			if (char_walkable(line[col])) {
+				int cell = cell_at(grid, row, col);
+				walkable[cell / 64] |= (uint64_t)1 << (cell % 64);
+			}
+		}
+		line = line_end + 1;
+	}
+	return true;
+}
+
+/**************** planes_new ****************/
+// Allocates the terrain and walkable planes in one block, unless a
+// compiled map (mapped) provides them. Terrain starts as solid rock
+// (' '), which is what the cells past the map's edges stay.
+static void
+planes_new(grid_t *grid, bool mapped){
+	grid->planes = NULL;
+	if (mapped) {
+		return;
 	}
+	size_t cells = (size_t)grid->num_tiles * GridTileCells;
+	size_t walkable_size = cells / 64 * sizeof(uint64_t);
+
+	//walkable first, so it is aligned
+	char *planes = calloc(1, walkable_size + cells);
+	assertp(planes, "Error allocating memory to cells\n");
+	memset(planes + walkable_size, ' ', cells);
+	grid->planes = planes;
+	grid->walkable = (uint64_t *)planes;
+	grid->terrain = planes + walkable_size;
+}
+
+/**************** cell_at ****************/
+// Cells are numbered tile by tile, and row by row within a tile, so the
+// cells of a tile are contiguous in every plane.
+static inline int
+cell_at(const grid_t *grid, int row, int col){
+	int tile = (row / GridTileSize) * grid->tile_cols + (col / GridTileSize);
+	return tile * GridTileCells + (row % GridTileSize) * GridTileSize + (col % GridTileSize);
+}
+
+/**************** cell_row ****************/
+static inline int
+cell_row(const grid_t *grid, int cell){
+	int tile = cell / GridTileCells;
+	return (tile / grid->tile_cols) * GridTileSize + (cell % GridTileCells) / GridTileSize;
+}
+
+/**************** cell_col ****************/
+static inline int
+cell_col(const grid_t *grid, int cell){
+	int tile = cell / GridTileCells;
+	return (tile % grid->tile_cols) * GridTileSize + cell % GridTileSize;
+}
+
+/**************** cell_walkable ****************/
+static inline bool
+cell_walkable(const grid_t *grid, int cell){
+	return (grid->walkable[cell / 64] >> (cell % 64)) & 1;
+}
 
-	rewind(fp); //reset file pointer back to beginning of file
-	
-	return nlines; //return the row count
+/**************** char_walkable ****************/
+// Only room spots ('.') and passages ('#') can be walked on.
+static inline bool
+char_walkable(char c){
+	return c == '#' || c == '.';
 }
 
-/**************** calculate_cols ****************/
+/**************** tag_at ****************/
+static inline char
+tag_at(const grid_t *grid, int cell){
+	cell_tile_t *tile = grid->tiles[cell / GridTileCells];
+	return (tile == NULL) ? '\0' : tile->tags[cell % GridTileCells];
+}
+
+/**************** gold_at ****************/
+static inline int
+gold_at(const grid_t *grid, int cell){
+	cell_tile_t *tile = grid->tiles[cell / GridTileCells];
+	return (tile == NULL) ? 0 : tile->gold[cell % GridTileCells];
+}
+
+/**************** tile_for_write ****************/
+// Returns the state of a cell's tile, creating it if the tile was empty.
+static cell_tile_t *
+tile_for_write(grid_t *grid, int cell){
+	int t = cell / GridTileCells;
+	if (grid->tiles[t] == NULL) {
+		grid->tiles[t] = calloc(1, sizeof(cell_tile_t));
+		assertp(grid->tiles[t], "Error allocating memory to a tile\n");
+	}
+	return grid->tiles[t];
+}
+
+/**************** set_tag ****************/
+static void
+set_tag(grid_t *grid, int cell, char tag){
+	tile_for_write(grid, cell)->tags[cell % GridTileCells] = tag;
+	free_update(grid, cell);
+}
+
+/**************** set_gold ****************/
+static void
+set_gold(grid_t *grid, int cell, int gold){
+	tile_for_write(grid, cell)->gold[cell % GridTileCells] = gold;
+	free_update(grid, cell);
+}
+
+/**************** free_index_new ****************/
+// Starts the free cells off as every room cell, in the order of dots.
+// Nothing is copied yet: a chunk of free_cells, and a tile's free_pos,
+// are made only once a cell in them changes (free_set, free_positions),
+// so the index grows with the cells that players and gold have touched.
+static void
+free_index_new(grid_t *grid){
+	dot_index(grid);
+	grid->num_free = grid->num_dots;
+	grid->free_cells = calloc(grid->num_dots / FreeChunk + 1, sizeof(int32_t *));
+	assertp(grid->free_cells, "Error allocating memory to free cells\n");
+	grid->free_pos = calloc(grid->num_tiles, sizeof(int32_t *));
+	assertp(grid->free_pos, "Error allocating memory to free cell positions\n");
+}
+
+/**************** free_update ****************/
+// A room cell is free while it has neither a player nor gold. Adding
+// appends it; removing moves the last free cell into its place.
+static void
+free_update(grid_t *grid, int cell){
+	if (grid->free_pos == NULL || grid->terrain[cell] != '.') {
+		return;
+	}
+	int32_t *pos = &free_positions(grid, cell / GridTileCells)[cell % GridTileCells];
+	if (*pos == FreeUnlisted) {
+		return;
+	}
+	bool empty = tag_at(grid, cell) == '\0' && gold_at(grid, cell) == 0;
+	if (empty && *pos < 0) {
+		*pos = grid->num_free;
+		free_set(grid, grid->num_free++, cell);
+	}
+	else if (!empty && *pos >= 0) {
+		int last = free_get(grid, --grid->num_free);
+		free_set(grid, *pos, last);
+		free_positions(grid, last / GridTileCells)[last % GridTileCells] = *pos;
+		*pos = -1;
+	}
+}
+
+/**************** free_get ****************/
+// A chunk not yet made still holds its entries of dots.
 static int
-calculate_cols(FILE* fp)
-{	
-	if (fp == NULL) { // if the file is null return 0
-		return 0;
+free_get(grid_t *grid, int i){
+	int32_t *chunk = grid->free_cells[i / FreeChunk];
+	return (chunk == NULL) ? (int)grid->dots[i] : chunk[i % FreeChunk];
+}
+
+/**************** free_set ****************/
+// Makes the chunk holding index i from dots, if not made yet.
+static void
+free_set(grid_t *grid, int i, int cell){
+	int32_t **chunk = &grid->free_cells[i / FreeChunk];
+	if (*chunk == NULL) {
+		*chunk = malloc(FreeChunk * sizeof(int32_t));
+		assertp(*chunk, "Error allocating memory to free cells\n");
+		int first = i - i % FreeChunk;
+		for (int j = first; j < first + FreeChunk && j < grid->num_dots; j++) {
+			(*chunk)[j - first] = grid->dots[j];
+		}
+	}
+	(*chunk)[i % FreeChunk] = cell;
+}
+
+/**************** free_positions ****************/
+// Returns the index in free_cells of each cell of a tile, -1 for cells
+// not there, making it on first use. Until then no room cell of the tile
+// has changed, nor been moved by a removal, so each is still free at its
+// place in dots. A room cell a compiled map's dots leave out is marked
+// FreeUnlisted and never enters the index.
+static int32_t *
+free_positions(grid_t *grid, int tile){
+	int32_t **pos = &grid->free_pos[tile];
+	if (*pos == NULL) {
+		*pos = malloc(GridTileCells * sizeof(int32_t));
+		assertp(*pos, "Error allocating memory to free cell positions\n");
+		//a tile's room cells in one row are consecutive in dots
+		int first = tile * GridTileCells;
+		int top = cell_row(grid, first);
+		int left = cell_col(grid, first);
+		for (int r = 0; r < GridTileSize; r++) {
+			int rank = (top + r < grid->num_rows) ? dot_rank(grid, top + r, left) : 0;
+			for (int c = 0; c < GridTileSize; c++) {
+				int i = r * GridTileSize + c;
+				if (grid->terrain[first + i] != '.') {
+					(*pos)[i] = -1;
+				}
+				else if (rank < grid->num_dots && grid->dots[rank] == first + i) {
+					(*pos)[i] = rank++;
+				}
+				else {
+					(*pos)[i] = FreeUnlisted;
+				}
+			}
+		}
 	}
+	return *pos;
+}
+
+/**************** grid_known_new ****************/
+uint64_t **
+grid_known_new(grid_t *grid){
+	uint64_t **known = calloc(grid->num_tiles, sizeof(uint64_t *));	// nothing known yet
+	assertp(known, "Error allocating memory to known tiles\n");
+	return known;
+}
 
-	rewind(fp); //reset file pointer back to beginning of file
+/**************** grid_known_delete ****************/
+void
+grid_known_delete(grid_t *grid, uint64_t **known){
+	if (known == NULL) {
+		return;
+	}
+	for (int t = 0; t < grid->num_tiles; t++) {
+		free(known[t]);
+	}
+	free(known);
+}
+
+/**************** known_get ****************/
+static bool
+known_get(const grid_t *grid, uint64_t **known, int cell){
+	uint64_t *bits = known[cell / GridTileCells];
+	int i = cell % GridTileCells;
+	return bits != NULL && ((bits[i / 64] >> (i % 64)) & 1);
+}
 
-	int num_cols = 0; //initialize a count for columns and character holder to iterate the file
-	char c = '\0';
-	while ( (c = fgetc(fp)) != '\n') { //loop through the file
-		num_cols++; //if not a new line, incrememnet the column count
+/**************** known_set ****************/
+// Marks a cell known, allocating the bits of its tile on the player's
+// first sight into the tile.
+static void
+known_set(grid_t *grid, uint64_t **known, int cell){
+	int t = cell / GridTileCells;
+	if (known[t] == NULL) {
+		known[t] = calloc(GridTileCells / 64, sizeof(uint64_t));
+		assertp(known[t], "Error allocating memory to known tile\n");
 	}
+	int i = cell % GridTileCells;
+	known[t][i / 64] |= (uint64_t)1 << (i % 64);
+}
 
-	rewind(fp); //reset file pointer back to beginning of file
-	
-	return num_cols; //return column count
+/**************** grid_set_viewport ****************/
+void
+grid_set_viewport(grid_t *grid, int rows, int cols){
+	grid->view_rows = (rows < grid->num_rows) ? rows : grid->num_rows;
+	grid->view_cols = (cols < grid->num_cols) ? cols : grid->num_cols;
+}
+
+/**************** view_origin ****************/
+// The view is centered on (row, col), but shifted to stay within the map.
+static void
+view_origin(grid_t *grid, int row, int col, int *top, int *left){
+	*top = row - grid->view_rows / 2;
+	*left = col - grid->view_cols / 2;
+	if (*top > grid->num_rows - grid->view_rows) {
+		*top = grid->num_rows - grid->view_rows;
+	}
+	if (*left > grid->num_cols - grid->view_cols) {
+		*left = grid->num_cols - grid->view_cols;
+	}
+	if (*top < 0) {
+		*top = 0;
+	}
+	if (*left < 0) {
+		*left = 0;
+	}
 }
 
 /**************** calculate_dots ****************/
 static int
 calculate_dots(grid_t *grid)
 {	
+	if (grid->map != NULL) { //a compiled map has counted them
+		return grid->map->header->num_dots;
+	}
 	int num_dots = 0; //initialize a count for dots
-	for (int i = 0; i < grid->num_rows; i++){ //loop through the number of rows
-		for (int j = 0; j < grid->num_cols; j++){//loop through the number of cols
-			if (grid->cells[i][j].default_char == '.'){//if the current cell is a dot increment dot count			
-				num_dots++;
-			}
+	int cells = grid->num_tiles * GridTileCells;
+	for (int i = 0; i < cells; i++){ //loop through the terrain
+		if (grid->terrain[i] == '.'){ //if the current cell is a dot increment dot count
+			num_dots++;
 		}
 	}
 	return num_dots; //return num dots
 }
 
-/**************** get_cell ****************/
-static cell_t*  
-get_cell(grid_t *grid, int dot_number){
-	int num_dots = 0; //initialize a count for dots
+/**************** dot_index ****************/
+// Sets dots to the room cells, row by row, and num_dots to their number.
+// A compiled map lists them, and is used in place; a text map is scanned
+// once into a new array.
+static void
+dot_index(grid_t *grid){
+	grid->num_dots = calculate_dots(grid);
+	if (grid->map != NULL) { //a compiled map lists them
+		grid->dots = grid->map->dots;
+		return;
+	}
+	uint32_t *dots = malloc((grid->num_dots + 1) * sizeof(uint32_t));
+	assertp(dots, "Error allocating memory to dot index\n");
+	grid->dots = dots;
+	int n = 0;
 	for (int i = 0; i < grid->num_rows; i++){ //loop through the number of rows
 		for (int j = 0; j < grid->num_cols; j++){ //loop through the number of cols
-			if (grid->cells[i][j].default_char == '.'){ //if the cell is a dot and the dot number refers to that dot, return it's cell address
-				if (dot_number == num_dots) { 
-					return &(grid->cells[i][j]);
-				}
-				num_dots++; //incrememt num dots
+			int cell = cell_at(grid, i, j);
+			if (grid->terrain[cell] == '.'){
+				dots[n++] = cell;
 			}
 		}
 	}
-	return NULL; //return null if no dots were found
 }
 
-
-/**************** grid_populate_gold ****************/
-static void 
-grid_populate_gold(grid_t* grid, int min_gold_piles, int max_gold_piles, int total_gold){
-	int num_dots = calculate_dots(grid); //set holder for number of dots in grid
-	int num_gold_piles = (rand() % (max_gold_piles - min_gold_piles + 1)) + min_gold_piles; //set the number of gold piles in grid to random number based on max/min params
-	int gold_in_piles[num_gold_piles]; //initialize int array for all the gold piles
-	for (int i = 0; i < num_gold_piles; i++){ //set every element in int array to 1
-		gold_in_piles[i] = 1;
+/**************** dot_rank ****************/
+// Binary searches dots, which is in row-major order, for the first room
+// cell at or after (row, col); num_dots if there is none.
+static int
+dot_rank(grid_t *grid, int row, int col){
+	long key = (long)row * grid->num_cols + col;
+	int low = 0, high = grid->num_dots;
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+		int dot = grid->dots[mid];
+		if ((long)cell_row(grid, dot) * grid->num_cols + cell_col(grid, dot) < key) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
 	}
+	return low;
+}
 
-	int remaining_gold = total_gold - num_gold_piles; //set remaining gold to the difference of total amount of gold and the number of gold piles
+/**************** random_seed ****************/
+// The grid's generator is PCG32: a 64-bit linear congruential state put
+// through a permuted output function. Seeding follows pcg32_srandom.
+static const uint64_t RandomMultiplier = 6364136223846793005ULL;
+static const uint64_t RandomIncrement = 1442695040888963407ULL;	// any odd constant
+
+static void
+random_seed(grid_t *grid, uint64_t seed){
+	grid->rng = 0;
+	random_next(grid);
+	grid->rng += seed;
+	random_next(grid);
+}
+
+/**************** random_next ****************/
+static uint32_t
+random_next(grid_t *grid){
+	uint64_t old = grid->rng;
+	grid->rng = old * RandomMultiplier + RandomIncrement;
+	uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+	uint32_t rot = (uint32_t)(old >> 59);
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
 
-	for (int i = 0; i < remaining_gold; i++) { //randomly select and increment gold piles by the amount of remaining gold
-		int cell_number = rand() % num_gold_piles;
-		gold_in_piles[cell_number]++;
+/**************** random_below ****************/
+// Scales 32 random bits into [0, bound) with a multiply instead of a
+// division, rejecting the few values that would bias it (Lemire).
+static int
+random_below(grid_t *grid, int bound){
+	uint32_t range = (uint32_t)bound;
+	uint64_t product = (uint64_t)random_next(grid) * range;
+	if ((uint32_t)product < range) {
+		uint32_t threshold = -range % range;
+		while ((uint32_t)product < threshold) {
+			product = (uint64_t)random_next(grid) * range;
+		}
 	}
+	return (int)(product >> 32);
+}
 
-	for (int i = 0; i < num_gold_piles;) { //for the number of gold piles
-		int dot_number = rand() % num_dots;
-		cell_t *cell = get_cell(grid, dot_number); //select a random cell in the grid
-		if (cell->gold == 0) { //if the gold property in that cell is equal to 0
-			cell->gold = gold_in_piles[i]; //set the gold property in that cell to the count in a gold pile
-			i++; //move to another gold pile
+/**************** split_gold ****************/
+// Splits total_gold into num_piles piles of at least one nugget each,
+// every such split being equally likely: lines the nuggets up and cuts
+// between them at num_piles - 1 distinct places (stars and bars). The
+// cuts are drawn with Floyd's algorithm, so only num_piles random
+// numbers are needed however much gold there is.
+static void
+split_gold(grid_t *grid, int total_gold, int num_piles, int *piles){
+	if (total_gold < num_piles) { //not enough to go around; one nugget each
+		for (int i = 0; i < num_piles; i++) {
+			piles[i] = 1;
+		}
+		return;
+	}
+	int cuts[num_piles]; //sorted cut places, 1..total_gold-1
+	int num_cuts = 0;
+	for (int j = total_gold - num_piles + 1; j < total_gold; j++) {
+		int cut = 1 + random_below(grid, j);
+		int pos = 0;
+		while (pos < num_cuts && cuts[pos] < cut) {
+			pos++;
 		}
+		if (pos < num_cuts && cuts[pos] == cut) { //taken; j is new and beyond every cut so far
+			cut = j;
+			pos = num_cuts;
+		}
+		memmove(&cuts[pos + 1], &cuts[pos], (num_cuts - pos) * sizeof(int));
+		cuts[pos] = cut;
+		num_cuts++;
+	}
+	int last = 0;
+	for (int i = 0; i < num_cuts; i++) {
+		piles[i] = cuts[i] - last;
+		last = cuts[i];
+	}
+	piles[num_piles - 1] = total_gold - last;
+}
+
+/**************** grid_populate_gold ****************/
+// Puts each pile on a distinct room cell drawn from the free cells. Each
+// pick leaves the free cells as it is covered, so this is a partial
+// Fisher-Yates shuffle of the room cells.
+static void 
+grid_populate_gold(grid_t* grid, int min_gold_piles, int max_gold_piles, int total_gold){
+	int num_gold_piles = random_below(grid, max_gold_piles - min_gold_piles + 1) + min_gold_piles; //set the number of gold piles in grid to random number based on max/min params
+	int gold_in_piles[num_gold_piles]; //initialize int array for all the gold piles
+	split_gold(grid, total_gold, num_gold_piles, gold_in_piles);
+
+	for (int i = 0; i < num_gold_piles; i++) { //for the number of gold piles
+		int cell = free_get(grid, random_below(grid, grid->num_free)); //a room cell without gold yet
+		int row = cell_row(grid, cell);
+		int col = cell_col(grid, cell);
+		set_gold(grid, cell, gold_in_piles[i]); //set the gold in that cell to the count in a gold pile
+		journal_append(grid, GridEventGold, '\0', row, col, row, col, gold_in_piles[i]);
 	}
 }
 
 /**************** grid_remove_player ****************/
 void 
 grid_remove_player(grid_t* grid, player_t* player) {
-	(grid->cells)[player->row][player->col].tag = '\0'; //set the cell tag of that player to null. Rest is handled by server.c
+	set_tag(grid, cell_at(grid, player->row, player->col), '\0'); //set the cell tag of that player to null. Rest is handled by server.c
+	journal_append(grid, GridEventLeave, player->player_tag, player->row, player->col, player->row, player->col, 0);
 }
 
 
@@ -251,30 +944,42 @@ grid_move(grid_t *grid, player_t *player, int row, int col) {
 		return 0;
 	}
 
-	cell_t* move_to = &(grid->cells)[player->row+row][player->col+col]; //hold the address of the cell the player would potentially move to
+	int move_to = cell_at(grid, player->row+row, player->col+col); //hold the cell the player would potentially move to
 
-	if (!move_to->is_walkable) { //check if the move_to cell is not walkable. If so, return 0
+	if (!cell_walkable(grid, move_to)) { //check if the move_to cell is not walkable. If so, return 0
 		return 0;
 	}
 
-	cell_t* cur_cell = &((grid->cells)[player->row][player->col]); //otherwise, hold the current cell the player is in 
+	int cur_cell = cell_at(grid, player->row, player->col); //otherwise, hold the current cell the player is in 
+	int from_row = player->row;
+	int from_col = player->col;
 
 	player->row = player->row + row; //update the player location to the move location
 	player->col = player->col + col;
+	journal_append(grid, GridEventMove, player->player_tag, from_row, from_col, player->row, player->col, 0);
 
-	int gold_amt = move_to->gold; //save the gold amount of the move to cell, and then set the gold amount at that cell to 0
-	move_to->gold = 0;
+	int gold_amt = gold_at(grid, move_to); //save the gold amount of the move to cell, and then set the gold amount at that cell to 0
+	if (gold_amt > 0) {
+		set_gold(grid, move_to, 0);
+		if (grid->gold_field != NULL) { //the pile is no longer a place to travel to
+			field_remove_source(grid, grid->gold_field, move_to);
+		}
+	}
+	if (gold_amt > 0) {
+		journal_append(grid, GridEventPickup, player->player_tag, player->row, player->col, player->row, player->col, gold_amt);
+	}
 	//if the player would potentially move to empty square, set the tag at the move_to cell to the player_tag and remove the player tag at the current cell
-	if (move_to->tag == '\0') { 
-		move_to->tag = player->player_tag;
-		cur_cell->tag = '\0';
+	if (tag_at(grid, move_to) == '\0') { 
+		set_tag(grid, move_to, player->player_tag);
+		set_tag(grid, cur_cell, '\0');
 	}
 	else { //otherwise, move to the cell that the other player is occupying, and swap locations and player tags 
-		player_t* swap_player = ((grid->players)[move_to->tag-'A']);
-		cur_cell->tag = swap_player->player_tag;
-		move_to->tag = player->player_tag;
-		swap_player->row = player->row - row;
-		swap_player->col = player->col - col;
+		player_t* swap_player = ((grid->players)[tag_at(grid, move_to)-'A']);
+		set_tag(grid, cur_cell, swap_player->player_tag);
+		set_tag(grid, move_to, player->player_tag);
+		swap_player->row = from_row;
+		swap_player->col = from_col;
+		journal_append(grid, GridEventMove, swap_player->player_tag, player->row, player->col, from_row, from_col, 0);
 	}
 	grid->gold_remaining = grid->gold_remaining - gold_amt; //update remaining gold count in grid
 	player->gold_obtained+= gold_amt; //update gold obtained by player
@@ -292,10 +997,12 @@ grid_move_to_end(grid_t *grid, player_t *player, int row, int col) {
 	while (true) { 
 		gold_count = gold_count + grid_move(grid, player, row, col);
 
-		for (int x = 0; x < grid->num_rows; x++){ //loop through rows and cols in grid
-			for (int y = 0; y < grid->num_cols; y++){
+		int top, left; //only cells in the player's view can be seen
+		view_origin(grid, cur_row, cur_col, &top, &left);
+		for (int x = top; x < top + grid->view_rows; x++){ //loop through rows and cols in the view
+			for (int y = left; y < left + grid->view_cols; y++){
 				if (grid_isVisible(grid, cur_row, cur_col, x, y)){ //if the current cell is visible
-					player->known[x][y] = 1; //set the cell to known for the player
+					known_set(grid, player->known, cell_at(grid, x, y)); //set the cell to known for the player
 				}
 			}
 		}
@@ -310,6 +1017,187 @@ grid_move_to_end(grid_t *grid, player_t *player, int row, int col) {
 	return 0;
 }
 
+/**************** grid_gold_distance ****************/
+int
+grid_gold_distance(grid_t *grid, int row, int col){
+	uint32_t dist = gold_field(grid)->dist[cell_at(grid, row, col)];
+	return (dist == FieldFar) ? -1 : (int)dist;
+}
+
+/**************** grid_move_toward_gold ****************/
+// Steps to the first free neighbor, in key order, that is a step closer.
+int
+grid_move_toward_gold(grid_t *grid, player_t *player){
+	grid_field_t *field = gold_field(grid);
+	uint32_t here = field->dist[cell_at(grid, player->row, player->col)];
+	if (here == FieldFar || here == 0) {
+		return -1;
+	}
+	for (int d = 0; d < 8; d++) {
+		int row = player->row + FieldSteps[d][0];
+		int col = player->col + FieldSteps[d][1];
+		if (grid_in_bounds(grid, row, col)) {
+			int cell = cell_at(grid, row, col);
+			if (field->dist[cell] == here - 1 && tag_at(grid, cell) == '\0') {
+				return grid_move(grid, player, FieldSteps[d][0], FieldSteps[d][1]);
+			}
+		}
+	}
+	return 0; //every step closer has a player on it
+}
+
+/**************** gold_field ****************/
+// Computes the field on first use, by one search from every gold pile at once.
+static grid_field_t *
+gold_field(grid_t *grid){
+	if (grid->gold_field != NULL) {
+		return grid->gold_field;
+	}
+	size_t cells = (size_t)grid->num_tiles * GridTileCells;
+	grid_field_t *field = malloc(sizeof(grid_field_t));
+	assertp(field, "Error allocating memory to gold field\n");
+	field->dist = malloc(cells * sizeof(uint32_t));
+	field->source = malloc(cells * sizeof(int32_t));
+	field->queue = malloc(cells * sizeof(int));
+	assertp(field->dist, "Error allocating memory to gold field\n");
+	assertp(field->source, "Error allocating memory to gold field\n");
+	assertp(field->queue, "Error allocating memory to gold field\n");
+	memset(field->dist, 0xff, cells * sizeof(uint32_t));	// FieldFar
+	memset(field->source, 0xff, cells * sizeof(int32_t));	// -1
+
+	int tail = 0;
+	for (int t = 0; t < grid->num_tiles; t++) { //gold is only in tiles that have been written
+		if (grid->tiles[t] == NULL) {
+			continue;
+		}
+		for (int i = 0; i < GridTileCells; i++) {
+			if (grid->tiles[t]->gold[i] > 0) {
+				int cell = t * GridTileCells + i;
+				field->dist[cell] = 0;
+				field->source[cell] = cell;
+				field->queue[tail++] = cell;
+			}
+		}
+	}
+	for (int head = 0; head < tail; head++) {
+		tail = field_expand(grid, field, field->queue[head], tail);
+	}
+	grid->gold_field = field;
+	return field;
+}
+
+/**************** field_expand ****************/
+// Gives each walkable neighbor of a cell that is more than one step
+// further from a source the cell's source and one more step, and queues
+// it at field->queue[tail]. Returns the new tail.
+static int
+field_expand(grid_t *grid, grid_field_t *field, int cell, int tail){
+	int row = cell_row(grid, cell);
+	int col = cell_col(grid, cell);
+	uint32_t next = field->dist[cell] + 1;
+	for (int d = 0; d < 8; d++) {
+		if (!grid_in_bounds(grid, row + FieldSteps[d][0], col + FieldSteps[d][1])) {
+			continue;
+		}
+		int to = cell_at(grid, row + FieldSteps[d][0], col + FieldSteps[d][1]);
+		if (field->dist[to] > next && cell_walkable(grid, to)) {
+			field->dist[to] = next;
+			field->source[to] = field->source[cell];
+			field->queue[tail++] = to;
+		}
+	}
+	return tail;
+}
+
+/**************** field_remove_source ****************/
+// Removing a source only makes cells further from a source, and only the
+// cells that were nearest to it, which are connected to it. They are
+// cleared, then searched again from the cells around them, in order of
+// their steps, merged with the queue of cells reached.
+static void
+field_remove_source(grid_t *grid, grid_field_t *field, int source){
+	//the cells nearest to the source, found from it and marked -2 as found
+	int *region = field->queue;
+	int size = 0;
+	region[size++] = source;
+	field->source[source] = -2;
+	for (int i = 0; i < size; i++) {
+		int row = cell_row(grid, region[i]);
+		int col = cell_col(grid, region[i]);
+		for (int d = 0; d < 8; d++) {
+			if (grid_in_bounds(grid, row + FieldSteps[d][0], col + FieldSteps[d][1])) {
+				int to = cell_at(grid, row + FieldSteps[d][0], col + FieldSteps[d][1]);
+				if (field->source[to] == source) {
+					field->source[to] = -2;
+					region[size++] = to;
+				}
+			}
+		}
+	}
+	for (int i = 0; i < size; i++) {
+		field->dist[region[i]] = FieldFar;
+		field->source[region[i]] = -1;
+	}
+
+	//the cells around them that still reach a source; a cell may be listed more than once
+	int num_seeds = 0, max_seeds = 64;
+	field_seed_t *seeds = malloc(max_seeds * sizeof(field_seed_t));
+	assertp(seeds, "Error allocating memory to field seeds\n");
+	for (int i = 0; i < size; i++) {
+		int row = cell_row(grid, region[i]);
+		int col = cell_col(grid, region[i]);
+		for (int d = 0; d < 8; d++) {
+			if (grid_in_bounds(grid, row + FieldSteps[d][0], col + FieldSteps[d][1])) {
+				int to = cell_at(grid, row + FieldSteps[d][0], col + FieldSteps[d][1]);
+				if (field->dist[to] != FieldFar) {
+					if (num_seeds == max_seeds) {
+						max_seeds *= 2;
+						seeds = realloc(seeds, max_seeds * sizeof(field_seed_t));
+						assertp(seeds, "Error allocating memory to field seeds\n");
+					}
+					seeds[num_seeds].dist = field->dist[to];
+					seeds[num_seeds++].cell = to;
+				}
+			}
+		}
+	}
+	qsort(seeds, num_seeds, sizeof(field_seed_t), seed_compare);
+
+	//expand the nearest of the next seed and the next queued cell; the region list is done with
+	int head = 0, tail = 0, s = 0;
+	while (s < num_seeds || head < tail) {
+		int cell;
+		if (head == tail || (s < num_seeds && seeds[s].dist <= field->dist[field->queue[head]])) {
+			cell = seeds[s++].cell;
+		}
+		else {
+			cell = field->queue[head++];
+		}
+		tail = field_expand(grid, field, cell, tail);
+	}
+	free(seeds);
+}
+
+/**************** seed_compare ****************/
+static int
+seed_compare(const void *a, const void *b){
+	uint32_t x = ((const field_seed_t *)a)->dist;
+	uint32_t y = ((const field_seed_t *)b)->dist;
+	return (x > y) - (x < y);
+}
+
+/**************** field_delete ****************/
+static void
+field_delete(grid_field_t *field){
+	if (field == NULL) {
+		return;
+	}
+	free(field->dist);
+	free(field->source);
+	free(field->queue);
+	free(field);
+}
+
 /**************** int_len ****************/
 int 
 int_len(int i) {
@@ -319,24 +1207,38 @@ int_len(int i) {
 	return floor(log10(abs(i))) + 1; //return the largest integer value less than or equal to the float (log of the positive value of the int param)
 }
 
+/**************** grid_terrain ****************/
+char
+grid_terrain(grid_t *grid, int row, int col){
+	return grid->terrain[cell_at(grid, row, col)];
+}
+
 /**************** grid_isVisible ****************/
-static bool 
+bool 
 grid_isVisible(grid_t *grid, int x1, int y1, int x2, int y2 ){
-	if (grid->cells[x2][y2].default_char == ' '){ //if the cell is empty return false
+	if (grid->map != NULL && grid->map->visibility != NULL) { //look it up if the map was compiled with visibility
+		int32_t viewer = grid->map->walk_index[cell_at(grid, x1, y1)];
+		if (viewer >= 0) {
+			uint32_t cell = cell_at(grid, x2, y2);
+			const uint64_t *bits = grid->map->visibility + (size_t)viewer * grid->map->header->vis_words;
+			return (bits[cell / 64] >> (cell % 64)) & 1;
+		}
+	}
+	if (grid->terrain[cell_at(grid, x2, y2)] == ' '){ //if the cell is empty return false
 		return false;
 	}
 
 	if (x1 == x2){ //if in the same column
         if (y1< y2){  //if starting row is above current row
             for (int i = y1+1; i < y2; i++){  //move down vertically and check cells until at current cell
-                if (!grid->cells[x1][i].is_walkable){ //if the cell is not walkable, return false
+                if (!cell_walkable(grid, cell_at(grid, x1, i))){ //if the cell is not walkable, return false
                     return false;
                 }
             }
             return true; //return true if all cells in between are walkable
         } else { //otherwise
             for (int i = y1-1; i > y2; i--){ //move up vertically and check for cells until at current cell
-                if (!grid->cells[x1][i].is_walkable){ //if the cell is not walkable, return false
+                if (!cell_walkable(grid, cell_at(grid, x1, i))){ //if the cell is not walkable, return false
                     return false;
                 }
             }
@@ -348,14 +1250,14 @@ grid_isVisible(grid_t *grid, int x1, int y1, int x2, int y2 ){
     if (y1 == y2){ //if in the same row
         if (x1< x2){ //if starting col is to the left of current col
             for (int i = x1+1; i < x2; i++){ //move to the right until at current cell
-                if (!grid->cells[i][y1].is_walkable){ //if the cell is not walkable, return false
+                if (!cell_walkable(grid, cell_at(grid, i, y1))){ //if the cell is not walkable, return false
                     return false;
                 }
             }
             return true; //otherwise return true if none of the cells are not walkable
         } else { //otherwise
             for (int i = x1-1; i > x2; i--){ //move to the left until at the current cell
-                if (!grid->cells[i][y1].is_walkable){ //if the cell is not walkable, return false
+                if (!cell_walkable(grid, cell_at(grid, i, y1))){ //if the cell is not walkable, return false
                     return false;
                 }
             }
@@ -407,18 +1309,18 @@ static bool
 is_vertical_wall(grid_t *grid, int x, double y){
     int j = (int)floor(y);
     if (floor(y) == y){	// if [x][y], is an exact grid point      
-		if (grid->cells[x][j].default_char != '.'){
+		if (grid->terrain[cell_at(grid, x, j)] != '.'){
 			return true;
 		}
 
     } 
 	else { // if it is between two grid points
 		if (j == grid->num_cols - 1){
-			if (grid->cells[x][j].default_char != '.'){
+			if (grid->terrain[cell_at(grid, x, j)] != '.'){
 				return true;
 			}
 		} else{
-			if (grid->cells[x][j].default_char != '.' && grid->cells[x][j+1].default_char != '.'){
+			if (grid->terrain[cell_at(grid, x, j)] != '.' && grid->terrain[cell_at(grid, x, j+1)] != '.'){
             	return true;
         	}
 		}
@@ -433,16 +1335,16 @@ static bool
 is_horizontal_wall(grid_t *grid, double x, int y){
 	int j = (int)floor(x);
     if (floor(x) == x){     // if [x][y], is an exact grid point      
-		if (grid->cells[j][y].default_char != '.'){
+		if (grid->terrain[cell_at(grid, j, y)] != '.'){
 			return true;
 		}    
     } else{	// if [x][y] is between two grid points
 		if (j == grid->num_rows-1){
-			if (grid->cells[j][y].default_char != '.'){
+			if (grid->terrain[cell_at(grid, j, y)] != '.'){
 				return true;
 			}
 		}else{
-			if (grid->cells[j][y].default_char != '.' && grid->cells[j+1][y].default_char != '.'){
+			if (grid->terrain[cell_at(grid, j, y)] != '.' && grid->terrain[cell_at(grid, j+1, y)] != '.'){
             return true;
         	}
 		}
@@ -452,123 +1354,530 @@ is_horizontal_wall(grid_t *grid, double x, int y){
 
 
 /**************** grid_display_board ****************/
+// Renders every player's and the spectator's display.
+// Each view reads shared state and writes only its own player's
+// known and display, so the views are rendered as independent tasks on
+// the grid's pool (inline when it has none). The caller, the only thread
+// changing the grid, waits in pool_run until all of them are done, so
+// the tasks read the grid itself and never see a half-applied move.
 void 
 grid_display_board(grid_t *grid){
-	player_t *player; //initialize player holder and spectator validator boolean
-	bool is_spectator = false;
-	for (int i = 0; i <= grid->MaxPlayers; i++){ //loop through max amount of players in grid
-		if (i==grid->MaxPlayers) { //if at max players
-			player = grid->spectator; //set that player to spectator and set spectator validator to true
-			is_spectator = true;
-		}
-		else { //otherwise hold value of current player
-			player = grid->players[i];
+	pool_run(grid->pool, grid->MaxPlayers + 1, render_task, grid);
+}
+
+/**************** grid_render ****************/
+void
+grid_render(grid_t *grid, int slot, char *display){
+	player_t viewer = { .known = NULL };	// the spectator knows everything
+	if (slot >= 0) {
+		viewer = *grid->players[slot];	// shares the player's known table
+	}
+	viewer.display = display;
+	render_view(grid, &viewer, slot);
+}
+
+/**************** grid_render_changes ****************/
+// Each cell an event names is redrawn from the grid as it is now, so the
+// events' order does not matter: a swap's two moves end up right.
+void
+grid_render_changes(grid_t *grid, uint64_t *since, char *display){
+	grid_event_t events[64];
+	int count = 0;
+	if (*since == 0 || (count = grid_journal_read(grid, since, events, 64)) < 0) {
+		grid_render(grid, -1, display);
+		*since = grid_journal_seq(grid);
+		return;
+	}
+	int top, left;
+	view_origin(grid, grid->num_rows / 2, grid->num_cols / 2, &top, &left);
+	while (count > 0) {
+		for (int i = 0; i < count; i++) {
+			redraw_cell(grid, top, left, events[i].from_row, events[i].from_col, display);
+			redraw_cell(grid, top, left, events[i].row, events[i].col, display);
 		}
-		if (player == NULL) { //if that player is null, continue iteration
-			continue;
+		count = grid_journal_read(grid, since, events, 64);
+	}
+}
+
+/**************** redraw_cell ****************/
+// Redraws a cell of the spectator's view, whose top left is (top, left),
+// as render_view draws it; a cell outside the view is left alone.
+static void
+redraw_cell(grid_t *grid, int top, int left, int row, int col, char *display){
+	if (row < top || row >= top + grid->view_rows || col < left || col >= left + grid->view_cols) {
+		return;
+	}
+	int cell = cell_at(grid, row, col);
+	char c = grid->terrain[cell];
+	if (gold_at(grid, cell) > 0) {
+		c = '*';
+	}
+	else if (tag_at(grid, cell) != '\0') {
+		c = tag_at(grid, cell);
+	}
+	display[(row - top) * (grid->view_cols + 1) + (col - left)] = c;
+}
+
+/**************** render_task ****************/
+// Pool task rendering view number i: a player, or the spectator after the last player.
+static void
+render_task(void *arg, const int i){
+	grid_t *grid = arg;
+	if (i == grid->MaxPlayers) { //if at max players, render for the spectator
+		if (grid->spectator != NULL) {
+			render_view(grid, grid->spectator, -1);
 		}
-		int px = player->row; //hold the location of player and initialize display pointer
-		int py = player->col;
-		char *end_pointer = player->display; 
-		for (int row = 0; row < grid->num_rows; row++){ //loop through grid
-			for (int col = 0; col < grid->num_cols; col++){
-				cell_t cell = grid->cells[row][col]; //for each current cell
-				if (px == row && py == col && !is_spectator){ //if that cell is equal to the player's location and is not a spectator
-					player->known[row][col] = 1; //set that cell to known
-					sprintf(end_pointer, "@"); //use "@" sign to represent the current player
-				}
-				else if (is_spectator || grid_isVisible(grid, px, py, row, col)){ //otherwise if a spectator or that cell is visible in grid for player
-					if (!is_spectator) { //if the cell is just visible, set it to known for player
-						player->known[row][col] = 1;
-					}
-					if (cell.gold > 0){ //if that cell has gold, use "*" to represent it
-						sprintf(end_pointer, "*");
-					}
-					else if (cell.tag != '\0'){ //if the cell is not empty
-						sprintf(end_pointer, "%c", cell.tag); //just display the tag at the cell
-					} else{ //if the cell is empty, use default character at cell
-						sprintf(end_pointer, "%c", cell.default_char);
-					}
-					
+	}
+	else if (grid->players[i] != NULL && !grid->players[i]->player_quit) { //otherwise render for the current player, unless it quit
+		render_view(grid, grid->players[i], i);
+	}
+}
+
+/**************** render_view ****************/
+// Writes one view of the grid into a player's display: the part of the
+// grid around the player, or around the middle of the grid for the
+// spectator, which is all of it unless the server set a smaller viewport.
+// slot is the player's slot, or -1 for the spectator.
+static void
+render_view(grid_t *grid, player_t *player, int slot){
+	bool is_spectator = (slot < 0);
+	int px = is_spectator ? 0 : player->row; //hold the location of player and initialize display pointer
+	int py = is_spectator ? 0 : player->col;
+	int top, left;
+	if (is_spectator) {
+		view_origin(grid, grid->num_rows / 2, grid->num_cols / 2, &top, &left);
+	}
+	else {
+		view_origin(grid, px, py, &top, &left);
+	}
+	char *end_pointer = player->display; 
+	for (int row = top; row < top + grid->view_rows; row++){ //loop through the view
+		for (int col = left; col < left + grid->view_cols; col++){
+			int cell = cell_at(grid, row, col);
+			const cell_tile_t *state = grid->tiles[cell / GridTileCells]; //tags and gold of this tile
+			int i = cell % GridTileCells;
+			if (px == row && py == col && !is_spectator){ //if that cell is equal to the player's location and is not a spectator
+				known_set(grid, player->known, cell); //set that cell to known
+				*end_pointer = '@'; //use "@" sign to represent the current player
+			}
+			else if (is_spectator || grid_isVisible(grid, px, py, row, col)){ //otherwise if a spectator or that cell is visible in grid for player
+				if (!is_spectator) { //if the cell is just visible, set it to known for player
+					known_set(grid, player->known, cell);
 				}
-				else if(player->known[row][col] == 1){ //otherwise if the cell is already known to player
-					sprintf(end_pointer, "%c", cell.default_char); //just display the default character at that cell
+				if (state != NULL && state->gold[i] > 0){ //if that cell has gold, use "*" to represent it
+					*end_pointer = '*';
 				}
-				else{ //if just a spectator, display empty space
-					sprintf(end_pointer, " ");
+				else if (state != NULL && state->tags[i] != '\0'){ //if the cell is not empty
+					*end_pointer = state->tags[i]; //just display the tag at the cell
+				} else{ //if the cell is empty, use default character at cell
+					*end_pointer = grid->terrain[cell];
 				}
-				end_pointer++; //increment display pointer
+				
+			}
+			else if(known_get(grid, player->known, cell)){ //otherwise if the cell is already known to player
+				*end_pointer = grid->terrain[cell]; //just display the default character at that cell
 			}
-			sprintf(end_pointer, "\n"); //display a newline and increment display pointer
-			end_pointer++;
+			else{ //if just a spectator, display empty space
+				*end_pointer = ' ';
+			}
+			end_pointer++; //increment display pointer
 		}
+		*end_pointer = '\n'; //display a newline and increment display pointer
+		end_pointer++;
 	}
+	*end_pointer = '\0';
+}
+
 
+/**************** journal_append ****************/
+// Records one mutation in the journal, overwriting the oldest event when full.
+static void
+journal_append(grid_t *grid, grid_event_type_t type, char tag, int from_row, int from_col, int row, int col, int gold){
+	grid_journal_t *journal = grid->journal;
+	uint64_t seq = journal->next_seq++;
+	grid_event_t *event = &journal->events[seq % GridJournalCapacity];
+	event->seq = seq;
+	event->type = type;
+	event->tag = tag;
+	event->from_row = from_row;
+	event->from_col = from_col;
+	event->row = row;
+	event->col = col;
+	event->gold = gold;
 }
 
+/**************** grid_journal_seq ****************/
+uint64_t
+grid_journal_seq(grid_t *grid){
+	return grid->journal->next_seq;
+}
+
+/**************** grid_journal_read ****************/
+int
+grid_journal_read(grid_t *grid, uint64_t *since, grid_event_t *events, int max){
+	grid_journal_t *journal = grid->journal;
+	uint64_t oldest = (journal->next_seq > GridJournalCapacity) ? journal->next_seq - GridJournalCapacity : 1;
+	if (*since < oldest) { //the events the caller wants were overwritten
+		return -1;
+	}
+
+	int count = 0;
+	while (count < max && *since < journal->next_seq) {
+		events[count++] = journal->events[*since % GridJournalCapacity];
+		(*since)++;
+	}
+	return count;
+}
 
 /**************** grid_delete ****************/
 void 
 grid_delete(grid_t* grid) {
-// Free each row of the cells 2D array
-	for (int i = 0; i < grid->num_rows; ++i){
-		free(grid->cells[i]);	
+	free(grid->planes);	// terrain, unless mapped from a compiled map
+	if (grid->tiles != NULL) {
+		for (int t = 0; t < grid->num_tiles; t++) {
+			free(grid->tiles[t]);
+		}
+		free(grid->tiles);
 	}
-	free(grid->cells); 
 	free(grid->players);
+	free(grid->journal);
+	field_delete(grid->gold_field);
+	if (grid->free_cells != NULL) {
+		for (int c = 0; c <= grid->num_dots / FreeChunk; c++) {
+			free(grid->free_cells[c]);
+		}
+		free(grid->free_cells);
+	}
+	if (grid->map == NULL) {
+		free((void *)grid->dots);	// a compiled map's list is in the mapping
+	}
+	if (grid->free_pos != NULL) {
+		for (int t = 0; t < grid->num_tiles; t++) {
+			free(grid->free_pos[t]);
+		}
+		free(grid->free_pos);
+	}
+	if (grid->map != NULL) {
+		munmap((void *)grid->map->base, grid->map->size);
+		free(grid->map);
+	}
 	free(grid);
 }
 
 
-/**************** grid_delete ****************/
+/**************** grid_add_player ****************/
 void 
 grid_add_player(grid_t* grid, player_t* player) {
-//get a random empty cell from grid
-	int num_empty = calculate_empty_spots(grid);
-	int spot_num = rand() % num_empty;
-	cell_t *cell = get_empty_cell(grid, spot_num);
+	int cell = free_get(grid, random_below(grid, grid->num_free)); //get a random empty cell from grid
 	//set the tag in that cell to the player's tag and set the player's location to that cell's location
-	cell->tag = player->player_tag;
-	player->row = cell->row;
-	player->col = cell->col;
+	set_tag(grid, cell, player->player_tag);
+	player->row = cell_row(grid, cell);
+	player->col = cell_col(grid, cell);
+	journal_append(grid, GridEventJoin, player->player_tag, player->row, player->col, player->row, player->col, 0);
 }
 
 
-/**************** calculate_empty_spots ****************/
-static int
-calculate_empty_spots(grid_t *grid)
-{	
-	int num_empty = 0;
-	for (int i = 0; i < grid->num_rows; i++){ //loop through grid
-		for (int j = 0; j < grid->num_cols; j++){	
-			if (grid->cells[i][j].default_char == '.' && grid->cells[i][j].tag == '\0' && grid->cells[i][j].gold == 0){	 //if default char at cell is '.' and it has no tag or gold
-				num_empty++; //increment number of empty spots
+/**************** grid_in_bounds ****************/
+static bool grid_in_bounds(grid_t *grid, int row, int col) {
+	return !(row < 0 || col < 0 || row >= grid->num_rows || col >= grid->num_cols); //return whether the location is not in bounds
+}
+
+
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test plays random games on each map given and checks the
+ * grid's incremental state against the same state worked out afresh:
+ *   ./gridtest maps/main.txt maps/hole.txt
+ * Each map, a text map, is first compiled to gridtest.mapc, and every
+ * game is played on both at once with the same seed and the same steps:
+ * moves, runs, travel steps toward gold, joins and quits.
+ *  - the free-cell index holds exactly the room cells with neither a
+ *    player nor gold, each once, at the place free_pos gives for it;
+ *  - the gold distances match a fresh 8-way breadth-first search from
+ *    every pile, after each pickup;
+ *  - the compiled map's game matches the text map's: every step's
+ *    result, every cell's tag and gold, and every player's display;
+ *  - the spectator's view patched from the journal after every step
+ *    (grid_render_changes) matches the view rendered whole.
+ * Prints a line per game, and exits 1 if anything did not match.
+ * `make test` runs it on the shipped maps and a generated one.
+ */
+
+#ifdef UNIT_TEST
+
+static const int TestSeeds = 3;	// games per map
+static const int TestSteps = 4000;	// most steps per game
+static const int TestPlayers = 26;
+static const int TestFirstPlayers = 10;	// in the game from the start; the rest join later
+
+//one game, played on both copies of a map
+typedef struct test_game {
+	grid_t *grid;
+	player_t players[26];
+	char names[26][2];
+	char *display;	// a render of one view, compared across copies
+	char *frame;	// the spectator's view, kept up to date from the journal
+	uint64_t frame_seq;
+} test_game_t;
+
+static bool test_start(test_game_t *game, char *filename, int seed);
+static void test_join(test_game_t *game, int slot);
+static void test_end(test_game_t *game);
+static int test_step(test_game_t *game, int slot, int action, int d);
+static int check_free(grid_t *grid);
+static int check_field(grid_t *grid);
+static int check_same(test_game_t *text, test_game_t *compiled, int joined);
+static int check_frame(test_game_t *game);
+
+int
+main(const int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s mapfile...\n", argv[0]);
+		return 2;
+	}
+	char *compiled_name = "gridtest.mapc";
+	int failed = 0;
+	for (int m = 1; m < argc; m++) {
+		if (!grid_compile(argv[m], compiled_name, false)) {
+			return 2;
+		}
+		for (int seed = 1; seed <= TestSeeds; seed++) {
+			test_game_t text, compiled;
+			if (!test_start(&text, argv[m], seed) || !test_start(&compiled, compiled_name, seed)) {
+				return 2;
+			}
+			int joined = 0;
+			for (; joined < TestFirstPlayers; joined++) {
+				test_join(&text, joined);
+				test_join(&compiled, joined);
 			}
+			int mismatches = check_free(text.grid) + check_field(text.grid) + check_same(&text, &compiled, joined)
+					+ check_frame(&text);
+			srand(seed);
+			int steps = 0;
+			for (; steps < TestSteps && text.grid->gold_remaining > 0; steps++) {
+				int slot = rand() % joined;
+				int action = rand() % 20;
+				int d = rand() % 8;
+				if (action == 0 && joined < TestPlayers) { //a new player joins
+					test_join(&text, joined);
+					test_join(&compiled, joined);
+					joined++;
+					mismatches += check_free(text.grid);
+					continue;
+				}
+				int got = test_step(&text, slot, action, d);
+				if (test_step(&compiled, slot, action, d) != got) {
+					mismatches++;
+				}
+				if (got > 0) {
+					mismatches += check_field(text.grid);
+				}
+				mismatches += check_frame(&text);
+				if (action == 1 || steps % 50 == 0) {
+					mismatches += check_free(text.grid);
+				}
+				if (steps % 10 == 0) {
+					mismatches += check_same(&text, &compiled, joined);
+				}
+			}
+			mismatches += check_free(text.grid) + check_free(compiled.grid) + check_same(&text, &compiled, joined);
+			printf("%s seed %d: %d steps, %d players, %d gold left, %d mismatches\n",
+					argv[m], seed, steps, joined, text.grid->gold_remaining, mismatches);
+			failed += (mismatches > 0);
+			test_end(&text);
+			test_end(&compiled);
+		}
+		unlink(compiled_name);
+	}
+	return (failed > 0) ? 1 : 0;
+}
+
+/**************** test_start ****************/
+// Views are narrowed as the server does for large maps, so runs stay quick.
+static bool
+test_start(test_game_t *game, char *filename, int seed){
+	game->grid = grid_new(filename, seed, 10, 20, 300, TestPlayers);
+	if (game->grid == NULL) {
+		return false;
+	}
+	grid_set_viewport(game->grid, 40, 120);
+	game->display = malloc(game->grid->view_rows * (game->grid->view_cols + 1) + 1);
+	game->frame = malloc(game->grid->view_rows * (game->grid->view_cols + 1) + 1);
+	assertp(game->display, "Error allocating memory to test display\n");
+	assertp(game->frame, "Error allocating memory to test display\n");
+	game->frame_seq = 0;
+	return true;
+}
+
+/**************** test_join ****************/
+static void
+test_join(test_game_t *game, int slot){
+	player_t *player = &game->players[slot];
+	memset(player, 0, sizeof(player_t));
+	game->names[slot][0] = 'a' + slot;
+	game->names[slot][1] = '\0';
+	player->player_name = game->names[slot];
+	player->player_tag = 'A' + slot;
+	player->known = grid_known_new(game->grid);
+	game->grid->players[slot] = player;
+	grid_add_player(game->grid, player);
+}
+
+/**************** test_end ****************/
+static void
+test_end(test_game_t *game){
+	for (int i = 0; i < TestPlayers; i++) {
+		if (game->grid->players[i] != NULL) {
+			grid_known_delete(game->grid, game->players[i].known);
 		}
 	}
-	return num_empty; //return number of empty spots
+	free(game->display);
+	free(game->frame);
+	grid_delete(game->grid);
 }
 
+/**************** test_step ****************/
+// Takes one step for the player in slot, as game_key and game_travel do:
+// action 1 quits, 2 and 3 run, 4 to 10 travel and the rest move, in
+// direction d. A player that quit does nothing. Returns the gold collected.
+static int
+test_step(test_game_t *game, int slot, int action, int d){
+	player_t *player = &game->players[slot];
+	if (player->player_quit) {
+		return 0;
+	}
+	if (action == 1) {
+		grid_remove_player(game->grid, player);
+		player->player_quit = true;
+		return 0;
+	}
+	if (action <= 3) {
+		return grid_move_to_end(game->grid, player, FieldSteps[d][0], FieldSteps[d][1]);
+	}
+	if (action <= 10) {
+		return grid_move_toward_gold(game->grid, player);
+	}
+	return grid_move(game->grid, player, FieldSteps[d][0], FieldSteps[d][1]);
+}
 
-/**************** get_empty_cell ****************/
-static cell_t* 
-get_empty_cell(grid_t *grid, int dot_number){
-	int num_empty = 0;
-	for (int i = 0; i < grid->num_rows; i++){ //loop through grid
-		for (int j = 0; j < grid->num_cols; j++){
-			if (grid->cells[i][j].default_char == '.' && grid->cells[i][j].tag == '\0' && grid->cells[i][j].gold == 0){	 //if default char at cell is '.' and it has no tag or gold
-				if (dot_number == num_empty) { //if it's dot number matches the current empty spot count
-					return &(grid->cells[i][j]); //return that spot
+/**************** check_free ****************/
+// Counts the ways the free-cell index differs from the room cells that
+// hold neither a player nor gold.
+static int
+check_free(grid_t *grid){
+	size_t cells = (size_t)grid->num_tiles * GridTileCells;
+	char *listed = calloc(cells, 1);
+	assertp(listed, "Error allocating memory to test\n");
+	int mismatches = 0;
+	for (int i = 0; i < grid->num_free; i++) {
+		int cell = free_get(grid, i);
+		if (listed[cell]++) { //listed twice
+			mismatches++;
+		}
+		int32_t *pos = grid->free_pos[cell / GridTileCells];
+		if (pos != NULL && pos[cell % GridTileCells] != i) {
+			mismatches++;
+		}
+	}
+	for (int row = 0; row < grid->num_rows; row++) {
+		for (int col = 0; col < grid->num_cols; col++) {
+			int cell = cell_at(grid, row, col);
+			bool empty = grid->terrain[cell] == '.' && tag_at(grid, cell) == '\0' && gold_at(grid, cell) == 0;
+			if (empty != (listed[cell] != 0)) {
+				mismatches++;
+			}
+		}
+	}
+	free(listed);
+	return mismatches;
+}
+
+/**************** check_field ****************/
+// Counts the walkable cells whose gold distance differs from a fresh
+// 8-way breadth-first search from every pile.
+static int
+check_field(grid_t *grid){
+	size_t cells = (size_t)grid->num_tiles * GridTileCells;
+	int *dist = malloc(cells * sizeof(int));
+	int *queue = malloc(cells * sizeof(int));
+	assertp(dist, "Error allocating memory to test\n");
+	assertp(queue, "Error allocating memory to test\n");
+	int tail = 0;
+	for (size_t cell = 0; cell < cells; cell++) {
+		dist[cell] = -1;
+		if (gold_at(grid, cell) > 0) {
+			dist[cell] = 0;
+			queue[tail++] = cell;
+		}
+	}
+	for (int head = 0; head < tail; head++) {
+		int row = cell_row(grid, queue[head]);
+		int col = cell_col(grid, queue[head]);
+		for (int d = 0; d < 8; d++) {
+			int next_row = row + FieldSteps[d][0];
+			int next_col = col + FieldSteps[d][1];
+			if (grid_in_bounds(grid, next_row, next_col)) {
+				int next = cell_at(grid, next_row, next_col);
+				if (cell_walkable(grid, next) && dist[next] < 0) {
+					dist[next] = dist[queue[head]] + 1;
+					queue[tail++] = next;
 				}
-				num_empty++; //increment empty spot count
 			}
 		}
 	}
-	return NULL; //return NULL if not found
+	int mismatches = 0;
+	for (int row = 0; row < grid->num_rows; row++) {
+		for (int col = 0; col < grid->num_cols; col++) {
+			int cell = cell_at(grid, row, col);
+			if (cell_walkable(grid, cell) && grid_gold_distance(grid, row, col) != dist[cell]) {
+				mismatches++;
+			}
+		}
+	}
+	free(dist);
+	free(queue);
+	return mismatches;
 }
 
+/**************** check_same ****************/
+// Counts the differences between the games on the text and compiled
+// copies of a map: cells, gold left, and the view of every player still
+// in the game and of the spectator.
+static int
+check_same(test_game_t *text, test_game_t *compiled, int joined){
+	grid_t *a = text->grid, *b = compiled->grid;
+	int mismatches = (a->gold_remaining != b->gold_remaining) + (a->num_free != b->num_free);
+	for (int row = 0; row < a->num_rows; row++) {
+		for (int col = 0; col < a->num_cols; col++) {
+			int cell = cell_at(a, row, col);
+			if (tag_at(a, cell) != tag_at(b, cell) || gold_at(a, cell) != gold_at(b, cell)) {
+				mismatches++;
+			}
+		}
+	}
+	for (int slot = -1; slot < joined; slot++) {
+		if (slot >= 0 && text->players[slot].player_quit) {
+			continue;
+		}
+		grid_render(a, slot, text->display);
+		grid_render(b, slot, compiled->display);
+		if (strcmp(text->display, compiled->display) != 0) {
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
 
-/**************** grid_in_bounds ****************/
-static bool grid_in_bounds(grid_t *grid, int row, int col) {
-	return !(row < 0 || col < 0 || row >= grid->num_rows || col >= grid->num_cols); //return whether the location is not in bounds
+/**************** check_frame ****************/
+// Brings the spectator's view up to date from the journal's events, and
+// returns 1 if it differs from the view rendered whole.
+static int
+check_frame(test_game_t *game){
+	grid_render_changes(game->grid, &game->frame_seq, game->frame);
+	grid_render(game->grid, -1, game->display);
+	return strcmp(game->frame, game->display) != 0;
 }
+
+#endif // UNIT_TEST
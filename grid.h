@@ -1,11 +1,42 @@
 #ifndef __GRID_H
 #define __GRID_H
 #include <stdio.h>
-#include <message.h>
+#include <pool.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 
-typedef struct cell cell_t;
+typedef struct grid_journal grid_journal_t;
+typedef struct grid_map grid_map_t;
+typedef struct cell_tile cell_tile_t;
+typedef struct grid_field grid_field_t;
+
+//events the journal keeps before overwriting the oldest
+#define GridJournalCapacity 4096
+//the grid is stored in square tiles of this many rows and columns
+#define GridTileSize 64
+#define GridTileCells (GridTileSize * GridTileSize)
+
+//kinds of mutation recorded in the grid's journal
+typedef enum grid_event_type {
+	GridEventGold,	// a gold pile was placed at (row, col)
+	GridEventJoin,	// player tag was placed at (row, col)
+	GridEventLeave,	// player tag left (row, col)
+	GridEventMove,	// player tag moved from (from_row, from_col) to (row, col)
+	GridEventPickup,	// player tag picked up gold at (row, col)
+} grid_event_type_t;
+
+//one journal entry; sequence numbers start at 1 and have no gaps
+typedef struct grid_event {
+	uint64_t seq;
+	grid_event_type_t type;
+	char tag;	// player tag, '\0' for gold placement
+	int from_row;
+	int from_col;
+	int row;
+	int col;
+	int gold;	// gold placed or picked up, else 0
+} grid_event_t;
 
 
 typedef struct player {
@@ -13,10 +44,9 @@ typedef struct player {
 	char player_tag;
 	int gold_obtained;
 	char* display;
-	int **known;
+	uint64_t **known;	// per tile: a bit per cell known to the player, NULL until first seen (see grid_known_new)
 	int row;
 	int col;
-	const addr_t addr;
 	bool player_quit;
 }
 player_t;
@@ -24,27 +54,84 @@ player_t;
 typedef struct grid {
 	int num_rows;
 	int num_cols;
+	int tile_rows;	// tiles down and across; edge tiles extend past the map
+	int tile_cols;
+	int num_tiles;
+	int view_rows;	// size of each display; the whole map unless set by grid_set_viewport
+	int view_cols;
 	int gold_remaining;
 	int MaxPlayers;
-	cell_t **cells;
+	uint64_t rng;	// state of the grid's own random number generator, seeded by grid_new
+	const char *terrain;	// map character of each cell, tile by tile
+	const uint64_t *walkable;	// bit per cell, set if a player may stand there
+	cell_tile_t **tiles;	// tags and gold of each tile, NULL until something is placed in it
+	const uint32_t *dots;	// room cells, row by row: a compiled map's list, or found in a text map
+	int num_dots;
+	int32_t **free_cells;	// room cells with neither player nor gold, in no order, in chunks; NULL while a chunk still matches dots
+	int num_free;
+	int32_t **free_pos;	// per tile: index of each cell in free_cells, -1 if not there; NULL while the tile's room cells are free where dots has them
+	void *planes;	// the block holding terrain and walkable, unless mapped from a compiled map
 	player_t** players;
 	player_t* spectator;
+	pool_t* pool;	// threads rendering displays in parallel; NULL renders inline
+	grid_journal_t* journal;	// latest mutations, in order
+	grid_map_t* map;	// the compiled map file, if loaded from one; else NULL
+	grid_field_t* gold_field;	// steps from each cell to the nearest gold, once first asked for; else NULL
 } grid_t;
 
 //creates and returns a new grid struct given filename, seed, min and max gold piles, total gold in grid, and max players in grid
 grid_t *grid_new(char* filename, int seed, int min_gold_piles, int max_gold_piles, int total_gold, int MaxPlayers); 
+//compiles the map in filename (text or compiled) into a binary map at outname,
+//with a precomputed visibility table if visibility is true; grid_new loads such a
+//file directly. Returns false, having printed why, on error
+bool grid_compile(char *filename, char *outname, bool visibility);
+//narrows every display to rows x cols around its player (or the middle of
+//the map, for the spectator); never wider than the map
+void grid_set_viewport(grid_t *grid, int rows, int cols);
+//returns a new, empty known table for a player; known tiles are allocated as the player sees into them
+uint64_t **grid_known_new(grid_t *grid);
+//frees a known table and every tile in it; does nothing if NULL
+void grid_known_delete(grid_t *grid, uint64_t **known);
 //removes a given player from grid
 void grid_remove_player(grid_t* grid, player_t* player);
 //returns an int of a player's gold amount after movement
 int grid_move(grid_t *grid, player_t *player, int row, int col);
 //returns an int of a player's gold amount after moving to end boundary of grid
 int grid_move_to_end(grid_t *grid, player_t *player, int row, int col);
+//returns the number of steps (8-way, as players move) from (row, col) to the nearest gold,
+//or -1 if none can be reached. The distances are computed for every cell on first use,
+//shared by every player, and kept up to date as gold is picked up
+int grid_gold_distance(grid_t *grid, int row, int col);
+//moves a player one step along a shortest path to the nearest gold, never swapping with
+//another player: if every such step is taken, the player waits. Returns the gold collected,
+//0 if none (or the player waited), or -1 if no gold can be reached
+int grid_move_toward_gold(grid_t *grid, player_t *player);
+//returns the map character at (row, col), which must be within the map
+char grid_terrain(grid_t *grid, int row, int col);
+//returns whether the cell at (x2, y2) can be seen from (x1, y1); x is a row and y a column
+bool grid_isVisible(grid_t *grid, int x1, int y1, int x2, int y2);
 //returns the largest integer value less than or equal to the log of the positive value of a given integer
 int int_len(int i);
 //adds a given player to grid
 void grid_add_player(grid_t* grid, player_t* player);
-//displays the grid board
+//renders the display of every player still in the game and the spectator, in parallel on grid->pool if set
 void grid_display_board(grid_t *grid);
+//brings the spectator's view in display, as last rendered by this function at journal
+//position *since, up to date: only the cells named by the journal events since then are
+//redrawn, and *since is advanced past them. The whole view is rendered if *since is 0
+//or those events were already overwritten
+void grid_render_changes(grid_t *grid, uint64_t *since, char *display);
+//renders the view of the player in slot, or of the
+//spectator if slot is -1 (whether or not there is one), into display, which holds
+//view_rows * (view_cols + 1) + 1 chars; the player's display is left alone
+void grid_render(grid_t *grid, int slot, char *display);
+//returns the sequence number the next journal event will get
+uint64_t grid_journal_seq(grid_t *grid);
+//copies up to max journal events, starting at sequence number *since, into events
+//and advances *since past them; returns the number copied, or -1 if the events
+//from *since on were already overwritten.
+//Call from the thread that mutates the grid.
+int grid_journal_read(grid_t *grid, uint64_t *since, grid_event_t *events, int max);
 //deletes and frees a grid
 void grid_delete(grid_t* grid);
 
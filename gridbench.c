@@ -0,0 +1,449 @@
+/*
+ * gridbench.c - micro-benchmarks of the grid module.
+ *  For each map, times grid_new and grid_isVisible, then, with each
+ *  number of players in PlayerCounts, grid_display_board, grid_move and
+ *  grid_move_to_end. Maps too large for one DISPLAY message are shown
+ *  through the server's viewport, as the server would. Every benchmark
+ *  reports the nanoseconds per operation (mean, percentiles and maximum)
+ *  and the operations per second.
+ *
+ * usage: ./gridbench [-j jsonfile] [-n ops] [-t seconds] [-s seed] mapfile...
+ *   jsonfile - also write the results there, as JSON, for comparing runs
+ *   ops      - most operations timed per benchmark (default 2000)
+ *   seconds  - most time spent per benchmark (default 0.5)
+ *   seed     - seed of the grids and of the moves made (default 1)
+ *
+ * foobarbaz, May 2019
+ */
+
+#define _DEFAULT_SOURCE	// for clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <memory.h>
+#include <message.h>
+#include "grid.h"
+#include "game.h"
+
+//what one benchmark measured
+typedef struct result {
+	const char *map;
+	int rows;
+	int cols;
+	int players;	// 0 for benchmarks that have none
+	const char *op;
+	int batch;	// operations timed together in each sample
+	long ops;	// operations timed
+	double seconds;	// time spent in them
+	double mean;	// nanoseconds per operation
+	double p50;
+	double p90;
+	double p99;
+	double max;
+} result_t;
+
+//state of the benchmarks of one map
+typedef struct bench {
+	const char *map;
+	int seed;
+	grid_t *grid;	// NULL while timing grid_new
+	player_t *players[26];
+	int num_players;
+	int *viewers;	// row and col of each walkable cell, for grid_isVisible
+	int num_viewers;
+	uint64_t rng;
+} bench_t;
+
+//one timed sample: runs a benchmark's operation batch times and returns the nanoseconds taken
+typedef double (*op_t)(bench_t *bench, int batch);
+
+static const char Usage[] = "usage: ./gridbench [-j jsonfile] [-n ops] [-t seconds] [-s seed] mapfile...\n";
+static const int PlayerCounts[] = { 1, 2, 4, 8, 16, 26 };
+static const int MaxPlayers = 26;
+static const int GoldTotal = 300;
+static const int GoldMinNumPiles = 10;
+static const int GoldMaxNumPiles = 20;
+static const int MinOps = 10;	// operations timed even past the time limit
+static const char MoveKeys[] = "hjklyubn";
+static const int MoveRows[] = { 0, 1, -1, 0, -1, -1, 1, 1 };
+static const int MoveCols[] = { -1, 0, 0, 1, -1, 1, -1, 1 };
+
+static volatile int sink;
+static long max_ops = 2000;
+static double max_seconds = 0.5;
+
+static grid_t *bench_grid(bench_t *bench);
+static void bench_players(bench_t *bench, int num_players);
+static void bench_free(bench_t *bench);
+static bool run(bench_t *bench, const char *op, op_t fn, int batch, result_t *result);
+static double op_new(bench_t *bench, int batch);
+static double op_visible(bench_t *bench, int batch);
+static double op_display(bench_t *bench, int batch);
+static double op_move(bench_t *bench, int batch);
+static double op_move_to_end(bench_t *bench, int batch);
+static uint32_t next_random(bench_t *bench, uint32_t bound);
+static double now_ns(void);
+static int compare_doubles(const void *a, const void *b);
+static void print_result(const result_t *result);
+static void json_result(FILE *fp, const result_t *result, bool first);
+static bool str2int(const char string[], int *number);
+
+int
+main(int argc, char *argv[]){
+	const char *json_path = NULL;
+	int seed = 1;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		int value = 0;
+		if (arg + 1 == argc) {
+			fprintf(stderr, Usage);
+			return 1;
+		}
+		if (strcmp(argv[arg], "-j") == 0) {
+			json_path = argv[++arg];
+		}
+		else if (strcmp(argv[arg], "-n") == 0 && str2int(argv[arg+1], &value) && value > 0) {
+			max_ops = value;
+			arg++;
+		}
+		else if (strcmp(argv[arg], "-t") == 0 && sscanf(argv[arg+1], "%lf", &max_seconds) == 1 && max_seconds > 0) {
+			arg++;
+		}
+		else if (strcmp(argv[arg], "-s") == 0 && str2int(argv[arg+1], &seed)) {
+			arg++;
+		}
+		else {
+			fprintf(stderr, Usage);
+			return 1;
+		}
+	}
+	if (arg == argc) {
+		fprintf(stderr, Usage);
+		return 1;
+	}
+	FILE *json = NULL;
+	if (json_path != NULL) {
+		if ((json = fopen(json_path, "w")) == NULL) {
+			fprintf(stderr, "Cannot write %s\n", json_path);
+			return 2;
+		}
+		fprintf(json, "{\n  \"seed\": %d,\n  \"max_ops\": %ld,\n  \"max_seconds\": %g,\n  \"time\": %ld,\n  \"results\": [",
+				seed, max_ops, max_seconds, (long)time(NULL));
+	}
+
+	printf("%-24s %7s %3s %-18s %7s %11s %11s %11s %11s %11s %12s\n", "map", "size", "pl", "op",
+			"ops", "mean ns", "p50 ns", "p90 ns", "p99 ns", "max ns", "ops/s");
+	bool first = true;
+	for (; arg < argc; arg++) {
+		bench_t bench = { .map = argv[arg], .seed = seed, .rng = (uint64_t)seed * 2 + 1 };
+		result_t result;
+		// grid_new says why a map does not load; the server would refuse it too, so go on
+		if (!run(&bench, "grid_new", op_new, 1, &result)) {
+			fprintf(stderr, "Skipping %s\n", bench.map);
+			continue;
+		}
+		print_result(&result);
+		json_result(json, &result, first);
+		first = false;
+
+		// every walkable cell can be a viewer, as any player position can
+		bench.grid = bench_grid(&bench);
+		bench.viewers = malloc(2 * sizeof(int) * (size_t)bench.grid->num_rows * bench.grid->num_cols);
+		assertp(bench.viewers, "Error allocating memory to viewers\n");
+		for (int row = 0; row < bench.grid->num_rows; row++) {
+			for (int col = 0; col < bench.grid->num_cols; col++) {
+				char c = grid_terrain(bench.grid, row, col);
+				if (c == '.' || c == '#') {
+					bench.viewers[2 * bench.num_viewers] = row;
+					bench.viewers[2 * bench.num_viewers + 1] = col;
+					bench.num_viewers++;
+				}
+			}
+		}
+		if (run(&bench, "grid_isVisible", op_visible, 64, &result)) {
+			print_result(&result);
+			json_result(json, &result, false);
+		}
+		bench_free(&bench);
+
+		for (int p = 0; p < sizeof(PlayerCounts) / sizeof(PlayerCounts[0]); p++) {
+			struct {
+				const char *name;
+				op_t fn;
+			} ops[] = {
+				{ "grid_display_board", op_display },
+				{ "grid_move", op_move },
+				{ "grid_move_to_end", op_move_to_end },
+			};
+			for (int o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+				// each op starts from the same fresh grid and players
+				bench.grid = bench_grid(&bench);
+				if (bench.grid->num_free < PlayerCounts[p]) {	// the map has too few spots for so many
+					bench_free(&bench);
+					break;
+				}
+				bench_players(&bench, PlayerCounts[p]);
+				if (run(&bench, ops[o].name, ops[o].fn, 1, &result)) {
+					print_result(&result);
+					json_result(json, &result, false);
+				}
+				bench_free(&bench);
+			}
+		}
+		free(bench.viewers);
+	}
+
+	if (json != NULL) {
+		fprintf(json, "\n  ]\n}\n");
+		fclose(json);
+	}
+	return 0;
+}
+
+/**************** bench_grid ****************/
+// Loads the map as the server would, with its viewport if too large for one DISPLAY.
+static grid_t *
+bench_grid(bench_t *bench){
+	grid_t *grid = grid_new((char *)bench->map, bench->seed, GoldMinNumPiles, GoldMaxNumPiles, GoldTotal, MaxPlayers);
+	if (grid != NULL && (grid->num_cols + 1) * grid->num_rows + 10 >= message_MaxBytes) {
+		grid_set_viewport(grid, game_default_config.viewport_rows, game_default_config.viewport_cols);
+	}
+	return grid;
+}
+
+/**************** bench_players ****************/
+// Adds players to the bench's grid, as the engine does when they join.
+static void
+bench_players(bench_t *bench, int num_players){
+	grid_t *grid = bench->grid;
+	for (int i = 0; i < num_players; i++) {
+		player_t *player = malloc(sizeof(player_t));
+		assertp(player, "Error allocating memory to player\n");
+		player->player_name = NULL;
+		player->player_tag = 'A' + i;
+		player->gold_obtained = 0;
+		player->display = malloc(grid->view_rows * (grid->view_cols + 1) + 1);
+		assertp(player->display, "Error allocating memory to player display\n");
+		player->known = grid_known_new(grid);
+		player->player_quit = false;
+		grid->players[i] = player;
+		grid_add_player(grid, player);
+		bench->players[i] = player;
+	}
+	bench->num_players = num_players;
+}
+
+/**************** bench_free ****************/
+static void
+bench_free(bench_t *bench){
+	for (int i = 0; i < bench->num_players; i++) {
+		free(bench->players[i]->display);
+		grid_known_delete(bench->grid, bench->players[i]->known);
+		free(bench->players[i]);
+	}
+	bench->num_players = 0;
+	if (bench->grid != NULL) {
+		grid_delete(bench->grid);
+		bench->grid = NULL;
+	}
+}
+
+/**************** run ****************/
+// Times samples of batch operations until max_ops operations or max_seconds,
+// but at least MinOps operations, then sorts them for the percentiles.
+// Returns false if the first sample failed.
+static bool
+run(bench_t *bench, const char *op, op_t fn, int batch, result_t *result){
+	long max_samples = (max_ops + batch - 1) / batch;
+	double *samples = malloc(max_samples * sizeof(double));
+	assertp(samples, "Error allocating memory to samples\n");
+	long num_samples = 0;
+	double spent = 0;
+	while (num_samples < max_samples && (spent < max_seconds * 1e9 || num_samples * batch < MinOps)) {
+		double ns = fn(bench, batch);
+		if (ns < 0) {
+			break;
+		}
+		samples[num_samples++] = ns / batch;
+		spent += ns;
+	}
+	if (num_samples == 0) {
+		free(samples);
+		return false;
+	}
+	qsort(samples, num_samples, sizeof(double), compare_doubles);
+
+	grid_t *grid = (bench->grid != NULL) ? bench->grid : bench_grid(bench);
+	result->map = bench->map;
+	result->rows = grid->num_rows;
+	result->cols = grid->num_cols;
+	if (grid != bench->grid) {
+		grid_delete(grid);
+	}
+	result->players = bench->num_players;
+	result->op = op;
+	result->batch = batch;
+	result->ops = num_samples * batch;
+	result->seconds = spent / 1e9;
+	result->mean = spent / result->ops;
+	result->p50 = samples[num_samples * 50 / 100];
+	result->p90 = samples[num_samples * 90 / 100];
+	result->p99 = samples[num_samples * 99 / 100];
+	result->max = samples[num_samples - 1];
+	free(samples);
+	return true;
+}
+
+/**************** op_new ****************/
+// Times loading the map; freeing the grid is not timed.
+static double
+op_new(bench_t *bench, int batch){
+	double start = now_ns();
+	grid_t *grid = bench_grid(bench);
+	double ns = now_ns() - start;
+	if (grid == NULL) {
+		return -1;
+	}
+	grid_delete(grid);
+	return ns;
+}
+
+/**************** op_visible ****************/
+// Checks cells around random viewers, within the viewer's view as a render would.
+static double
+op_visible(bench_t *bench, int batch){
+	grid_t *grid = bench->grid;
+	if (bench->num_viewers == 0) {
+		return -1;
+	}
+	int cells[batch][4];
+	for (int i = 0; i < batch; i++) {
+		int viewer = next_random(bench, bench->num_viewers);
+		int row = bench->viewers[2 * viewer];
+		int col = bench->viewers[2 * viewer + 1];
+		int top = row - grid->view_rows / 2;
+		int left = col - grid->view_cols / 2;
+		top = (top < 0) ? 0 : (top + grid->view_rows > grid->num_rows) ? grid->num_rows - grid->view_rows : top;
+		left = (left < 0) ? 0 : (left + grid->view_cols > grid->num_cols) ? grid->num_cols - grid->view_cols : left;
+		cells[i][0] = row;
+		cells[i][1] = col;
+		cells[i][2] = top + next_random(bench, grid->view_rows);
+		cells[i][3] = left + next_random(bench, grid->view_cols);
+	}
+	int visible = 0;
+	double start = now_ns();
+	for (int i = 0; i < batch; i++) {
+		visible += grid_isVisible(grid, cells[i][0], cells[i][1], cells[i][2], cells[i][3]);
+	}
+	double ns = now_ns() - start;
+	sink = visible;	// the results are used, so the calls cannot be optimized away
+	return ns;
+}
+
+/**************** op_display ****************/
+// Renders every player's display; a random move first changes the grid, untimed.
+static double
+op_display(bench_t *bench, int batch){
+	int k = next_random(bench, 8);
+	grid_move(bench->grid, bench->players[next_random(bench, bench->num_players)], MoveRows[k], MoveCols[k]);
+	double start = now_ns();
+	grid_display_board(bench->grid);
+	return now_ns() - start;
+}
+
+/**************** op_move ****************/
+// Moves a random player one step in a random direction.
+static double
+op_move(bench_t *bench, int batch){
+	player_t *player = bench->players[next_random(bench, bench->num_players)];
+	int k = next_random(bench, sizeof(MoveKeys) - 1);
+	double start = now_ns();
+	grid_move(bench->grid, player, MoveRows[k], MoveCols[k]);
+	return now_ns() - start;
+}
+
+/**************** op_move_to_end ****************/
+// Runs a random player in a random direction until something is in the way.
+static double
+op_move_to_end(bench_t *bench, int batch){
+	player_t *player = bench->players[next_random(bench, bench->num_players)];
+	int k = next_random(bench, sizeof(MoveKeys) - 1);
+	double start = now_ns();
+	grid_move_to_end(bench->grid, player, MoveRows[k], MoveCols[k]);
+	return now_ns() - start;
+}
+
+/**************** next_random ****************/
+// xorshift64*, reduced to [0, bound); the grid's own generator is left alone.
+static uint32_t
+next_random(bench_t *bench, uint32_t bound){
+	bench->rng ^= bench->rng >> 12;
+	bench->rng ^= bench->rng << 25;
+	bench->rng ^= bench->rng >> 27;
+	return (uint32_t)(((bench->rng * 0x2545F4914F6CDD1DULL) >> 32) * bound >> 32);
+}
+
+/**************** now_ns ****************/
+static double
+now_ns(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/**************** compare_doubles ****************/
+static int
+compare_doubles(const void *a, const void *b){
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/**************** print_result ****************/
+static void
+print_result(const result_t *result){
+	const char *name = strrchr(result->map, '/');
+	name = (name != NULL) ? name + 1 : result->map;
+	char size[24];
+	snprintf(size, sizeof(size), "%dx%d", result->rows, result->cols);
+	printf("%-24s %7s %3d %-18s %7ld %11.1f %11.1f %11.1f %11.1f %11.1f %12.0f\n", name, size,
+			result->players, result->op, result->ops, result->mean, result->p50, result->p90,
+			result->p99, result->max, 1e9 / result->mean);
+	fflush(stdout);
+}
+
+/**************** json_result ****************/
+// Appends a result to the results array; does nothing if fp is NULL.
+static void
+json_result(FILE *fp, const result_t *result, bool first){
+	if (fp == NULL) {
+		return;
+	}
+	fprintf(fp, "%s\n    {\"map\": \"", first ? "" : ",");
+	for (const char *c = result->map; *c != '\0'; c++) {	// map paths are the only strings from outside
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', fp);
+		}
+		fputc(*c, fp);
+	}
+	fprintf(fp, "\", \"rows\": %d, \"cols\": %d, \"players\": %d, \"op\": \"%s\", \"batch\": %d, \"ops\": %ld, "
+			"\"seconds\": %.6f, \"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, "
+			"\"max_ns\": %.1f, \"ops_per_sec\": %.1f}",
+			result->rows, result->cols, result->players, result->op, result->batch, result->ops,
+			result->seconds, result->mean, result->p50, result->p90, result->p99, result->max,
+			1e9 / result->mean);
+}
+
+/**************** str2int ****************/
+/* Convert a string to an integer, returning that integer.
+ * Returns true if successful, or false if any error.
+ * It is an error if there is any additional character beyond the integer.
+ * Assumes number is a valid pointer.
+ */
+static bool
+str2int(const char string[], int *number){
+	char nextchar;
+	return (sscanf(string, "%d%c", number, &nextchar) == 1);
+}
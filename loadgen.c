@@ -0,0 +1,417 @@
+/*
+ * loadgen.c – a load generator for the nuggets server.
+ *  Simulates many players and spectators from one process, each with
+ *  its own socket, and measures how long the server takes to answer.
+ *
+ * usage: ./loadgen [-n players] [-s spectators] [-k rate[,rate...]] [-d seconds] [-g gameid] hostname port
+ *   players    - simulated players (default 100)
+ *   spectators - simulated spectators (default 0), at most one per player
+ *   rate       - keystrokes per second sent by each player (default 10);
+ *                with a list, one step at each rate, to find where the server saturates
+ *   seconds    - length of each step (default 10)
+ *   gameid     - game of the first player (default 1)
+ *
+ * Player i plays alone in game gameid+i, so that every DISPLAY it gets
+ * answers one of its own keystrokes: the latency of a keystroke is the
+ * time from sending its KEY to receiving the next DISPLAY not yet
+ * matched. Spectator j watches game gameid+j, and is sent a DISPLAY
+ * whenever its player is. Keys are sent on a fixed schedule, whether or
+ * not earlier ones were answered, so a saturated server shows up as
+ * growing latency and lost datagrams rather than a slower sender.
+ *
+ * After each step, loadgen waits DrainTime for late answers, then prints
+ * the keystrokes sent and answered, the latency percentiles, and the
+ * datagrams lost: keys never answered, and DISPLAYs a spectator missed.
+ * A lost DISPLAY is charged to the key whose answer was lost; the next
+ * answer then goes to the key after it, as DISPLAYs come in order.
+ *
+ * exit: 0 on normal run-through; 1 on error opening a socket;
+ *  2 on usage error; 3 on error connecting with host
+ *
+ * foobarbaz, May 2019
+ */
+
+#define _DEFAULT_SOURCE  // for clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include "support/message.h"
+#include "support/memory.h"
+
+// a simulated player or spectator
+typedef struct client {
+    message_ctx_t* ctx;     // its own socket, so the server sees its own address
+    int game;               // game it plays or watches
+    bool spectator;
+    bool joined;            // got OK (player) or GRID (spectator)
+    struct client* player;  // for a spectator, the player of its game
+    struct client* watcher; // for a player, the spectator of its game, if any
+    double next_key;        // when the next keystroke is due, in seconds from the start
+    double* sent;           // send times of unanswered keys, oldest first (a ring)
+    int first;              // index of the oldest in sent
+    int pending;            // number in sent
+    long expected;          // for a spectator, DISPLAYs its player got since it joined
+    long displays;          // DISPLAYs received
+} client_t;
+
+// what one step measured
+typedef struct step {
+    double rate;
+    long sent;              // keys sent
+    long answered;          // keys answered with a DISPLAY
+    long lost;              // keys given up on
+    long expected;          // DISPLAYs spectators should have got
+    long watched;           // DISPLAYs spectators got
+    double* latencies;      // microseconds, of each answered key
+    long num_latencies;
+    long max_latencies;
+} step_t;
+
+static const char Usage[] = "usage: ./loadgen [-n players] [-s spectators] [-k rate[,rate...]] [-d seconds] [-g gameid] hostname port\n";
+static const int MaxRates = 32;          // rates in one -k list
+static const int MaxPending = 4096;      // unanswered keys remembered per player
+static const double DrainTime = 1.0;     // seconds to wait for late answers after a step
+static const double JoinTimeout = 5.0;   // seconds to wait for every client to join
+static const char Keys[] = "hjklyubn";   // keys sent, one step in each direction
+
+static addr_t server;
+
+static bool join_all(client_t* clients, int num_clients, struct pollfd* fds, step_t* step);
+static void run_step(client_t* clients, int num_players, int num_clients, struct pollfd* fds, step_t* step, double duration);
+static void receive(client_t* clients, int num_clients, struct pollfd* fds, int timeout, step_t* step);
+static void handle(client_t* client, const char* message, double now, step_t* step);
+static void send_key(client_t* client, double now, step_t* step);
+static void join(client_t* client);
+static void print_step(const step_t* step, double duration);
+static double percentile(const step_t* step, double p);
+static int compare_doubles(const void* a, const void* b);
+static double now_seconds(void);
+static bool str2int(const char string[], int* number);
+
+int main(int argc, char* argv[])
+{
+    int num_players = 100;
+    int num_spectators = 0;
+    double rates[MaxRates];
+    int num_rates = 1;
+    rates[0] = 10;
+    double duration = 10;
+    int first_game = 1;
+
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        const char* value = argv[arg + 1];
+        bool ok = false;
+        if (strcmp(argv[arg], "-n") == 0) {
+            ok = str2int(value, &num_players) && num_players > 0;
+        } else if (strcmp(argv[arg], "-s") == 0) {
+            ok = str2int(value, &num_spectators) && num_spectators >= 0;
+        } else if (strcmp(argv[arg], "-d") == 0) {
+            ok = sscanf(value, "%lf", &duration) == 1 && duration > 0;
+        } else if (strcmp(argv[arg], "-g") == 0) {
+            ok = str2int(value, &first_game) && first_game >= 0;
+        } else if (strcmp(argv[arg], "-k") == 0) {
+            // a comma-separated list of positive rates
+            num_rates = 0;
+            int used = 0;
+            ok = true;
+            while (ok && value[0] != '\0') {
+                ok = num_rates < MaxRates && sscanf(value, "%lf%n", &rates[num_rates], &used) == 1
+                    && rates[num_rates] > 0 && (value[used] == '\0' || value[used] == ',');
+                num_rates++;
+                value += used + (value[used] == ',');
+            }
+            ok = ok && num_rates > 0;
+        }
+        if (!ok) {
+            fprintf(stderr, "%s", Usage);
+            exit(2);
+        }
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "%s", Usage);
+        exit(2);
+    }
+    if (!message_setAddr(argv[arg], argv[arg + 1], &server)) {
+        fprintf(stderr, "Cannot form address from %s %s\n", argv[arg], argv[arg + 1]);
+        exit(3);
+    }
+    if (num_spectators > num_players) {
+        num_spectators = num_players;   // a game has one spectator; another would boot it
+    }
+
+    // players first, then spectators, each with its own socket
+    int num_clients = num_players + num_spectators;
+    client_t* clients = calloc(num_clients, sizeof(client_t));
+    struct pollfd* fds = calloc(num_clients, sizeof(struct pollfd));
+    assertp(clients, "Error allocating memory to clients");
+    assertp(fds, "Error allocating memory to descriptors");
+    for (int i = 0; i < num_clients; i++) {
+        client_t* client = &clients[i];
+        if ((client->ctx = message_ctx_new(NULL, 0, false)) == NULL) {
+            fprintf(stderr, "Cannot open socket %d; raise the limit on open files?\n", i);
+            exit(1);
+        }
+        fds[i].fd = message_ctx_fd(client->ctx);
+        fds[i].events = POLLIN;
+        client->spectator = (i >= num_players);
+        if (client->spectator) {
+            client->player = &clients[i - num_players];
+            client->player->watcher = client;
+            client->game = client->player->game;
+        } else {
+            client->game = first_game + i;
+            client->sent = malloc(MaxPending * sizeof(double));
+            assertp(client->sent, "Error allocating memory to send times");
+        }
+    }
+
+    step_t joining = { 0 };
+    if (!join_all(clients, num_clients, fds, &joining)) {
+        fprintf(stderr, "Not every client joined within %.0f seconds; is the server at %s %s?\n",
+                JoinTimeout, argv[arg], argv[arg + 1]);
+        exit(3);
+    }
+    printf("%d players and %d spectators in games %d to %d of %s %s\n", num_players, num_spectators,
+           first_game, first_game + num_players - 1, argv[arg], argv[arg + 1]);
+    printf("%8s %9s %9s %9s %10s %10s %10s %10s %8s %8s\n", "keys/s", "sent", "answered", "lost",
+           "loss %", "p50 us", "p99 us", "p999 us", "specs %", "ans/s");
+
+    for (int r = 0; r < num_rates; r++) {
+        step_t step = { .rate = rates[r] };
+        run_step(clients, num_players, num_clients, fds, &step, duration);
+        print_step(&step, duration);
+        free(step.latencies);
+    }
+
+    for (int i = 0; i < num_clients; i++) {
+        message_ctx_send(clients[i].ctx, server, "KEY Q");
+        message_ctx_delete(clients[i].ctx);
+        free(clients[i].sent);
+    }
+    free(clients);
+    free(fds);
+    return 0;
+}
+
+/* ***** join_all ***** */
+// sends every player's PLAY, then every spectator's SPECTATE once its
+// player is in, and waits until all have joined or JoinTimeout passes
+static bool join_all(client_t* clients, int num_clients, struct pollfd* fds, step_t* step)
+{
+    double start = now_seconds();
+    double last_try = -1;
+    while (now_seconds() - start < JoinTimeout) {
+        // (re)send any join not yet answered, once a second, as datagrams may be lost
+        int waiting = 0;
+        bool retry = now_seconds() - last_try >= 1;
+        for (int i = 0; i < num_clients; i++) {
+            client_t* client = &clients[i];
+            if (!client->joined) {
+                waiting++;
+                if (retry && (!client->spectator || client->player->joined)) {
+                    join(client);
+                }
+            }
+        }
+        if (waiting == 0) {
+            return true;
+        }
+        if (retry) {
+            last_try = now_seconds();
+        }
+        receive(clients, num_clients, fds, 100, step);
+    }
+    return false;
+}
+
+/* ***** run_step ***** */
+// sends keys at the step's rate for duration seconds, then waits for late answers
+static void run_step(client_t* clients, int num_players, int num_clients, struct pollfd* fds, step_t* step, double duration)
+{
+    double start = now_seconds();
+    double interval = 1 / step->rate;
+    // spread the players' first keys over one interval, so they do not all send at once
+    for (int i = 0; i < num_players; i++) {
+        clients[i].next_key = start + interval * i / num_players;
+    }
+    for (int i = num_players; i < num_clients; i++) {
+        clients[i].expected = clients[i].displays = 0;
+    }
+
+    double end = start + duration;
+    double now = start;
+    while (now < end) {
+        double next = end;
+        for (int i = 0; i < num_players; i++) {
+            while (clients[i].next_key <= now) {
+                send_key(&clients[i], now, step);
+                clients[i].next_key += interval;
+            }
+            if (clients[i].next_key < next) {
+                next = clients[i].next_key;
+            }
+        }
+        int timeout = (int)((next - now) * 1000);   // poll rounds down; a key is at most 1 ms late
+        receive(clients, num_clients, fds, timeout, step);
+        now = now_seconds();
+    }
+    receive(clients, num_clients, fds, 0, step);
+
+    // give the server time to answer what it still can
+    while (now_seconds() < end + DrainTime) {
+        receive(clients, num_clients, fds, 10, step);
+    }
+    for (int i = 0; i < num_players; i++) {
+        step->lost += clients[i].pending;
+        clients[i].pending = 0;
+    }
+    for (int i = num_players; i < num_clients; i++) {
+        step->expected += clients[i].expected;
+        step->watched += clients[i].displays;
+    }
+}
+
+/* ***** receive ***** */
+// waits up to timeout milliseconds for messages, then handles every message waiting
+static void receive(client_t* clients, int num_clients, struct pollfd* fds, int timeout, step_t* step)
+{
+    if (poll(fds, num_clients, timeout) <= 0) {
+        return;
+    }
+    double now = now_seconds();
+    for (int i = 0; i < num_clients; i++) {
+        if (fds[i].revents & POLLIN) {
+            addr_t from;
+            const char* message;
+            while ((message = message_ctx_receive(clients[i].ctx, &from)) != NULL) {
+                handle(&clients[i], message, now, step);
+            }
+        }
+    }
+}
+
+/* ***** handle ***** */
+// handles one message to a client, received at time now
+static void handle(client_t* client, const char* message, double now, step_t* step)
+{
+    if (strncmp(message, "OK ", strlen("OK ")) == 0) {
+        client->joined = true;
+    } else if (strncmp(message, "GRID ", strlen("GRID ")) == 0) {
+        if (client->spectator) {
+            client->joined = true;
+        }
+    } else if (strncmp(message, "DISPLAY\n", strlen("DISPLAY\n")) == 0) {
+        client->displays++;
+        if (client->spectator) {
+            return;
+        }
+        if (client->watcher != NULL && client->watcher->joined) {
+            client->watcher->expected++;
+        }
+        // the oldest unanswered key is the one answered
+        if (client->pending > 0) {
+            double sent = client->sent[client->first];
+            client->first = (client->first + 1) % MaxPending;
+            client->pending--;
+            step->answered++;
+            if (step->num_latencies == step->max_latencies) {
+                step->max_latencies = (step->max_latencies == 0) ? 4096 : 2 * step->max_latencies;
+                step->latencies = realloc(step->latencies, step->max_latencies * sizeof(double));
+                assertp(step->latencies, "Error allocating memory to latencies");
+            }
+            step->latencies[step->num_latencies++] = (now - sent) * 1e6;
+        }
+    } else if (strncmp(message, "QUIT", strlen("QUIT")) == 0) {
+        // the game is over, or the spectator was replaced; start it again and rejoin.
+        // Keys still unanswered reached a game that ended, so are not counted as lost
+        client->joined = false;
+        client->pending = 0;
+        join(client);
+    } else if (strncmp(message, "NO", strlen("NO")) == 0 && !client->joined) {
+        fprintf(stderr, "Game %d refused a client: %s\n", client->game, message);
+    }
+}
+
+/* ***** send_key ***** */
+// sends a random key from a player that has joined, remembering when
+static void send_key(client_t* client, double now, step_t* step)
+{
+    if (!client->joined) {
+        return;
+    }
+    char key_msg[] = "KEY x";
+    key_msg[strlen("KEY ")] = Keys[rand() % (sizeof(Keys) - 1)];
+    message_ctx_send(client->ctx, server, key_msg);
+    step->sent++;
+    if (client->pending == MaxPending) {     // give up on the oldest
+        client->first = (client->first + 1) % MaxPending;
+        client->pending--;
+        step->lost++;
+    }
+    client->sent[(client->first + client->pending) % MaxPending] = now;
+    client->pending++;
+}
+
+/* ***** join ***** */
+// sends a client's PLAY or SPECTATE for its game
+static void join(client_t* client)
+{
+    char join_msg[64];
+    if (client->spectator) {
+        sprintf(join_msg, "SPECTATE #%d", client->game);
+    } else {
+        sprintf(join_msg, "PLAY #%d load%d", client->game, client->game);
+    }
+    message_ctx_send(client->ctx, server, join_msg);
+}
+
+/* ***** print_step ***** */
+static void print_step(const step_t* step, double duration)
+{
+    qsort(step->latencies, step->num_latencies, sizeof(double), compare_doubles);
+    double loss = (step->sent > 0) ? 100.0 * step->lost / step->sent : 0;
+    double watched = (step->expected > 0) ? 100.0 * step->watched / step->expected : 100;
+    printf("%8.1f %9ld %9ld %9ld %10.3f %10.0f %10.0f %10.0f %8.2f %8.0f\n", step->rate, step->sent,
+           step->answered, step->lost, loss, percentile(step, 0.5), percentile(step, 0.99),
+           percentile(step, 0.999), watched, step->answered / duration);
+    fflush(stdout);
+}
+
+/* ***** percentile ***** */
+// returns the latency below which fraction p of the sorted latencies fall; 0 if none
+static double percentile(const step_t* step, double p)
+{
+    if (step->num_latencies == 0) {
+        return 0;
+    }
+    return step->latencies[(long)(p * (step->num_latencies - 1))];
+}
+
+/* ***** compare_doubles ***** */
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* ***** now_seconds ***** */
+// seconds on the monotonic clock
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* ***** str2int ***** */
+// converts a whole string to an integer; false if it is not one
+static bool str2int(const char string[], int* number)
+{
+    char nextchar;
+    return sscanf(string, "%d%c", number, &nextchar) == 1;
+}
@@ -0,0 +1,37 @@
+/* 
+ * mapc.c - compiles a nuggets map into the binary map format.
+ *  The compiled map holds the map's cells with a walkable bitmap, walkable
+ *  and room-cell indices and, with -v, a precomputed visibility table.
+ *  The server loads a compiled map directly, and every server process
+ *  using it shares the file read-only through the page cache.
+ *
+ * usage: ./mapc [-v] mapfile outfile
+ *
+ * foobarbaz, May 2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "grid.h"
+
+int main(int argc, char *argv[])
+{
+    bool visibility = false;  // precompute visibility too?
+
+    // pick off the optional flag, then check usage
+    if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+        visibility = true;
+        argv++;
+        argc--;
+    }
+    if (argc != 3) {
+        fprintf(stderr, "usage: ./mapc [-v] mapfile outfile\n");
+        exit(1);
+    }
+
+    if (!grid_compile(argv[1], argv[2], visibility)) {
+        exit(2);
+    }
+    return 0;
+}
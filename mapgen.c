@@ -0,0 +1,382 @@
+/*
+ * mapgen.c - generates valid nuggets maps of any size from a seed.
+ *  The map is divided into a lattice of slots. Some slots hold a room,
+ *  the others a passage junction; a random spanning tree over the lattice,
+ *  plus a few extra links, is drawn as `#` passages, so the map is one
+ *  connected component. Passages cross the gaps between slots with at
+ *  most two turns and enter rooms through their walls, never at corners.
+ *
+ * usage: ./mapgen [-s seed] [-r rooms] [-c corridor] [-d dots] rows cols
+ *   rooms    - number of rooms (default: one per 600 gridpoints)
+ *   corridor - gap between neighbouring slots that passages cross (default: a quarter of a slot)
+ *   dots     - total room spots to aim for (default: random room sizes)
+ * The map is written to stdout; the number of rooms, spots and passage
+ * spots is written to stderr.
+ *
+ * foobarbaz, May 2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+//One slot of the lattice: a room's box, or a junction point when top == bottom
+typedef struct node {
+	int top;	// rows and columns of the room's boundary, or of the junction
+	int left;
+	int bottom;
+	int right;
+	bool is_room;
+	int degree;	// links drawn to neighbouring slots
+} node_t;
+
+//A map under construction
+typedef struct map {
+	int rows;
+	int cols;
+	char *chars;	// rows x cols map characters
+	int slot_rows;	// lattice of slots
+	int slot_cols;
+	int slot_height;
+	int slot_width;
+	int margin;	// rock kept around each box within its slot
+	node_t *nodes;	// slot_rows x slot_cols
+} map_t;
+
+static const char Usage[] = "usage: ./mapgen [-s seed] [-r rooms] [-c corridor] [-d dots] rows cols\n";
+static const int GridpointsPerRoom = 600;	// default room density
+static const int ExtraLinkPercent = 10;	// links beyond the spanning tree, per hundred slot pairs
+
+static bool str2int(const char string[], int *number);
+static int rand_between(int low, int high);
+static void place_node(map_t *map, int slot, int target_dots);
+static void link_nodes(map_t *map, int a, int b, bool horizontal);
+static void draw_passage(map_t *map, int row, int col);
+static void draw_room(map_t *map, node_t *node);
+static void prune_junctions(map_t *map, bool *links);
+
+int main(int argc, char *argv[])
+{
+	int seed = time(NULL);
+	int rooms = 0;	// 0 until set
+	int corridor = -1;
+	int dots = 0;
+
+	// pick off the options, then check usage
+	int arg = 1;
+	for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+		int value;
+		if (!str2int(argv[arg+1], &value) || strlen(argv[arg]) != 2) {
+			fprintf(stderr, Usage);
+			return 1;
+		}
+		switch (argv[arg][1]) {
+			case 's': seed = value; break;
+			case 'r': rooms = value; break;
+			case 'c': corridor = value; break;
+			case 'd': dots = value; break;
+			default:
+				fprintf(stderr, Usage);
+				return 1;
+		}
+	}
+	map_t map;
+	if (argc - arg != 2 || !str2int(argv[arg], &map.rows) || !str2int(argv[arg+1], &map.cols)) {
+		fprintf(stderr, Usage);
+		return 1;
+	}
+	if (map.rows < 5 || map.cols < 5 || (double)map.rows * map.cols > 1e9) {
+		fprintf(stderr, "Map must be at least 5x5, and at most 1e9 gridpoints.\n");
+		return 1;
+	}
+	srand(seed);
+
+	// lay the slots out to match the map's shape; each must fit a room with its gaps
+	if (rooms <= 0) {
+		rooms = (map.rows * map.cols) / GridpointsPerRoom + 1;
+	}
+	int min_slot = (corridor < 0) ? 5 : corridor + 3;
+	int max_slots = (map.rows / min_slot) * (map.cols / min_slot);
+	if (max_slots < 1) {
+		fprintf(stderr, "A %d corridor leaves no room for rooms in a %dx%d map.\n", corridor, map.rows, map.cols);
+		return 1;
+	}
+	if (rooms > max_slots) {
+		fprintf(stderr, "Only %d rooms fit; making %d.\n", max_slots, max_slots);
+		rooms = max_slots;
+	}
+	map.slot_rows = (int)round(sqrt((double)rooms * map.rows / map.cols));
+	if (map.slot_rows < 1) {
+		map.slot_rows = 1;
+	}
+	if (map.slot_rows > map.rows / min_slot) {
+		map.slot_rows = map.rows / min_slot;
+	}
+	map.slot_cols = (rooms + map.slot_rows - 1) / map.slot_rows;
+	if (map.slot_cols > map.cols / min_slot) {	// too narrow: take more rows instead
+		map.slot_cols = map.cols / min_slot;
+		map.slot_rows = (rooms + map.slot_cols - 1) / map.slot_cols;
+	}
+	map.slot_height = map.rows / map.slot_rows;
+	map.slot_width = map.cols / map.slot_cols;
+	int slot_min = (map.slot_height < map.slot_width) ? map.slot_height : map.slot_width;
+	if (corridor < 0) {
+		corridor = slot_min / 4;
+	}
+	map.margin = (corridor + 1) / 2;
+	if (map.margin < 1) {
+		map.margin = 1;
+	}
+
+	int slots = map.slot_rows * map.slot_cols;
+	map.chars = malloc((size_t)map.rows * map.cols);
+	map.nodes = calloc(slots, sizeof(node_t));
+	int *order = malloc(slots * sizeof(int));
+	bool *links = calloc((size_t)slots * 2, sizeof(bool));	// 2*slot: link right; 2*slot+1: link down
+	int *stack = malloc(slots * sizeof(int));
+	bool *visited = calloc(slots, sizeof(bool));
+	if (map.chars == NULL || map.nodes == NULL || order == NULL || links == NULL || stack == NULL || visited == NULL) {
+		fprintf(stderr, "Not enough memory for a %dx%d map.\n", map.rows, map.cols);
+		return 2;
+	}
+	memset(map.chars, ' ', (size_t)map.rows * map.cols);
+
+	// a random choice of slots hold the rooms
+	for (int i = 0; i < slots; i++) {
+		order[i] = i;
+	}
+	for (int i = slots - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		int swap = order[i];
+		order[i] = order[j];
+		order[j] = swap;
+	}
+	for (int i = 0; i < rooms; i++) {
+		map.nodes[order[i]].is_room = true;
+	}
+	for (int i = 0; i < slots; i++) {
+		place_node(&map, i, dots / rooms);
+	}
+	rooms = 0;	// some slots may have been too small for their room
+	for (int i = 0; i < slots; i++) {
+		rooms += map.nodes[i].is_room;
+	}
+
+	// spanning tree over the lattice by randomized depth-first search
+	int depth = 0;
+	stack[depth++] = 0;
+	visited[0] = true;
+	while (depth > 0) {
+		int slot = stack[depth - 1];
+		int r = slot / map.slot_cols, c = slot % map.slot_cols;
+		int next[4], count = 0;
+		if (r > 0 && !visited[slot - map.slot_cols]) next[count++] = slot - map.slot_cols;
+		if (r < map.slot_rows - 1 && !visited[slot + map.slot_cols]) next[count++] = slot + map.slot_cols;
+		if (c > 0 && !visited[slot - 1]) next[count++] = slot - 1;
+		if (c < map.slot_cols - 1 && !visited[slot + 1]) next[count++] = slot + 1;
+		if (count == 0) {
+			depth--;
+			continue;
+		}
+		int to = next[rand() % count];
+		int from = (to < slot) ? to : slot;	// links are kept on the upper or left slot
+		bool same_row = (to / map.slot_cols == r);
+		links[2 * from + (same_row ? 0 : 1)] = true;
+		visited[to] = true;
+		stack[depth++] = to;
+	}
+	// a few extra links make loops
+	for (int i = 0; i < 2 * slots; i++) {
+		if (!links[i] && rand() % 100 < ExtraLinkPercent) {
+			links[i] = true;
+		}
+	}
+	for (int slot = 0; slot < slots; slot++) {	// drop links off the lattice's edges
+		if (slot % map.slot_cols == map.slot_cols - 1) links[2 * slot] = false;
+		if (slot / map.slot_cols == map.slot_rows - 1) links[2 * slot + 1] = false;
+	}
+	prune_junctions(&map, links);
+
+	for (int slot = 0; slot < slots; slot++) {
+		if (map.nodes[slot].is_room) {
+			draw_room(&map, &map.nodes[slot]);
+		}
+	}
+	for (int slot = 0; slot < slots; slot++) {
+		if (links[2 * slot]) {
+			link_nodes(&map, slot, slot + 1, true);
+		}
+		if (links[2 * slot + 1]) {
+			link_nodes(&map, slot, slot + map.slot_cols, false);
+		}
+	}
+
+	// write the map and report what is in it
+	long num_dots = 0, num_passages = 0;
+	for (size_t i = 0; i < (size_t)map.rows * map.cols; i++) {
+		num_dots += (map.chars[i] == '.');
+		num_passages += (map.chars[i] == '#');
+	}
+	for (int row = 0; row < map.rows; row++) {
+		fwrite(map.chars + (size_t)row * map.cols, 1, map.cols, stdout);
+		putchar('\n');
+	}
+	fprintf(stderr, "%dx%d map, seed %d: %d rooms, %ld spots, %ld passage spots\n",
+		map.rows, map.cols, seed, rooms, num_dots, num_passages);
+
+	free(map.chars);
+	free(map.nodes);
+	free(order);
+	free(links);
+	free(stack);
+	free(visited);
+	return (fflush(stdout) == 0) ? 0 : 2;
+}
+
+// places a slot's room or junction at random within the slot, leaving the
+// margin clear; a room's interior aims at target_dots spots when nonzero
+static void place_node(map_t *map, int slot, int target_dots)
+{
+	node_t *node = &map->nodes[slot];
+	int slot_top = (slot / map->slot_cols) * map->slot_height;
+	int slot_left = (slot % map->slot_cols) * map->slot_width;
+	int max_height = map->slot_height - 2 * map->margin;	// box size that fits
+	int max_width = map->slot_width - 2 * map->margin;
+
+	if (!node->is_room || max_height < 3 || max_width < 3) {
+		node->is_room = false;
+		node->top = node->bottom = slot_top + map->slot_height / 2;
+		node->left = node->right = slot_left + map->slot_width / 2;
+		return;
+	}
+
+	int height, width;	// of the boundary box
+	if (target_dots > 0) {
+		// interior area near the target, with a random aspect near the slot's
+		double aspect = (double)max_width / max_height * (0.5 + (rand() % 100) / 100.0);
+		int inner_width = (int)round(sqrt(target_dots * aspect));
+		inner_width = (inner_width < 1) ? 1 : (inner_width > max_width - 2) ? max_width - 2 : inner_width;
+		int inner_height = (target_dots + inner_width - 1) / inner_width;
+		inner_height = (inner_height < 1) ? 1 : (inner_height > max_height - 2) ? max_height - 2 : inner_height;
+		height = inner_height + 2;
+		width = inner_width + 2;
+	}
+	else {
+		height = rand_between(3 + (max_height - 3) / 3, max_height);
+		width = rand_between(3 + (max_width - 3) / 3, max_width);
+	}
+	node->top = slot_top + map->margin + rand_between(0, max_height - height);
+	node->left = slot_left + map->margin + rand_between(0, max_width - width);
+	node->bottom = node->top + height - 1;
+	node->right = node->left + width - 1;
+}
+
+// removes junctions that lead nowhere, so no passage dead-ends
+static void prune_junctions(map_t *map, bool *links)
+{
+	int slots = map->slot_rows * map->slot_cols;
+	for (int slot = 0; slot < slots; slot++) {
+		if (links[2 * slot]) {
+			map->nodes[slot].degree++;
+			map->nodes[slot + 1].degree++;
+		}
+		if (links[2 * slot + 1]) {
+			map->nodes[slot].degree++;
+			map->nodes[slot + map->slot_cols].degree++;
+		}
+	}
+	bool pruned = true;
+	while (pruned) {
+		pruned = false;
+		for (int slot = 0; slot < slots; slot++) {
+			node_t *node = &map->nodes[slot];
+			if (node->is_room || node->degree != 1) {
+				continue;
+			}
+			// drop its only link
+			int neighbours[4][2] = {
+				{ 2 * slot, slot + 1 }, { 2 * slot + 1, slot + map->slot_cols },
+				{ 2 * (slot - 1), slot - 1 }, { 2 * (slot - map->slot_cols) + 1, slot - map->slot_cols },
+			};
+			for (int i = 0; i < 4; i++) {
+				int link = neighbours[i][0];
+				if (link >= 0 && link < 2 * slots && neighbours[i][1] >= 0 && links[link]) {
+					links[link] = false;
+					map->nodes[neighbours[i][1]].degree--;
+					break;
+				}
+			}
+			node->degree = 0;
+			pruned = true;
+		}
+	}
+}
+
+// draws a passage between neighbouring slots a and b (b right of or below a):
+// out through a door in a's facing wall, across the gap with at most two
+// turns, and in through a door in b's facing wall; junctions are their own doors
+static void link_nodes(map_t *map, int a, int b, bool horizontal)
+{
+	node_t *from = &map->nodes[a];
+	node_t *to = &map->nodes[b];
+	if (horizontal) {
+		// doors on interior rows, so never at a corner
+		int from_row = from->is_room ? rand_between(from->top + 1, from->bottom - 1) : from->top;
+		int to_row = to->is_room ? rand_between(to->top + 1, to->bottom - 1) : to->top;
+		int start = from->is_room ? from->right + 1 : from->right;
+		int end = to->is_room ? to->left - 1 : to->left;
+		int turn = rand_between(start, end);
+		for (int col = start; col <= turn; col++) draw_passage(map, from_row, col);
+		for (int row = (from_row < to_row ? from_row : to_row); row <= (from_row < to_row ? to_row : from_row); row++) draw_passage(map, row, turn);
+		for (int col = turn; col <= end; col++) draw_passage(map, to_row, col);
+		if (from->is_room) draw_passage(map, from_row, from->right);
+		if (to->is_room) draw_passage(map, to_row, to->left);
+	}
+	else {
+		int from_col = from->is_room ? rand_between(from->left + 1, from->right - 1) : from->left;
+		int to_col = to->is_room ? rand_between(to->left + 1, to->right - 1) : to->left;
+		int start = from->is_room ? from->bottom + 1 : from->bottom;
+		int end = to->is_room ? to->top - 1 : to->top;
+		int turn = rand_between(start, end);
+		for (int row = start; row <= turn; row++) draw_passage(map, row, from_col);
+		for (int col = (from_col < to_col ? from_col : to_col); col <= (from_col < to_col ? to_col : from_col); col++) draw_passage(map, turn, col);
+		for (int row = turn; row <= end; row++) draw_passage(map, row, to_col);
+		if (from->is_room) draw_passage(map, from->bottom, from_col);
+		if (to->is_room) draw_passage(map, to->top, to_col);
+	}
+}
+
+// makes one gridpoint a passage spot
+static void draw_passage(map_t *map, int row, int col)
+{
+	map->chars[(size_t)row * map->cols + col] = '#';
+}
+
+// draws a room's boundary and fills its interior with spots
+static void draw_room(map_t *map, node_t *node)
+{
+	for (int row = node->top; row <= node->bottom; row++) {
+		char *line = map->chars + (size_t)row * map->cols;
+		for (int col = node->left; col <= node->right; col++) {
+			bool edge_row = (row == node->top || row == node->bottom);
+			bool edge_col = (col == node->left || col == node->right);
+			line[col] = (edge_row && edge_col) ? '+' : edge_row ? '-' : edge_col ? '|' : '.';
+		}
+	}
+}
+
+// returns a random integer in [low, high]
+static int rand_between(int low, int high)
+{
+	return (high <= low) ? low : low + rand() % (high - low + 1);
+}
+
+// converts a string to a nonnegative int, false if it is not entirely one
+static bool str2int(const char string[], int *number)
+{
+	char nextchar;
+	return sscanf(string, "%d%c", number, &nextchar) == 1 && *number >= 0;
+}
@@ -0,0 +1,145 @@
+#!/bin/sh
+#
+# pgo.sh - builds everything with profile-guided and link-time optimization.
+#  0. Copies the sources to pgo/build and builds there, so the binaries,
+#     benchmark maps and logs in the tree are left alone.
+#  1. Builds the default (unoptimized) binaries, and an -O2 -flto build,
+#     keeping copies of each in pgo/ for comparison.
+#  2. Records a workload: loadgen bots playing maps/main.txt and a large
+#     generated map, through the default server with -R.
+#  3. Builds instrumented binaries and trains them on the same play: the
+#     server live (so its message loop, the render pool and, with -i, the
+#     network I/O thread are profiled), a player in a pseudo-terminal, and
+#     replay on the recordings.
+#  4. Rebuilds with -fprofile-use and LTO, leaving those binaries in
+#     pgo/build.
+#  5. Times the three builds on the same work, one line each, and prints
+#     each build's speedup over the one before it, so what the profile
+#     adds is not mixed up with what -O2 -flto does: replaying the
+#     recordings, gridbench's grid_display_board, and messagebench's
+#     ping-pong.
+#
+# usage: ./pgo.sh   (make pgo runs it)
+#   PGO_PORT - port for the training servers (default 40247)
+#
+# foobarbaz, May 2019
+#
+
+set -e
+DIR=pgo
+B=$DIR/build                # where everything is built
+PORT=${PGO_PORT:-40247}
+OPT="-O2 -flto=auto"
+GEN="$OPT -fprofile-generate -fprofile-update=atomic"   # the render pool counts from several threads
+USE="$OPT -fprofile-use -fprofile-correction -Wno-missing-profile"
+MAPS="maps/main.txt $DIR/large.txt"
+
+# builds everything in $B with the given optimization flags, after
+# removing the objects but not the profile data
+build() {
+    rm -f $B/*.o $B/*.a $B/support/*.o $B/support/support.a
+    make -C $B all OPTFLAGS="$1" AR=gcc-ar > /dev/null
+    rm -f $B/support/messagebench
+    make -C $B/support messagebench OPTFLAGS="$1" > /dev/null
+}
+
+# keeps a copy of the binaries timed, as $DIR/<name>.<build>
+keep() {
+    for prog in replay gridbench support/messagebench; do
+        cp $B/$prog $DIR/$(basename $prog).$1
+    done
+}
+
+# plays a map with bots against a server started with the given options
+# usage: play server options... mapfile
+play() {
+    server=$1
+    shift
+    $server -p $PORT "$@" 2> /dev/null &
+    pid=$!
+    sleep 0.5
+    $DIR/loadgen -n 30 -s 5 -k 20 -d 3 localhost $PORT > /dev/null
+    # a player moving about game 0, in a terminal large enough for it
+    if command -v script > /dev/null; then
+        (sleep 1; printf 'llllhhhhjjjjkkkkyyuubbnnLHJKYUBNllhhjjkk'; sleep 1; printf 'Q'; sleep 1) |
+            script -qc "stty rows 50 cols 200; $B/player localhost $PORT bot" /dev/null > /dev/null 2>&1 || true
+    fi
+    kill -TERM $pid
+    wait $pid
+}
+
+# times a build of the binaries kept, printing seconds of replay (the best
+# of three passes), ns per grid_display_board, and ping-pong round trips
+# per second
+measure() {
+    replay=
+    for pass in 1 2 3; do
+        start=$(date +%s.%N)
+        for rec in $DIR/*.rec; do
+            $DIR/replay.$1 $rec > /dev/null
+        done
+        end=$(date +%s.%N)
+        replay=$(echo "$start $end $replay" | awk '{ t = $2 - $1; print ($3 == "" || t < $3) ? t : $3 }')
+    done
+    display=$($DIR/gridbench.$1 -t 0.2 $MAPS | awk '$4 == "grid_display_board" { sum += $6 } END { print sum }')
+    pingpong=$($DIR/messagebench.$1 -t 0.5 -s 6,2048 pingpong | awk '$1 == "pingpong" { sum += $6 } END { print sum }')
+    echo "$replay $display $pingpong"
+}
+
+# a fresh copy of the sources; the maps are read from the tree
+rm -rf $DIR
+mkdir -p $B/support
+cp Makefile *.c *.h $B
+cp support/Makefile support/*.c support/*.h $B/support
+
+echo "default build"
+build ""
+keep default
+$B/mapgen -s 1 600 2000 > $DIR/large.txt 2> /dev/null
+cp $B/loadgen $DIR/loadgen      # the bots are not trained on, so they stay the same throughout
+echo "recording the workload"
+for map in $MAPS; do
+    play $B/server -R $DIR/$(basename $map .txt).rec $map 1
+done
+
+echo "-O2 -flto build"
+build "$OPT"
+keep lto
+
+echo "instrumented build, training"
+build "$GEN"
+for map in $MAPS; do
+    play $B/server -r 2 $map 1
+    play $B/server $map 2
+    play $B/server -i $map 3
+done
+for rec in $DIR/*.rec; do
+    $B/replay $rec > /dev/null
+done
+
+echo "profile-guided build"
+build "$USE"
+keep pgo
+
+echo "timing"
+base=$(measure default)
+lto=$(measure lto)
+pgo=$(measure pgo)
+# one line per build; the speedups are over the line before, so the
+# profile is credited only with what it adds to -O2 -flto
+echo "default $base
+-O2_-flto $lto
+-O2_-flto_+_profile $pgo" | awk '
+    BEGIN {
+        printf "%-22s %11s %11s %13s %9s %9s %10s\n", "build", "replay s", "display ns", "pingpong rt/s",
+            "replay x", "display x", "pingpong x"
+    }
+    {
+        gsub("_", " ", $1)
+        printf "%-22s %11.3f %11.0f %13.0f", $1, $2, $3, $4
+        if (NR > 1) {
+            printf " %8.2fx %8.2fx %9.2fx", replay / $2, display / $3, $4 / pingpong
+        }
+        printf "\n"
+        replay = $2; display = $3; pingpong = $4
+    }' | tee $DIR/speedup.txt
@@ -2,18 +2,28 @@
  * player.c – the client module for the nuggets game.
  *  Handles communication between the player/spectator and server.
  *
- * usage: ./player hostname port [playername]
+ * usage: ./player [-g gameid] hostname port [playername]
+ *        ./player --playback file [-s speed] [-t seconds]
+ *
+ * With --playback, plays back a spectator recording made by the server's
+ * -S option instead, from the given second and at the given speed. While
+ * it plays, space pauses, + and - double and halve the speed, h and l
+ * seek 10 seconds back and forward, H and L seek to the start and end,
+ * and q quits.
  *
  * exit: 0 on normal run-through; 1 on error initializing message module;
  *  2 on usage error;
  *  3 on error connecting with host; 4 on fatal error from message loop
  *  5 on error from resizing screen during game
+ *  6 on error reading a recording
  *
  * foobarbaz, May 2019
  */
 
+#define _DEFAULT_SOURCE  // for clock_gettime
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <ncurses.h>
 #include <ctype.h>
 #include <stdbool.h>
@@ -21,6 +31,7 @@
 #include <signal.h>
 #include "support/message.h"
 #include "support/log.h"
+#include "support/framerec.h"
 
 // Function Prototypes
 void resize_handler(int sig);
@@ -36,8 +47,11 @@ bool handle_gameover(const char *message);
 bool handle_stdin (void *arg);
 bool handle_message (void *arg, const addr_t from, const char *message);
 void initialize_curses();
+int playback(const char *path, double speed, double start);
 
 static const int MaxNameLength = 50;   // max number of chars in playerName
+static const long SeekStep = 10000;    // milliseconds skipped by h and l in playback
+static const int PlaybackTick = 100;   // milliseconds between status line updates in playback
 static char tag;    // letter representing player on map
 static char* map;   // pointer to string representing map
 static int N;    // number of nuggets recently collected by player
@@ -97,7 +111,8 @@ void update_display()
     int row = 1; int col = 0;   // to store tag location
 
     // iterate through characters in map string
-    for (int i = 1; i < strlen(map); i++) {
+    int length = strlen(map);
+    for (int i = 1; i < length; i++) {
         addch(map[i]);
         if (searching && map[i] == '\n') {  // move to next line
             row++;
@@ -252,7 +267,12 @@ bool handle_stdin (void *arg)
         // to steer cursor
         int c = getch();    // read one character
         char message[30];
-        sprintf(message, "KEY %c", c);
+        if (c == 'g') {
+            // travel to the nearest gold, in one message rather than a key per step
+            sprintf(message, "TRAVEL");
+        } else {
+            sprintf(message, "KEY %c", c);
+        }
         message_send(*otherp, message); // communicate to server
     } else {
         log_v("handle_stdin called without a correspondent.");
@@ -315,10 +335,119 @@ initialize_curses()
         curs_set(0);
 }
 
+/* ***** playback ***** */
+// plays back a spectator recording, at speed times real time from start seconds in
+// returns the exit status: 0, or 6 if the recording cannot be read
+// path: recording made by the server's -S option
+int playback(const char *path, double speed, double start)
+{
+    frameplay_t *play = frameplay_open(path);
+    if (play == NULL || frameplay_count(play) == 0) {
+        fprintf(stderr, "%s is not a spectator recording.\n", path);
+        frameplay_close(play);
+        return 6;
+    }
+
+    // frames are displays: rows of cols characters, each ending in a newline
+    int size = frameplay_size(play);
+    const char *first = frameplay_seek(play, 0, NULL);
+    int ncols = strchr(first, '\n') - first;
+    int nrows = size / (ncols + 1);
+    long end = frameplay_time(play, frameplay_count(play) - 1);
+    long pos = start * 1000;  // milliseconds into the recording
+
+    initialize_curses();
+    keypad(stdscr, TRUE);
+    char grid_msg[32];
+    sprintf(grid_msg, "GRID %d %d", nrows, ncols);
+    handle_grid(grid_msg);
+
+    // update_display skips the newline that follows DISPLAY in a message
+    char display[size + 2];
+    display[0] = '\n';
+    map = display;
+    bool paused = false;
+    struct timespec last;
+    clock_gettime(CLOCK_MONOTONIC, &last);
+    while (true) {
+        if (pos < 0) {
+            pos = 0;
+        }
+        if (pos >= end) {
+            pos = end;
+            paused = true;  // stay on the last frame
+        }
+        int i = frameplay_find(play, pos);
+        strcpy(&display[1], frameplay_seek(play, i, &R));
+        sprintf(error_message, "[%s %gx] %.1fs of %.1fs", paused ? "paused" : "playing",
+                speed, pos / 1000.0, end / 1000.0);
+        show_error_message = true;
+        update_statusline();
+        update_display();
+
+        // sleep until the next frame is due, but wake to tick the status line
+        int wait = PlaybackTick;
+        if (!paused && i + 1 < frameplay_count(play)) {
+            long due = (frameplay_time(play, i + 1) - pos) / speed;
+            wait = (due < wait) ? ((due > 0) ? due : 0) : wait;
+        }
+        timeout(paused ? -1 : wait);
+        int c = getch();
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!paused) {
+            pos += ((now.tv_sec - last.tv_sec) * 1000 + (now.tv_nsec - last.tv_nsec) / 1000000) * speed;
+        }
+        last = now;
+
+        if (c == 'q' || c == 'Q') {
+            break;
+        } else if (c == ' ') {
+            paused = !paused;
+        } else if (c == '+') {
+            speed *= 2;
+        } else if (c == '-') {
+            speed /= 2;
+        } else if (c == 'h' || c == KEY_LEFT) {
+            pos -= SeekStep;
+        } else if (c == 'l' || c == KEY_RIGHT) {
+            pos += SeekStep;
+        } else if (c == 'H') {
+            pos = 0;
+        } else if (c == 'L') {
+            pos = end;
+        }
+    }
+
+    endwin();
+    frameplay_close(play);
+    return 0;
+}
+
 /* **************************************** */
-int main(const int argc, const char *argv[])
+int main(int argc, const char *argv[])
 {
     addr_t other; // address of the other side of this communication
+    char game[16] = "";  // optional "#id" selecting the game to join
+
+    // playing back a recording needs no server
+    if (argc > 1 && strcmp(argv[1], "--playback") == 0) {
+        double speed = 1; double start = 0; char nextchar;
+        int i = 3;
+        for (; i + 1 < argc; i += 2) {
+            if (strcmp(argv[i], "-s") == 0 && sscanf(argv[i+1], "%lf%c", &speed, &nextchar) == 1 && speed > 0)
+                continue;
+            if (strcmp(argv[i], "-t") == 0 && sscanf(argv[i+1], "%lf%c", &start, &nextchar) == 1 && start >= 0)
+                continue;
+            break;
+        }
+        if (argc < 3 || i != argc) {
+            fprintf(stderr, "usage: ./player --playback file [-s speed] [-t seconds]\n");
+            exit(2);
+        }
+        exit(playback(argv[2], speed, start));
+    }
 
     // initialize the logging module
     log_init(stderr);
@@ -330,9 +459,19 @@ int main(const int argc, const char *argv[])
         exit(1);
     }
 
-    // check usage
+    // pick off the optional game ID, then check usage
+    if (argc > 2 && strcmp(argv[1], "-g") == 0) {
+        int id = 0; char nextchar;
+        if (sscanf(argv[2], "%d%c", &id, &nextchar) != 1 || id < 0) {
+            fprintf(stderr, "Game ID must be a nonnegative integer.\n");
+            exit(2);
+        }
+        sprintf(game, "#%d", id);
+        argv += 2;
+        argc -= 2;
+    }
     if (argc != 3 && argc != 4) {
-        fprintf(stderr, "usage: ./player hostname port [yourname] \n");
+        fprintf(stderr, "usage: ./player [-g gameid] hostname port [yourname] \n");
         exit(2); 
     }
 
@@ -355,12 +494,21 @@ int main(const int argc, const char *argv[])
 
     // client speaks first
     // determine appropriate message to join server with
-    char message[10 + MaxNameLength];
+    char message[10 + sizeof(game) + MaxNameLength];
     if (is_player) {
         strcpy(message, "PLAY ");
+        if (game[0] != '\0') {        // pass game ID, if any
+            strcat(message, game);
+            strcat(message, " ");
+        }
         strcat(message, playername);   // pass playername
-    } else
+    } else {
         strcpy(message, "SPECTATE");
+        if (game[0] != '\0') {        // pass game ID, if any
+            strcat(message, " ");
+            strcat(message, game);
+        }
+    }
     message_send(other, message);
     
     // optional message loop parameters timeout and handleTimeout are left 0 and NULL 
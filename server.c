@@ -1,35 +1,203 @@
 /* 
  * server.c - the server for the nuggets game.
- *  Handles communication between the grid and the players.
+ *  A network adapter over the game engine (game.h): turns the players'
+ *  messages into engine calls, and the engine's state into messages.
+ *  Hosts any number of independent games, each its own engine,
+ *  routed by the game ID given in PLAY/SPECTATE.
+ *  With -w, games are sharded over worker processes sharing one port.
+ *  With -i, a dedicated thread does all network I/O for each process.
+ *  With -r, displays are rendered in parallel on a pool of threads.
+ *  With -R, every message handled is recorded for the replay tool.
+ *  With -S, each game's spectator view is recorded for player --playback.
+ *  A STATS message from localhost, or from the address given with -a,
+ *  is answered with the server's counters; STATS #k asks worker k.
+ *  A TRAVEL message moves its player toward the nearest gold, a step
+ *  every TravelTick, until it gets there or sends a key.
  *
- * usage: ./server mapfile [seed]
+ * usage: ./server [-w workers] [-p port] [-r threads] [-i] [-R recording] [-S frames] [-a admin] [-T trace] mapfile [seed]
+ *
+ * Built with -DPROBES (make PROBES=1), each message's and each travel tick's time is split into
+ * phases timed into histograms, printed at each game over and when the
+ * server stops; with -T, the phases are also written as a Chrome trace.
+ *
+ * Built with -DREPLAY, this is instead the replay tool, which feeds a
+ * recording back through handle_message without a network:
+ *
+ * usage: ./replay [-t] [-m mapfile] recording
  *
  * foobarbaz, April 2019
  */
 
+#define _DEFAULT_SOURCE	// for clock_gettime and nanosleep
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <message.h>
+#include <netio.h>
 #include <string.h>
 #include <file.h>
-#include "grid.h"
+#include <framerec.h>
+#include <probe.h>
+#include "game.h"
 #include <math.h>
 #include <time.h>
 #include <ctype.h>
 #include <memory.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+//Hosted struct for one hosted game: its engine and the addresses of its clients
+typedef struct hosted {
+  int id;
+  game_t* engine;
+  addr_t* addrs;       // address of the player in each slot
+  bool* traveling;     // whether the player in each slot is traveling to gold
+  int travelers;       // players of the game traveling
+  addr_t spectator;    // address of the spectator
+  bool watched;        // whether there is a spectator
+  framerec_t* frames;  // recording of the spectator's view, with -S; else NULL
+  char* frame;         // the spectator's view, rendered for the recording
+  uint64_t frame_seq;  // journal position frame is drawn up to; 0 until first drawn
+  struct hosted* next;  // next game in the same bucket of the game table
+} hosted_t;
+
+//Client struct for routing an address to the game it joined
+typedef struct client {
+  addr_t addr;
+  hosted_t* game;
+  int via;              // worker forwarding its messages here, or -1
+  struct client* next;  // next client in the same bucket of the client table
+} client_t;
+
+//Forward struct for routing an address to the worker hosting its game
+typedef struct forward {
+  addr_t addr;
+  int worker;
+  struct forward* next;  // next forward in the same bucket of the forward table
+} forward_t;
+
+//Sender struct for numbering the addresses seen in a recording
+typedef struct sender {
+  addr_t addr;
+  uint32_t slot;
+  struct sender* next;  // next sender in the same bucket of the sender table
+} sender_t;
+
+//Header of a recording (-R). The map path follows it, then a
+//record_entry and the message text for each message handled, in order.
+//An entry with no text marks a time the server took travel steps
+//without a message, so a replay takes them by then too.
+//Fields are in the recording machine's byte order.
+typedef struct record_header {
+  char magic[8];        // RecordMagic
+  uint32_t version;     // RecordVersion
+  int32_t seed;         // base seed the games were started from
+  uint32_t map_length;  // bytes in the map path, which has no null
+} record_header_t;
+
+typedef struct record_entry {
+  uint32_t delay;       // microseconds since the previous entry
+  uint32_t slot;        // sender; addresses are numbered in the order first seen
+  uint32_t length;      // bytes in the message text, which has no null
+} record_entry_t;
+
+#define NumStatTypes 13                // message types counted, "other" last
+#define StatStats 4                    // index of "STATS" among them
+
+//Counters answered to a STATS query; each worker keeps its own, and
+//STATS #k reaches worker k through the forwarding of PLAY/SPECTATE. Only the
+//thread handling messages touches them, so they are plain counts.
+typedef struct stats {
+  long in[NumStatTypes];     // messages handled, by type (StatTypes)
+  long out[NumStatTypes];    // messages sent, by type
+  long bytes_out;            // bytes in the messages sent
+  long renders;              // boards rendered, one per message handled for a game
+  long views;                // displays rendered on those boards
+  long views_skipped;        // displays not rendered, of players who quit
+  long travel_steps;         // steps taken by traveling players, waits included
+  double render_total;       // seconds spent rendering boards
+  double render_max;         // longest board render, in seconds
+  struct timespec started;   // when serving started
+} stats_t;
+
+#ifdef PROBES
+//Phases of handling a message, each timed into a histogram. Parse is the rest
+//of the message's time: parsing, routing, recording and the other replies.
+//Travel is the rest of a travel tick's time, outside its steps' phases.
+enum { ProbeParse, ProbeSimulate, ProbeRender, ProbeSend, ProbeTravel, NumProbes };
+#define PROBE_BEGIN(t) uint64_t t = probe_now()
+#define PROBE_END(phase, t) probe_end(phase, t)
+#define PROBE_MESSAGE(t, message) probe_rest(ProbeParse, t, "handle_message", StatTypes[stat_type(message)])
+#define PROBE_TICK(t) probe_rest(ProbeTravel, t, "travel_tick", NULL)
+#define PROBE_PRINT() probe_print(stdout, probes, NumProbes)
+#else
+// compiled out: no clock reads and no histograms
+#define PROBE_BEGIN(t)
+#define PROBE_END(phase, t)
+#define PROBE_MESSAGE(t, message)
+#define PROBE_TICK(t)
+#define PROBE_PRINT()
+#endif
 
 // Function Prototypes
+int parse_options(const int argc, const char *argv[]);
 int validate_params(const int argc, const char *argv[]);
 bool handle_message(void *arg, const addr_t from, const char *message);
-void add_player(addr_t from, const char* name);
-void process_keystroke(addr_t from, char key);
-void add_spectator(addr_t from);
-void game_over();
-void send_board();
-void player_remove(player_t* player);
-player_t* get_player_from_addr(addr_t from);
-void free_player(player_t* player);
-void free_grid();
+bool handle_timeout(void *arg);
+void stop_serving(int sig);
+void dispatch_message(const addr_t from, const char *message);
+void send_message(const addr_t to, const char *message);
+bool serve(message_ctx_t* ctx);
+int run_workers();
+int owner_of(const addr_t from, const char *message);
+void forward_message(int worker, const addr_t from, const char *message);
+void send_envelope(int worker, char op, const addr_t client, const char *message);
+const char* unwrap_forward(const addr_t from, const char *message, addr_t *client, char *op, int *sender);
+void handle_forward(const addr_t client, char op, int sender, const char *message);
+int forward_of(const addr_t from);
+void set_forward(const addr_t from, int worker);
+void drop_forward(const addr_t from, int worker);
+void free_forwards();
+void add_player(hosted_t* game, addr_t from, const char* name);
+void process_keystroke(hosted_t* game, addr_t from, char key);
+void add_spectator(hosted_t* game, addr_t from);
+void remove_spectator(hosted_t* game);
+void game_over(hosted_t* game);
+void send_board(hosted_t* game);
+void send_gold(hosted_t* game, int slot, int collected);
+void announce_gold(hosted_t* game, int slot, int collected);
+bool start_travel(hosted_t* game, addr_t from);
+bool travel_step(hosted_t* game, int slot);
+void set_traveling(hosted_t* game, int slot, bool traveling);
+bool travel_ticks();
+static void mark_time();
+int get_slot_from_addr(hosted_t* game, addr_t from);
+hosted_t* find_game(int id);
+hosted_t* start_game(int id);
+void end_game(hosted_t* game);
+bool game_idle(hosted_t* game);
+void free_games();
+hosted_t* game_from_addr(addr_t from);
+void route_client(addr_t from, hosted_t* game);
+void unroute_client(addr_t from);
+static int addr_bucket(const addr_t addr);
+static const char* parse_game_id(const char* str, int* id);
+bool record_open(const char* path);
+void record_message(const addr_t from, const char *message);
+void record_entry(uint32_t slot, const char *text);
+void record_close();
+static uint32_t sender_slot(const addr_t from);
+static int stat_type(const char* message);
+static bool is_admin(const addr_t from);
+void send_stats(const addr_t to);
+#ifdef PROBES
+static void probe_end(int phase, uint64_t start);
+static void probe_rest(int phase, uint64_t start, const char* name, const char* type);
+#endif
 static bool str2int(const char string[], int *number);
 
 const int name_width = 10;			   // default width for displaying a name in game_over
@@ -38,308 +206,633 @@ static const int MaxPlayers = 26;      // maximum number of players
 static const int GoldTotal = 300;      // amount of gold in the game
 static const int GoldMinNumPiles = 10; // minimum number of gold piles
 static const int GoldMaxNumPiles = 20; // maximum number of gold piles
-static const char PlayerTags[27] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 static const int MaxBytes = 65507;
+static const float ServeTick = 0.1;    // seconds the message loop waits before checking for a stop or travel steps due
+static const long TravelTick = 100000; // microseconds between the steps of a traveling player
+static const int ViewportRows = 40;    // display size for maps too large to send whole
+static const int ViewportCols = 120;
+static const int MaxGames = 1024;      // maximum number of games hosted at once
+static const int MaxWorkers = 64;      // maximum number of worker processes
+static const int RingCapacity = 4096;  // messages queued each way with -i
+static const int MaxRenderThreads = 64; // maximum number of render threads
+static const char Usage[] = "usage: ./server [-w workers] [-p port] [-r threads] [-i] [-R recording] [-S frames] [-a admin] [-T trace] mapfile [seed]\n";
+static const char* const StatTypes[NumStatTypes] = {
+	"PLAY", "KEY", "SPECTATE", "TRAVEL", "STATS", "OK", "GRID", "GOLD", "DISPLAY", "NO", "QUIT", "GAMEOVER", "other",
+};
+static const char RecordMagic[8] = "NUGREC";
+static const uint32_t RecordVersion = 1;
+#define GameBuckets 257                // buckets in the game table
+#define ClientBuckets 1031             // buckets in the client and forward tables
 
-//Game struct for holding grid and num_players
-typedef struct {
-  grid_t* grid;
-  int num_players;
-} game_t;
-static game_t game;
+static hosted_t* games[GameBuckets];    // hosted games, hashed by game ID
+static client_t* clients[ClientBuckets]; // joined clients, hashed by address
+static forward_t* forwards[ClientBuckets]; // clients whose game is on another worker
+static int forwarded_by = -1;           // worker that forwarded the message being handled, or -1
+static int num_workers = 1;             // worker processes sharing the port
+static int worker_index = 0;            // which of those workers this process is
+static int server_port = 0;             // port to listen on; 0 to have one assigned
+static bool use_netio = false;          // hand network I/O to a dedicated thread
+static volatile sig_atomic_t stopping = 0;  // SIGINT or SIGTERM asked the server to stop
+static message_ctx_t* server_ctx = NULL; // context this process serves on
+static netio_t* server_io = NULL;       // its I/O thread, when use_netio
+static int render_threads = 0;          // extra threads rendering displays
+static pool_t* render_pool = NULL;      // those threads, shared by every game
+static int num_games = 0;               // number of games currently hosted
+static char* map_path;                  // map file every game is built from
+static int base_seed;                   // game N is seeded with base_seed + N
+static const char* record_path = NULL;  // file to record handled messages to, with -R
+static FILE* record_fp = NULL;          // that file, while serving
+static const char* frames_path = NULL;  // prefix of the spectator recordings, with -S
+static long record_last;               // serve_time of the last recorded entry
+static sender_t* senders[ClientBuckets]; // addresses recorded so far, hashed by address
+static uint32_t num_senders = 0;        // number of those addresses
+static addr_t admin_addr;               // host allowed to ask for STATS besides localhost, with -a
+static bool has_admin = false;          // whether -a was given
+static stats_t stats;                   // counters for STATS
+static int num_travelers = 0;           // players traveling, in every game
+static long serve_time = 0;             // microseconds when the message or timeout being handled came
+static long next_travel = 0;            // serve_time of the next travel steps
+static const char* trace_path = NULL;   // file to write the probes' Chrome trace to, with -T
+#ifdef PROBES
+static probe_hist_t probes[NumProbes] = { { "parse" }, { "simulate" }, { "render" }, { "send" }, { "travel" } };
+static uint64_t probe_spent = 0;        // time in the timed phases during the message or travel tick being handled
+static probe_trace_t* probe_trace = NULL; // the trace, while serving with -T
+static int probe_pid = 0;               // this process, to show the trace's events under
+#endif
 
 
+#ifndef REPLAY
 /* ***************** main ********************** */
 int
-main(const int argc, const char *argv[])
+main(int argc, const char *argv[])
 {
-	//validate params and return non-zero if invalid params
+	//skip past the options, then validate params and return non-zero if invalid params
 	int status;
+	int skip = parse_options(argc, argv);
+	if (skip < 0) {
+		return 2;
+	}
+	argc -= skip;
+	argv += skip;
     if ((status=validate_params(argc, argv)) != 0) {
 		return status;
 	}
 
 	//use random int as seed if not specified
-	if (argc == 2) {
-		game.grid = grid_new((char*)argv[1], time(NULL), GoldMinNumPiles, GoldMaxNumPiles, GoldTotal, MaxPlayers);
-	}
-	else {
-		game.grid = grid_new((char*)argv[1], atoi(argv[2]), GoldMinNumPiles, GoldMaxNumPiles, GoldTotal, MaxPlayers);
-	}
+	map_path = (char*)argv[1];
+	base_seed = (argc == 2) ? time(NULL) : atoi(argv[2]);
 
-	if (game.grid == NULL) {
+	// the default game is started up front so a bad map is reported at startup
+	hosted_t* game = start_game(0);
+	if (game == NULL) {
 		return 4;
 	}
 
-	//Probably should be (num_cols+1)*num_rows + 10 to include the newline but this is what the spec said to do.
-	if ((game.grid->num_cols*game.grid->num_rows + 10) >= MaxBytes) {
-		printf("Map is too large. Exceeds max bytes for display message!\n");
-		free_grid();
-		return 5;
+	// shard the games over worker processes, if asked to
+	if (num_workers > 1) {
+		free_games(); // each worker starts its own games on demand
+		return run_workers();
 	}
 
 	//initialize and loop through message
-	message_init(stderr);
-	message_loop(NULL, 0, NULL, NULL, handle_message); //no timeout and no stdin only message and no argument used
-	message_done();
+	message_ctx_t* ctx = message_ctx_new(stderr, server_port, false);
+	if (ctx == NULL) {
+		free_games();
+		return 6;
+	}
+	serve(ctx);
+	message_ctx_delete(ctx);
 
-	//frees grid and all of the memory used by it
-	free_grid();
+	//frees every game and all of the memory used by them
+	free_games();
+}
+#endif // REPLAY
+
+// serves clients on a context until the message loop ends
+// with use_netio, a dedicated thread receives and sends while this one handles messages
+// ctx- context to serve on
+// returns true if the loop ended normally, false on error
+bool serve(message_ctx_t* ctx) {
+	server_ctx = ctx;
+	bool ok = false;
+	clock_gettime(CLOCK_MONOTONIC, &stats.started);
+
+	// threads and the recording are started here, after any fork, so each worker has its own
+	if (record_path != NULL && !record_open(record_path)) {
+		return false;
+	}
+#ifdef PROBES
+	// as with the recording, each worker writes trace.index
+	if (trace_path != NULL) {
+		char name[strlen(trace_path) + 12];
+		sprintf(name, (num_workers > 1) ? "%s.%d" : "%s", trace_path, worker_index);
+		if ((probe_trace = probe_trace_new(name)) == NULL) {
+			printf("Unable to create trace %s!\n", name);
+			record_close();
+			return false;
+		}
+		probe_pid = getpid();
+	}
+#endif
+	if (render_threads > 0 && (render_pool = pool_new(render_threads)) == NULL) {
+		printf("Unable to start the render threads!\n");
+		record_close();
+		return false;
+	}
+	for (int b = 0; b < GameBuckets; b++) {
+		for (hosted_t* game = games[b]; game != NULL; game = game->next) {
+			game_set_pool(game->engine, render_pool);
+		}
+	}
+
+	// SIGINT and SIGTERM end the loop, so the process exits normally: recordings and
+	// traces are closed and profiling data is written. Without SA_RESTART they interrupt
+	// select or poll, and a signal arriving while a message is handled is seen within
+	// ServeTick. With -i, the I/O thread blocks them, so they reach this thread
+	struct sigaction action = { .sa_handler = stop_serving };
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	if (!use_netio) {
+		ok = message_ctx_loop(ctx, NULL, ServeTick, handle_timeout, NULL, handle_message) || stopping; //no stdin only message and no argument used
+	}
+	else if ((server_io = netio_new(ctx, RingCapacity)) == NULL) {
+		printf("Unable to start the network I/O thread!\n");
+	}
+	else {
+		ok = netio_loop(server_io, NULL, ServeTick, handle_timeout, handle_message);
+		netio_delete(server_io);
+		server_io = NULL;
+	}
+
+	// games outlive the pool and the context only until free_games, which never
+	// renders, and whose messages (to forwarding workers) are only counted
+	server_ctx = NULL;
+	pool_delete(render_pool);
+	render_pool = NULL;
+	record_close();
+#ifdef PROBES
+	probe_trace_delete(probe_trace);
+	probe_trace = NULL;
+#endif
+	PROBE_PRINT();
+	return ok;
+}
+
+// sends a message through this process's context, or queues it for the I/O thread
+// with no context (replay), the message is only counted
+// to- address to send to
+// message- message contents
+void send_message(const addr_t to, const char *message) {
+	stats.out[stat_type(message)]++;
+	stats.bytes_out += strlen(message);
+	if (server_io != NULL) {
+		netio_send(server_io, to, message);
+	}
+	else if (server_ctx == NULL) {
+		return;
+	}
+	else {
+		message_ctx_send(server_ctx, to, message);
+	}
+}
+
+// starts the worker processes, each bound to the shared port, and waits for them
+// socket k is bound before worker k is forked, so k is its index in the port's group
+// returns 0, or 6 if a socket could not be set up
+int run_workers() {
+	for (int i = 0; i < num_workers; i++) {
+		message_ctx_t* ctx = message_ctx_new(stderr, server_port, true);
+		if (ctx == NULL) {
+			printf("Unable to bind worker %d to a shared port!\n", i);
+			return 6;
+		}
+		server_port = message_ctx_port(ctx); // the rest of the workers share the port of the first
+
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 6;
+		}
+		if (pid == 0) {
+			// worker: loop on the socket bound just above, and die with the server
+#ifdef __linux__
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+			worker_index = i;
+			serve(ctx);
+			message_ctx_delete(ctx);
+			free_games();
+			free_forwards();
+			exit(0);
+		}
+		message_ctx_delete(ctx); // the worker holds the socket now
+	}
+	printf("Serving on port %d with %d workers\n", server_port, num_workers);
+	fflush(stdout);
+
+	// the workers run until killed
+	while (wait(NULL) > 0) {
+	}
+	return 0;
 }
 
 // function run within message_loop to handle incoming messages
+// messages for games hosted by another worker are forwarded there
 // returns true if break, false if continue
 // arg- argument passed (not used)
 // from- address message is received from
 // message- message contents
 bool handle_message(void *arg, const addr_t from, const char *message) {
+	// travel steps that came due before the message come first, as they would have without it;
+	// the message is recorded with the same time, so a replay takes the same steps before it
+	mark_time();
+	travel_ticks();
+	PROBE_BEGIN(start);
+	int owner = worker_index;
+	// a client's message forwarded by another worker
+	if (message[0] == message_SteerByte) {
+		addr_t client;
+		char op;
+		int sender;
+		const char* inner = unwrap_forward(from, message, &client, &op, &sender);
+		if (inner != NULL) {
+			handle_forward(client, op, sender, inner);
+		}
+	}
+	else if (num_workers > 1 && (owner = owner_of(from, message)) != worker_index) {
+		forward_message(owner, from, message);
+	}
+	else {
+		dispatch_message(from, message);
+	}
+	PROBE_MESSAGE(start, message);
+	return stopping;
+}
+
+// function run within message_loop when no message came for ServeTick seconds
+// takes any travel steps due
+// returns true, to end the loop, once the server was asked to stop
+bool handle_timeout(void *arg) {
+	mark_time();
+	if (travel_ticks() && record_fp != NULL) {
+		record_entry(0, ""); // a replay takes these steps by this time, not at the next message
+	}
+	return stopping;
+}
+
+// signal handler for SIGINT and SIGTERM: asks the message loop to end
+void stop_serving(int sig) {
+	stopping = 1;
+}
+
+// handles a client message for a game hosted by this process
+// from- address of the client
+// message- message contents
+void dispatch_message(const addr_t from, const char *message) {
+	hosted_t* game = NULL;
+	int id = 0;
+	if (record_fp != NULL) {
+		record_message(from, message);
+	}
+	stats.in[stat_type(message)]++;
 	// if message equals play
 	if (strncmp(message, "PLAY ", strlen("PLAY ")) == 0) {
-		add_player(from, &(message[strlen("PLAY ")]));
+		const char* name = parse_game_id(&(message[strlen("PLAY ")]), &id);
+		if (name == NULL || (game = start_game(id)) == NULL) {
+			send_message(from, "NO Invalid game");
+			return;
+		}
+		add_player(game, from, name);
 	}
 	// if message equals key
 	else if (strncmp(message, "KEY ", strlen("KEY ")) == 0) {
-		process_keystroke(from, message[strlen("KEY ")]);
+		// keys are routed to the game the sender joined; ignore strangers
+		if ((game = game_from_addr(from)) == NULL) {
+			return;
+		}
+		process_keystroke(game, from, message[strlen("KEY ")]);
 	}
 	// if message equals spectate
+	// only the default game is started by a spectator; others must have players
 	else if (strncmp(message, "SPECTATE", strlen("SPECTATE")) == 0) {
-		add_spectator(from);
+		if (parse_game_id(&(message[strlen("SPECTATE")]), &id) == NULL
+				|| (game = (id == 0) ? start_game(id) : find_game(id)) == NULL) {
+			send_message(from, "NO Invalid game");
+			return;
+		}
+		add_spectator(game, from);
+	}
+	// if message equals travel; from players only, like keys
+	else if (strcmp(message, "TRAVEL") == 0) {
+		if ((game = game_from_addr(from)) == NULL || !start_travel(game, from)) {
+			return;
+		}
+	}
+	// the server's counters, for localhost and the admin host only;
+	// STATS #k has been routed to worker k (owner_of)
+	else if (stat_type(message) == StatStats) {
+		const char* rest = parse_game_id(&(message[strlen("STATS")]), &id);
+		if (rest == NULL || *rest != '\0' || id >= num_workers) {
+			send_message(from, "NO Invalid worker");
+		}
+		else if (is_admin(from)) {
+			send_stats(from);
+		}
+		else {
+			send_message(from, "NO Not allowed");
+		}
+		return;
 	}
 	else {
-		return false;
+		return;
 	}
 	// no need to handle other message types- player only sends those three
 
+	// a game everyone has left (or that turned its only client away) is freed,
+	// so its ID can start afresh and the table does not fill with idle games
+	if (game_idle(game)) {
+		end_game(game);
+		return;
+	}
+
 	// update the board for players and spectator
-	send_board();
+	send_board(game);
 
-	// if no more gold after processing message
-	if (game.grid->gold_remaining == 0) {
-		game_over(); // sends gameover message
-		return true; // breaks the loop
+	// if no more gold after processing message, end this game but keep hosting the others
+	if (game_gold_remaining(game->engine) == 0) {
+		game_over(game); // sends gameover message
+		end_game(game);
 	}
-
-	
-	return false;
 }
 
-// adds a player to the player array held in game
+// adds a player to the game
+// game - game the player joins
 // from - address of player to be added
 // name - name of player to be added
-void add_player(addr_t from, const char* name) {
+void add_player(hosted_t* game, addr_t from, const char* name) {
 	//check if player limit reached or if the client is trying to reconnect
-	if (game.num_players == MaxPlayers || get_player_from_addr(from) != NULL) {
-		message_send(from, "NO"); // reject join request
+	if (game_num_players(game->engine) == MaxPlayers || get_slot_from_addr(game, from) >= 0 || game_from_addr(from) != NULL) {
+		send_message(from, "NO"); // reject join request
 		return;
 	}
 
-	//malloc a new player and its name
-	player_t* player = malloc(sizeof(player_t));
-	assertp(player, "Error allocating memory to player");
-	char* player_name = malloc(strlen(name)+1);
-	assertp(player_name, "Error allocating memory to player name");
-	//copy the playername into the name
-	strcpy(player_name, name);
-	//set the name, tag, and gold obtained
-	player->player_name = player_name;
-	player->player_tag = PlayerTags[game.num_players];
-	player->gold_obtained = 0;
-	// malloc known array
-	player->known = (int **)calloc(game.grid->num_rows, sizeof(int *)); 
-	assertp(player->known, "Error mallocing memory to known player array");
-    for (int i=0; i<game.grid->num_rows; i++) {
-         player->known[i] = (int *)calloc(game.grid->num_cols, sizeof(int));
-		 assertp(player->known[i], "Error allocating memory to player known array");
-	}
-
-	// malloc display for player
-	player->display = malloc(((game.grid->num_rows * (game.grid->num_cols + 1))+1)*sizeof(char));
-	assertp(player->display , "Error allocating memory to player display");
-	//addr is const so we need to cast away the const to modify
-	*(addr_t *)&player->addr = from;
-	// player hasn't quit
-	player->player_quit = false;
+	// the engine places the player on a random empty room spot
+	int slot = game_join(game->engine, name);
+	game->addrs[slot] = from;
 	// send message to player
 	char ok_msg[5];
-	sprintf(ok_msg, "OK %c", player->player_tag);
-	game.grid->players[game.num_players] = player;
-	// place the player on a random empty room spot
-	grid_add_player(game.grid, player);
-	message_send(from, ok_msg);
-	//allocate 4 spaces for GRID, enough for row/col, and 3 for spaces + null
-	char grid_msg[4 + (int_len(game.grid->num_rows)*sizeof(char)) + (int_len(game.grid->num_cols)*sizeof(char)) + 3];
-	sprintf(grid_msg, "GRID %d %d", game.grid->num_rows, game.grid->num_cols);
-	message_send(from, grid_msg);
+	sprintf(ok_msg, "OK %c", game_tag(game->engine, slot));
+	send_message(from, ok_msg);
+	//GRID, then row/col of up to 11 chars each
+	char grid_msg[32];
+	sprintf(grid_msg, "GRID %d %d", game_view_rows(game->engine), game_view_cols(game->engine));
+	send_message(from, grid_msg);
 
 	// send gold information to the new player
-	char gold_msg[4 + 1 + (int_len(player->gold_obtained)*sizeof(char)) + (int_len(game.grid->gold_remaining)*sizeof(char)) + 4];
-	sprintf(gold_msg, "GOLD 0 %d %d", player->gold_obtained, game.grid->gold_remaining);
-	message_send(from, gold_msg);
-	// increment number of players
-	game.num_players = game.num_players + 1;
+	send_gold(game, slot, 0);
+	// later keystrokes from this address are routed to this game
+	route_client(from, game);
 }
 
 // function for handling keystrokes from the player
+// game - game the sender joined
 // from - address of the player sending the message
 // key - keystroke sent
-void process_keystroke(addr_t from, char key) {
+void process_keystroke(hosted_t* game, addr_t from, char key) {
 
 	// if there is currently a spectator and the message is from the spectator
-	if (game.grid->spectator != NULL && message_eqAddr(from, game.grid->spectator->addr)) {
-		// Quit the spectator, free its memory and set the spectator equal to null
+	if (game->watched && message_eqAddr(from, game->spectator)) {
+		// Quit the spectator
 		if (key == 'Q') {
-			message_send(game.grid->spectator->addr, "QUIT");
-			free_player(game.grid->spectator);
-			game.grid->spectator = NULL;
-			return; // so we don't continue and trigger a segfault
-		}
-		else {
-			return; //spectator can only send Q
+			remove_spectator(game);
 		}
+		return; //spectator can only send Q
 	}
 
 	// get the player using its unique address
-	player_t* player = get_player_from_addr(from);
+	int slot = get_slot_from_addr(game, from);
 
 	// error handling, this should never happen but we validate here for ease of debugging
-	if (player == NULL) {
+	if (slot < 0) {
 		printf("ERROR PLAYER IS NULL IN PROCESS KEYSTROKE");
 		fflush(stdout);
+		return;
 	}
 
-	// initial gold collected is zero
-	int gold_collected = 0;
+	// a key takes the player back from traveling
+	set_traveling(game, slot, false);
 
-	// map each key to the movement. Each int in the move functions represents row, col
-	// a positive row represents a move down, a negative row represents a move up.
-	// a positive col represents a move left, a negative col represents a move right.
-	// move returns the gold collected which is stored.
-	switch (key) {
-		case 'h': gold_collected = grid_move(game.grid, player, 0, -1);
-			break;
-		case 'j': gold_collected = grid_move(game.grid, player, 1, 0);
-			break;
-		case 'k': gold_collected = grid_move(game.grid, player, -1, 0);
-			break;
-		case 'l': gold_collected = grid_move(game.grid, player, 0, 1);
-			break;
-		case 'y': gold_collected = grid_move(game.grid, player, -1, -1);
-			break;
-		case 'u': gold_collected = grid_move(game.grid, player, -1, 1);
-			break;
-		case 'b': gold_collected = grid_move(game.grid, player, 1, -1);
-			break;
-		case 'n': gold_collected = grid_move(game.grid, player, 1, 1);
-			break;
-		case 'H': gold_collected = grid_move_to_end(game.grid, player, 0, -1);
-			break;
-		case 'J': gold_collected = grid_move_to_end(game.grid, player, 1, 0);
-			break;
-		case 'K': gold_collected = grid_move_to_end(game.grid, player, -1, 0);
-			break;
-		case 'L': gold_collected = grid_move_to_end(game.grid, player, 0, 1);
-			break;
-		case 'Y': gold_collected = grid_move_to_end(game.grid, player, -1, -1);
-			break;
-		case 'U': gold_collected = grid_move_to_end(game.grid, player, -1, 1);
-			break;
-		case 'B': gold_collected = grid_move_to_end(game.grid, player, 1, -1);
-			break;
-		case 'N': gold_collected = grid_move_to_end(game.grid, player, 1, 1);
-			break;
-		case 'Q': player_remove(player);
-			break;
-		default:
-			message_send(from, "NO Invalid Key"); // any other key is invalid
-			break;
+	// the engine moves the player, returning the gold collected
+	PROBE_BEGIN(moved);
+	int gold_collected = game_key(game->engine, slot, key);
+	PROBE_END(ProbeSimulate, moved);
+	if (gold_collected < 0) {
+		send_message(from, "NO Invalid Key"); // any other key is invalid
+		return;
+	}
+	// the player left; its slot stays, so it keeps its tag and purse
+	if (key == 'Q') {
+		send_message(from, "QUIT");
+		unroute_client(from);
+		return;
 	}
 
 	// if we collected gold during the move
 	if (gold_collected != 0) {
-		//send a gold message to the player who collected the gold
-		char gold_msg[4 + (int_len(gold_collected)*sizeof(char)) + (int_len(player->gold_obtained)*sizeof(char)) + (int_len(game.grid->gold_remaining)*sizeof(char)) + 4];
-		sprintf(gold_msg, "GOLD %d %d %d", gold_collected, player->gold_obtained, game.grid->gold_remaining);
-		message_send(from, gold_msg);
-
-		//send a message to the spectator with the updated gold count
-		if (game.grid->spectator != NULL) {
-			//4 spaces for GOLD, 2 spaces for 0s, enough space for gold_remaining, 4 spaces for spaces and null
-			char gold_spec[4 + (int_len(game.grid->gold_remaining)*sizeof(char)) + 6];
-			sprintf(gold_spec, "GOLD 0 0 %d", game.grid->gold_remaining);
-			message_send(game.grid->spectator->addr, gold_spec);
-		}
-
-		//send a message to the rest of the players with an updated gold count
-		for (int i = 0; i < game.num_players; i++) {
-			if (message_eqAddr(from, game.grid->players[i]->addr)) {
-				continue;
-			}
-			player = game.grid->players[i];
-			if (player->player_quit) {
-				continue;
+		announce_gold(game, slot, gold_collected);
+	}
+}
+
+// tells everyone in a game that a player collected gold
+// game - game of the player
+// slot - slot of the player
+// collected - gold the player just collected
+void announce_gold(hosted_t* game, int slot, int collected) {
+	//send a gold message to the player who collected the gold
+	send_gold(game, slot, collected);
+
+	//send a message to the spectator with the updated gold count
+	if (game->watched) {
+		send_gold(game, GameSpectator, 0);
+	}
+
+	//send a message to the rest of the players with an updated gold count
+	for (int i = 0; i < game_num_players(game->engine); i++) {
+		if (i != slot && game_active(game->engine, i)) {
+			send_gold(game, i, 0);
+		}
+	}
+}
+
+// starts a player traveling to the nearest gold, taking its first step now
+// later steps are taken by travel_ticks, until the player gets there or sends a key
+// game - game the sender joined
+// from - address of the player
+// returns true if the player stepped, so the board is to be sent;
+// false if the sender is not a player, or no gold can be reached (it is told NO)
+bool start_travel(hosted_t* game, addr_t from) {
+	int slot = get_slot_from_addr(game, from);
+	if (slot < 0) {
+		return false; // the spectator cannot travel
+	}
+	set_traveling(game, slot, true);
+	if (!travel_step(game, slot)) {
+		send_message(from, "NO No gold within reach");
+		return false;
+	}
+	return true;
+}
+
+// moves a traveling player one step toward the nearest gold, through the engine's
+// shared distances; its travel ends once it collects gold or none can be reached
+// game - game of the player
+// slot - slot of the player
+// returns false if no gold can be reached
+bool travel_step(hosted_t* game, int slot) {
+	PROBE_BEGIN(moved);
+	int gold_collected = game_travel(game->engine, slot);
+	PROBE_END(ProbeSimulate, moved);
+	stats.travel_steps++;
+	if (gold_collected != 0) {
+		set_traveling(game, slot, false);
+	}
+	if (gold_collected > 0) {
+		announce_gold(game, slot, gold_collected);
+	}
+	return gold_collected >= 0;
+}
+
+// marks a player traveling or not, keeping count of the travelers
+// the first traveler of all starts the clock of the travel steps
+// game - game of the player
+// slot - slot of the player
+// traveling - whether the player is to travel
+void set_traveling(hosted_t* game, int slot, bool traveling) {
+	if (game->traveling[slot] == traveling) {
+		return;
+	}
+	game->traveling[slot] = traveling;
+	if (traveling && num_travelers == 0) {
+		next_travel = serve_time + TravelTick;
+	}
+	game->travelers += traveling ? 1 : -1;
+	num_travelers += traveling ? 1 : -1;
+}
+
+// takes the travel steps due: every TravelTick, each traveling player steps toward
+// the nearest gold, and each game with travelers sends one board for all of their steps
+// returns true if any steps were due
+bool travel_ticks() {
+	bool ticked = false;
+	while (num_travelers > 0 && serve_time >= next_travel) {
+		ticked = true;
+		PROBE_BEGIN(tick);
+		next_travel += TravelTick;
+		for (int b = 0; b < GameBuckets; b++) {
+			hosted_t* game = games[b];
+			while (game != NULL) {
+				hosted_t* next = game->next; // the game may end
+				if (game->travelers > 0) {
+					for (int i = 0; i < game_num_players(game->engine); i++) {
+						if (game->traveling[i]) {
+							travel_step(game, i);
+						}
+					}
+					send_board(game);
+					if (game_gold_remaining(game->engine) == 0) {
+						game_over(game);
+						end_game(game);
+					}
+				}
+				game = next;
 			}
-			char others_gold_msg[4 + 1 + (int_len(player->gold_obtained)*sizeof(char)) + (int_len(game.grid->gold_remaining)*sizeof(char)) + 4];
-			sprintf(others_gold_msg, "GOLD %d %d %d", 0, player->gold_obtained, game.grid->gold_remaining);
-			message_send(player->addr, others_gold_msg);
 		}
+		PROBE_TICK(tick);
+	}
+	return ticked;
+}
+
+// sets serve_time, which travel steps are scheduled by and recordings are stamped with,
+// to the monotonic clock in whole microseconds; in replay, main sets it to the recorded time
+static void mark_time() {
+#ifndef REPLAY
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	serve_time = now.tv_sec * 1000000L + now.tv_nsec / 1000;
+#endif
+}
+
+// sends a GOLD message to a player, or to the spectator
+// game - game of the player
+// slot - slot of the player, or GameSpectator
+// collected - gold the player just collected
+void send_gold(hosted_t* game, int slot, int collected) {
+	//GOLD, then three numbers of up to 11 chars each
+	char gold_msg[48];
+	if (slot == GameSpectator) {
+		sprintf(gold_msg, "GOLD 0 0 %d", game_gold_remaining(game->engine));
+		send_message(game->spectator, gold_msg);
+	}
+	else {
+		sprintf(gold_msg, "GOLD %d %d %d", collected, game_purse(game->engine, slot), game_gold_remaining(game->engine));
+		send_message(game->addrs[slot], gold_msg);
 	}
 }
 
 
 //function for adding a spectator
-//if there is an existing spectator it is booted from the game and freed
+//if there is an existing spectator it is booted from the game
+//game - game to spectate
 //from - address the spectator message is from
-void add_spectator(addr_t from) {
-	// if there is currently a spectator boot and free them
-	if (game.grid->spectator != NULL) {
-		message_send(game.grid->spectator->addr, "QUIT");
-		free_player(game.grid->spectator);
-		game.grid->spectator = NULL;
-	}
-
-	// malloc a new spectator and set its variables
-	player_t* spectator = malloc(sizeof(player_t));
-	assertp(spectator, "Error allocating memory to spectator");
-	*(addr_t *)&spectator->addr = from;
-	// malloc display and name
-	// spectator doesn't technically need a name but this makes freeing more simple
-	// as we can recycle the same function for freeing a player
-	spectator->display = malloc(((game.grid->num_rows * (game.grid->num_cols + 1))+1)*sizeof(char));
-	spectator->player_name = malloc((strlen("spectator") + 1)*sizeof(char));
-	assertp(spectator->display, "Error allocating memory to spectator display");
-	assertp(spectator->player_name, "Error allocating memory to spectator name");
-	spectator->row = 0;
-	spectator->col = 0;
-	spectator->known = NULL;
-	spectator->gold_obtained = 0;
-	strcpy(spectator->player_name, "spectator");
-	game.grid->spectator = spectator;
+void add_spectator(hosted_t* game, addr_t from) {
+	// an address takes part in one game at a time, unless it is this game's spectator rejoining
+	hosted_t* joined = game_from_addr(from);
+	if (joined != NULL && (joined != game || !game->watched
+			|| !message_eqAddr(from, game->spectator))) {
+		send_message(from, "NO");
+		return;
+	}
+
+	// if there is currently a spectator boot them
+	if (game->watched) {
+		remove_spectator(game);
+	}
+
+	game_spectate(game->engine);
+	game->spectator = from;
+	game->watched = true;
+	route_client(from, game);
 
 	//send grid and gold messages to spectator
+	char grid_msg[32];
+	sprintf(grid_msg, "GRID %d %d", game_view_rows(game->engine), game_view_cols(game->engine));
+	send_message(from, grid_msg);
+	send_gold(game, GameSpectator, 0);
+}
 
-	//allocate 4 spaces for GRID, enough for row/col, and 3 for spaces + null
-	char grid_msg[4 + (int_len(game.grid->num_rows)*sizeof(char)) + (int_len(game.grid->num_cols)*sizeof(char)) + 3];
-	sprintf(grid_msg, "GRID %d %d", game.grid->num_rows, game.grid->num_cols);
-	message_send(from, grid_msg);
-	//4 spaces for GOLD, 2 spaces for 0s, enough space for gold_remaining, 4 spaces for spaces and null
-	char gold_msg[4 + (int_len(game.grid->gold_remaining)*sizeof(char)) + 6];
-	sprintf(gold_msg, "GOLD 0 0 %d", game.grid->gold_remaining);
-	message_send(from, gold_msg);
+//tells the spectator to quit and takes it out of the game
+//game - game with a spectator
+void remove_spectator(hosted_t* game) {
+	send_message(game->spectator, "QUIT");
+	unroute_client(game->spectator);
+	game_unspectate(game->engine);
+	game->watched = false;
 }
 
 // function for sending gameover summary to players and spectator at end of game
-void game_over() {
+void game_over(hosted_t* game) {
+	int num_players = game_num_players(game->engine);
 	int strsize = 10; //initial GAMEOVER\n + null char
 	//one line per player, with player Letter, purse (gold nugget count), and player real name, in tabular form.
-	int print_size[game.num_players + 1]; //keeps track of number of chars to print in each line
+	int print_size[num_players + 1]; //keeps track of number of chars to print in each line
 	print_size[0] = 9; //the size of GAMEOVER\n
 	// for each player determine space needed for its summary
-	for (int i = 0; i < game.num_players; i++) {
-		player_t* player = game.grid->players[i];
+	for (int i = 0; i < num_players; i++) {
+		const char* name = game_name(game->engine, i);
 		//add size of playername, gold obtained, and player tag + 3 for spaces and newline
-		int gold_str_len = (int_len(player->gold_obtained)*sizeof(char));
+		int gold_str_len = snprintf(NULL, 0, "%d", game_purse(game->engine, i));
 		print_size[i+1] = 1;
-		print_size[i+1] += ((strlen(player->player_name) > name_width) ? strlen(player->player_name) : name_width);
+		print_size[i+1] += ((strlen(name) > name_width) ? strlen(name) : name_width);
 		print_size[i+1] += ((gold_str_len > gold_width) ? gold_str_len : gold_width);
 		print_size[i+1] += 3;
 		//add the size of the player summary to total size of string
@@ -353,71 +846,162 @@ void game_over() {
 	int idx = print_size[0]; //start of str after gameover
 
 	// for each player summary print the summary to the string
-	for (int i = 0; i < game.num_players; i++) {
-		player_t* player = game.grid->players[i];
+	for (int i = 0; i < num_players; i++) {
 		// prints to the next position after the previous print
-		sprintf(&summary[idx], "%-10s %c %-5d\n", player->player_name, player-> player_tag, player->gold_obtained);
+		sprintf(&summary[idx], "%-10s %c %-5d\n", game_name(game->engine, i), game_tag(game->engine, i), game_purse(game->engine, i));
 		// increment the start pointer after the message just printed
 		idx += print_size[i+1];
 	}
 
 	// send the summary and quit command to each of the players still connected
-	for (int i = 0; i < game.num_players; i++) {
-		player_t* player = game.grid->players[i];
-		if (!(player->player_quit)) {
-			message_send(player->addr, summary);
-			message_send(player->addr, "QUIT");
+	for (int i = 0; i < num_players; i++) {
+		if (game_active(game->engine, i)) {
+			send_message(game->addrs[i], summary);
+			send_message(game->addrs[i], "QUIT");
 		}
 	}
 
-	// print the summary to the server screen
+	// print the summary to the server screen, with the phase timings so far
 	printf("%s", summary);
+	PROBE_PRINT();
 
 	// send the summary and quit to spectator if any
-	if (game.grid->spectator != NULL) {
-		message_send(game.grid->spectator->addr, summary);
-		message_send(game.grid->spectator->addr, "QUIT");
+	if (game->watched) {
+		send_message(game->spectator, summary);
+		send_message(game->spectator, "QUIT");
 	}
 
 }
 
-// sends the display to each of the players and spectator
-void send_board() {
-	// update each player/spectator display to the most current state
-	grid_display_board(game.grid);
+// sends the display to each of the players and spectator of a game
+void send_board(hosted_t* game) {
+	// update each player/spectator display to the most current state, timed for STATS
+	struct timespec begin, end;
+	PROBE_BEGIN(rendered);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	game_render_all(game->engine);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	PROBE_END(ProbeRender, rendered);
+	double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+	stats.renders++;
+	stats.render_total += seconds;
+	if (seconds > stats.render_max) {
+		stats.render_max = seconds;
+	}
+	//allocate for display + DISPLAY\n + null term
+	char disp[game_display_size(game->engine) + 8];
 
 	// for each player still connected send the board they would see
-	for (int i = 0; i < game.num_players; i++) {
-		player_t* player = game.grid->players[i];
-
-		if (!(player->player_quit)) {
-			//allocate for display + DISPLAY\n + null term
-			char disp[strlen(player->display) + 9];
-			sprintf(disp, "DISPLAY\n%s", player->display);
-			message_send(player->addr, disp);
+	PROBE_BEGIN(sent);
+	// the engine does not render the displays of players who quit
+	for (int i = 0; i < game_num_players(game->engine); i++) {
+		if (game_active(game->engine, i)) {
+			sprintf(disp, "DISPLAY\n%s", game_display(game->engine, i));
+			send_message(game->addrs[i], disp);
+			stats.views++;
+		}
+		else {
+			stats.views_skipped++;
 		}
 	}
 
 	// if there's a spectator send them the display
-	if (game.grid->spectator != NULL) {
-		char disp[strlen(game.grid->spectator->display) + 9];
-		sprintf(disp, "DISPLAY\n%s", game.grid->spectator->display);
-		message_send(game.grid->spectator->addr, disp);
+	if (game->watched) {
+		sprintf(disp, "DISPLAY\n%s", game_display(game->engine, GameSpectator));
+		send_message(game->spectator, disp);
+		stats.views++;
 	}
-}
+	PROBE_END(ProbeSend, sent);
 
-// method for removing a player from the game
-// removed players are not removed from the player array
-void player_remove(player_t* player) {
-	// remove the player from the game board
-	grid_remove_player(game.grid, player);
-	// set the quit flag to true
-	player->player_quit = true;
-	// tell the player to quit
-	message_send(player->addr, "QUIT");
+	// record what a spectator sees, whether or not one is watching;
+	// only the cells the grid's journal says changed are redrawn
+	if (game->frames != NULL) {
+		game_render_changes(game->engine, &game->frame_seq, game->frame);
+		framerec_add(game->frames, game->frame, game_gold_remaining(game->engine));
+	}
 }
 
 
+/**************** parse_options ****************
+ * Function parses the options ahead of the map file
+ * Input:   const int argc- number of arguments
+ * 			const char *argv[]- arguments
+ * recognizes -w workers (number of worker processes), -p port,
+ * -r threads (render threads besides the main one),
+ * -i (dedicated network I/O thread), -R recording (file to record to),
+ * -S frames (prefix of the files to record each game's spectator view to),
+ * -a admin (host, besides localhost, allowed to ask for STATS)
+ * and -T trace (file to write the probes' Chrome trace to, with PROBES)
+ * returns the number of arguments consumed, or -1 if an option is invalid
+*/
+int parse_options(const int argc, const char *argv[]) {
+	int i = 1;
+	while (i < argc && argv[i][0] == '-') {
+		// flags
+		if (strcmp(argv[i], "-i") == 0) {
+			use_netio = true;
+			i++;
+			continue;
+		}
+
+		// options with a file value
+		if (strcmp(argv[i], "-R") == 0 || strcmp(argv[i], "-S") == 0 || strcmp(argv[i], "-T") == 0) {
+			if (i + 1 == argc) {
+				printf("Option %s needs a file\n%s", argv[i], Usage);
+				return -1;
+			}
+			if (argv[i][1] == 'R') {
+				record_path = argv[i+1];
+			}
+			else if (argv[i][1] == 'S') {
+				frames_path = argv[i+1];
+			}
+			else {
+#ifndef PROBES
+				printf("Option -T needs a server built with probes (make PROBES=1)\n");
+				return -1;
+#endif
+				trace_path = argv[i+1];
+			}
+			i += 2;
+			continue;
+		}
+
+		// the admin host; any port will do, as only the host is compared
+		if (strcmp(argv[i], "-a") == 0) {
+			if (i + 1 == argc || !message_setAddr(argv[i+1], "1024", &admin_addr)) {
+				printf("Option -a needs a host name or address\n%s", Usage);
+				return -1;
+			}
+			has_admin = true;
+			i += 2;
+			continue;
+		}
+
+		// options with an integer value
+		int value;
+		if (i + 1 == argc || !str2int(argv[i+1], &value)) {
+			printf("Option %s needs an integer value\n%s", argv[i], Usage);
+			return -1;
+		}
+		if (strcmp(argv[i], "-w") == 0 && value >= 1 && value <= MaxWorkers) {
+			num_workers = value;
+		}
+		else if (strcmp(argv[i], "-p") == 0 && value >= 0 && value <= 65535) {
+			server_port = value;
+		}
+		else if (strcmp(argv[i], "-r") == 0 && value >= 0 && value <= MaxRenderThreads) {
+			render_threads = value;
+		}
+		else {
+			printf("Invalid option %s %s\n%s", argv[i], argv[i+1], Usage);
+			return -1;
+		}
+		i += 2;
+	}
+	return i - 1;
+}
+
 /**************** validate_params ****************
  * Function checks if paramaters are valid
  * Input:   const int argc- number of arguments
@@ -428,7 +1012,7 @@ void player_remove(player_t* player) {
 int validate_params(const int argc, const char *argv[]) {
 	// check if correct number of args
 	if (argc != 2 && argc != 3) {
-		printf("incorrect number of arguments! expected 1 or 2, but got %d\nusage: ./server mapfile [seed]\n", argc-1);
+		printf("incorrect number of arguments! expected 1 or 2, but got %d\n%s", argc-1, Usage);
 		return 2;
 	}
 
@@ -445,63 +1029,616 @@ int validate_params(const int argc, const char *argv[]) {
 		int i;
 		if (!str2int(argv[2], &i)|| i<0){
 				printf("Second argument is not a valid integer! Seed must be nonengative 32 bit integer\n");
-		 		printf("usage: ./server mapfile [seed]\n");
+		 		printf("%s", Usage);
 		 		return 3;
 		}
 	}
     return 0;
 }
 
-// gets a player from the address given
+// gets the slot of a player from the address given
+// game- game to search
 // from- address of player you're trying to retrieve
-player_t* get_player_from_addr(const addr_t from) {
-	player_t* player = NULL;
+// returns the slot, or -1 if no player of the game has that address
+int get_slot_from_addr(hosted_t* game, const addr_t from) {
 	// loop through all of the players checking for matches
-	for (int i = 0; i < MaxPlayers; i++) {
-		// reached the end of the players without match
-		if (game.grid->players[i] == NULL) {
-			return player;
+	for (int i = 0; i < game_num_players(game->engine); i++) {
+		if (message_eqAddr(game->addrs[i], from)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+// finds a hosted game by its ID
+// id- game ID to look up
+// returns the game, or NULL if no such game is running
+hosted_t* find_game(int id) {
+	for (hosted_t* game = games[id % GameBuckets]; game != NULL; game = game->next) {
+		if (game->id == id) {
+			return game;
+		}
+	}
+	return NULL;
+}
+
+// finds a hosted game by its ID, starting a new one on the map if none is running
+// id- game ID to look up or start
+// returns the game, or NULL if the game could not be started
+hosted_t* start_game(int id) {
+	hosted_t* game = find_game(id);
+	if (game != NULL) {
+		return game;
+	}
+	if (num_games == MaxGames) {
+		return NULL;
+	}
+
+	// each game gets its own engine, seeded from its ID so games are reproducible
+	game_config_t config = game_default_config;
+	config.max_players = MaxPlayers;
+	config.total_gold = GoldTotal;
+	config.min_piles = GoldMinNumPiles;
+	config.max_piles = GoldMaxNumPiles;
+	// a map too large for one DISPLAY message is shown through a viewport around each player
+	config.max_display = MaxBytes - strlen("DISPLAY\n") - 2;
+	config.viewport_rows = ViewportRows;
+	config.viewport_cols = ViewportCols;
+	game_t* engine = game_create(map_path, base_seed + id, &config);
+	if (engine == NULL) {
+		return NULL;
+	}
+	game = malloc(sizeof(hosted_t));
+	assertp(game, "Error allocating memory to game");
+	game->id = id;
+	game->engine = engine;
+	game_set_pool(engine, render_pool);
+	game->addrs = calloc(MaxPlayers, sizeof(addr_t));
+	assertp(game->addrs, "Error allocating memory to game addresses");
+	game->traveling = calloc(MaxPlayers, sizeof(bool));
+	assertp(game->traveling, "Error allocating memory to game travelers");
+	game->travelers = 0;
+	game->watched = false;
+	game->frames = NULL;
+	game->frame = NULL;
+	game->frame_seq = 0;
+	// game N's spectator view is recorded to frames.N
+	if (frames_path != NULL) {
+		char name[strlen(frames_path) + 12];
+		sprintf(name, "%s.%d", frames_path, id);
+		int size = game_display_size(engine);
+		game->frame = malloc(size);
+		assertp(game->frame, "Error allocating memory to frame");
+		if ((game->frames = framerec_new(name, size - 1)) == NULL) {
+			printf("Unable to create spectator recording %s!\n", name);
 		}
-		if (message_eqAddr(game.grid->players[i]->addr, from)) {
-			return game.grid->players[i];
+	}
+
+	// link the game into its bucket
+	game->next = games[id % GameBuckets];
+	games[id % GameBuckets] = game;
+	num_games++;
+	return game;
+}
+
+// removes a finished game from the game table and frees it
+// its clients are unrouted so they may join another game
+// game- game to end
+void end_game(hosted_t* game) {
+	// players who quit were unrouted then, and may since be in another game
+	for (int i = 0; i < game_num_players(game->engine); i++) {
+		if (game_active(game->engine, i)) {
+			unroute_client(game->addrs[i]);
 		}
 	}
-	return player;
+	if (game->watched) {
+		unroute_client(game->spectator);
+	}
+
+	// unlink the game from its bucket
+	hosted_t** link = &games[game->id % GameBuckets];
+	while (*link != game) {
+		link = &(*link)->next;
+	}
+	*link = game->next;
+	num_games--;
+	num_travelers -= game->travelers;
+
+	framerec_delete(game->frames);
+	free(game->frame);
+	free(game->addrs);
+	free(game->traveling);
+	game_destroy(game->engine);
+	free(game);
 }
 
-// frees the player memory (including spectator)
-// player- player whose memory to free
-void free_player(player_t* player) {
-	// free the name and display
-	free(player->player_name);
-	free(player->display);
-	// known is never null for players but is NULL for spectators
-	if (player->known != NULL) {
-		// free each individual row and the entire struct itself
-		for (int i=0; i<game.grid->num_rows; i++) {
-			free(player->known[i]);
+// checks whether a game has no players still in it and no spectator
+// game- game to check
+bool game_idle(hosted_t* game) {
+	if (game->watched) {
+		return false;
+	}
+	for (int i = 0; i < game_num_players(game->engine); i++) {
+		if (game_active(game->engine, i)) {
+			return false;
 		}
-		free(player->known);
 	}
-	//free the player struct
-	free(player);
+	return true;
 }
 
-void free_grid() {
-	// if the spectator is not currently null free it
-	if (game.grid->spectator != NULL) {
-		free_player(game.grid->spectator);
+// ends every hosted game, used when the server shuts down
+void free_games() {
+	for (int b = 0; b < GameBuckets; b++) {
+		while (games[b] != NULL) {
+			end_game(games[b]);
+		}
 	}
-	// for all of the players in the game free them
-	for (int i = 0; i < game.num_players; i++) {
-		free_player(game.grid->players[i]);
+}
+
+// hashes an address into the client table
+static int addr_bucket(const addr_t addr) {
+	return (int)((addr.sin_addr.s_addr * 31u + addr.sin_port) % ClientBuckets);
+}
+
+// gets the game a client joined, using its address
+// from- address of the client
+// returns the game, or NULL if the address has not joined any game
+hosted_t* game_from_addr(const addr_t from) {
+	for (client_t* client = clients[addr_bucket(from)]; client != NULL; client = client->next) {
+		if (message_eqAddr(client->addr, from)) {
+			return client->game;
+		}
 	}
+	return NULL;
+}
 
-	// call grid_delete which deletes the cells in the grid
-	// as well as the pointer to the array of players and itself
-	grid_delete(game.grid);
+// records that an address joined a game
+// from- address of the client
+// game- game it joined
+void route_client(const addr_t from, hosted_t* game) {
+	client_t* client = malloc(sizeof(client_t));
+	assertp(client, "Error allocating memory to client");
+	client->addr = from;
+	client->game = game;
+	client->via = forwarded_by;
+	client->next = clients[addr_bucket(from)];
+	clients[addr_bucket(from)] = client;
 }
 
+// forgets the game an address joined, if any
+// a worker forwarding the client's messages here is told to forget it too
+// from- address of the client
+void unroute_client(const addr_t from) {
+	client_t** link = &clients[addr_bucket(from)];
+	while (*link != NULL) {
+		if (message_eqAddr((*link)->addr, from)) {
+			client_t* client = *link;
+			*link = client->next;
+			if (client->via >= 0) {
+				send_envelope(client->via, 'D', from, "");
+			}
+			free(client);
+			return;
+		}
+		link = &(*link)->next;
+	}
+}
+
+// picks the worker that handles a client message
+// STATS #k goes to worker k; a plain STATS stays with the worker it reached
+// PLAY and SPECTATE go to the worker hosting the named game, which is
+// remembered so the client's later keystrokes follow them there, until
+// that worker says the client left or was turned away
+// from- address of the client
+// message- message contents
+// returns the index of the worker
+int owner_of(const addr_t from, const char *message) {
+	int id = 0;
+	const char* arg = NULL;
+	if (strncmp(message, "PLAY ", strlen("PLAY ")) == 0) {
+		arg = &(message[strlen("PLAY ")]);
+	}
+	else if (strncmp(message, "SPECTATE", strlen("SPECTATE")) == 0) {
+		arg = &(message[strlen("SPECTATE")]);
+	}
+	else if (stat_type(message) == StatStats) {
+		arg = &(message[strlen("STATS")]);
+		const char* rest = parse_game_id(arg, &id);
+		return (rest != NULL && rest != arg && id < num_workers) ? id : worker_index;
+	}
+
+	if (arg != NULL) {
+		if (parse_game_id(arg, &id) == NULL) {
+			return worker_index; // let this worker reject it
+		}
+		int owner = id % num_workers;
+		if (owner != worker_index) {
+			set_forward(from, owner);
+		}
+		else {
+			drop_forward(from, -1);
+		}
+		return owner;
+	}
+
+	// other messages follow the client's game, if it is elsewhere
+	if (game_from_addr(from) != NULL) {
+		return worker_index;
+	}
+	int owner = forward_of(from);
+	return (owner < 0) ? worker_index : owner;
+}
+
+// forwards a client message to another worker through the shared port
+// worker- index of the worker to forward to
+// from- address of the client
+// message- message contents
+void forward_message(int worker, const addr_t from, const char *message) {
+	send_envelope(worker, 'F', from, message);
+}
+
+// sends an envelope about a client to another worker through the shared port
+// the steering byte picks the worker; the operation, this worker's index and
+// the client's address ride along: 'F' forwards the client's message, and
+// 'D' tells a forwarding worker the client is no longer in a game here
+// worker- index of the worker to send to
+// op- 'F' or 'D'
+// client- address of the client
+// message- the client's message, or "" for 'D'
+void send_envelope(int worker, char op, const addr_t client, const char *message) {
+	addr_t self;
+	char port[6];
+	sprintf(port, "%d", server_port);
+	if (!message_setAddr("127.0.0.1", port, &self)) {
+		return;
+	}
+
+	//4 for the steering, operation and sender bytes, 12 hex digits for the address, newline and null
+	char* envelope = malloc(strlen(message) + 18);
+	assertp(envelope, "Error allocating memory to forwarded message");
+	sprintf(envelope, "%c%c%c%c%08x%04x\n%s", message_SteerByte, '0' + worker, op, '0' + worker_index,
+			(unsigned)client.sin_addr.s_addr, (unsigned)client.sin_port, message);
+	send_message(self, envelope);
+	free(envelope);
+}
+
+// unpacks an envelope sent by another worker
+// only envelopes sent from the shared port on this host are trusted
+// from- address the envelope came from
+// message- the envelope
+// client- filled in with the address of the client
+// op- filled in with the operation, 'F' or 'D'
+// sender- filled in with the index of the worker that sent it
+// returns the client's message, or NULL if the envelope is not valid
+const char* unwrap_forward(const addr_t from, const char *message, addr_t *client, char *op, int *sender) {
+	unsigned ip, port;
+	char newline;
+	if (from.sin_addr.s_addr != htonl(INADDR_LOOPBACK) || ntohs(from.sin_port) != server_port) {
+		return NULL;
+	}
+	if (strlen(message) < 4 + 12 + 1 || (message[2] != 'F' && message[2] != 'D') || message[3] < '0' || message[3] >= '0' + num_workers) {
+		return NULL;
+	}
+	if (sscanf(&message[4], "%8x%4x%c", &ip, &port, &newline) != 3 || newline != '\n') {
+		return NULL;
+	}
+	*op = message[2];
+	*sender = message[3] - '0';
+	*client = message_noAddr();
+	client->sin_family = AF_INET;
+	client->sin_addr.s_addr = ip;
+	client->sin_port = port;
+	return &message[4 + 12 + 1];
+}
+
+// acts on an envelope from another worker
+// a forwarded message is handled as the client's own; if the client is not in a
+// game here afterward (turned away, or never joined), the forwarding worker is
+// told to forget it, as it is when the client later leaves (unroute_client);
+// STATS #k is forwarded without a forward entry, so needs no forgetting
+// client- address of the client
+// op- 'F' for a forwarded message, 'D' to forget the client's forward
+// sender- index of the worker that sent the envelope
+// message- the client's message
+void handle_forward(const addr_t client, char op, int sender, const char *message) {
+	if (op == 'D') {
+		drop_forward(client, sender);
+		return;
+	}
+	bool joined = game_from_addr(client) != NULL;
+	forwarded_by = sender;
+	dispatch_message(client, message);
+	forwarded_by = -1;
+	if (!joined && game_from_addr(client) == NULL && stat_type(message) != StatStats) {
+		send_envelope(sender, 'D', client, "");
+	}
+}
+
+// gets the worker hosting the game of a client, using its address
+// from- address of the client
+// returns the worker index, or -1 if the client has no game on another worker
+int forward_of(const addr_t from) {
+	for (forward_t* forward = forwards[addr_bucket(from)]; forward != NULL; forward = forward->next) {
+		if (message_eqAddr(forward->addr, from)) {
+			return forward->worker;
+		}
+	}
+	return -1;
+}
+
+// records the worker hosting the game a client last asked to join
+// from- address of the client
+// worker- index of that worker
+void set_forward(const addr_t from, int worker) {
+	forward_t* forward = forwards[addr_bucket(from)];
+	while (forward != NULL && !message_eqAddr(forward->addr, from)) {
+		forward = forward->next;
+	}
+	if (forward == NULL) {
+		forward = malloc(sizeof(forward_t));
+		assertp(forward, "Error allocating memory to forward");
+		forward->addr = from;
+		forward->next = forwards[addr_bucket(from)];
+		forwards[addr_bucket(from)] = forward;
+	}
+	forward->worker = worker;
+}
+
+// forgets the worker hosting a client's game
+// a forget from a worker the client has since moved away from is ignored
+// from- address of the client
+// worker- index of the worker the client left, or -1 for any
+void drop_forward(const addr_t from, int worker) {
+	forward_t** link = &forwards[addr_bucket(from)];
+	while (*link != NULL) {
+		if (message_eqAddr((*link)->addr, from)) {
+			forward_t* forward = *link;
+			if (worker < 0 || forward->worker == worker) {
+				*link = forward->next;
+				free(forward);
+			}
+			return;
+		}
+		link = &(*link)->next;
+	}
+}
+
+// frees the forward table, used when a worker shuts down
+void free_forwards() {
+	for (int b = 0; b < ClientBuckets; b++) {
+		while (forwards[b] != NULL) {
+			forward_t* forward = forwards[b];
+			forwards[b] = forward->next;
+			free(forward);
+		}
+	}
+}
+
+// opens the recording and writes its header
+// each worker records to its own file, named path.index
+// path- file to record to; replaced if it exists
+// returns false, having printed why, if it cannot be created
+bool record_open(const char* path) {
+	char name[strlen(path) + 12];
+	if (num_workers > 1) {
+		sprintf(name, "%s.%d", path, worker_index);
+	}
+	else {
+		strcpy(name, path);
+	}
+	if ((record_fp = fopen(name, "w")) == NULL) {
+		printf("Unable to create recording %s!\n", name);
+		return false;
+	}
+
+	record_header_t header = { .version = RecordVersion, .seed = base_seed, .map_length = strlen(map_path) };
+	memcpy(header.magic, RecordMagic, sizeof(header.magic));
+	fwrite(&header, sizeof(header), 1, record_fp);
+	fwrite(map_path, header.map_length, 1, record_fp);
+	fflush(record_fp);
+	mark_time();
+	record_last = serve_time;
+	return true;
+}
+
+// appends a handled message to the recording
+// from- address of the client
+// message- message contents
+void record_message(const addr_t from, const char *message) {
+	record_entry(sender_slot(from), message);
+}
+
+// appends an entry stamped with serve_time to the recording
+// a gap too long for one entry's delay is bridged by entries with no text,
+// so the replayed times add up to the recorded ones exactly
+// it is flushed at once, since the server usually ends by being killed
+// slot- sender's slot
+// text- message text, or "" to mark travel steps taken without a message
+void record_entry(uint32_t slot, const char *text) {
+	record_entry_t entry = { .delay = UINT32_MAX, .slot = 0, .length = 0 };
+	while (serve_time - record_last > UINT32_MAX) {
+		fwrite(&entry, sizeof(entry), 1, record_fp);
+		record_last += UINT32_MAX;
+	}
+	entry.delay = serve_time - record_last;
+	entry.slot = slot;
+	entry.length = strlen(text);
+	record_last = serve_time;
+	fwrite(&entry, sizeof(entry), 1, record_fp);
+	fwrite(text, entry.length, 1, record_fp);
+	fflush(record_fp);
+}
+
+// closes the recording, if any, and forgets its senders
+void record_close() {
+	if (record_fp == NULL) {
+		return;
+	}
+	fclose(record_fp);
+	record_fp = NULL;
+	for (int b = 0; b < ClientBuckets; b++) {
+		while (senders[b] != NULL) {
+			sender_t* sender = senders[b];
+			senders[b] = sender->next;
+			free(sender);
+		}
+	}
+	num_senders = 0;
+}
+
+// numbers an address for the recording, in the order addresses are first seen
+// from- address of the client
+// returns its number
+static uint32_t sender_slot(const addr_t from) {
+	for (sender_t* sender = senders[addr_bucket(from)]; sender != NULL; sender = sender->next) {
+		if (message_eqAddr(sender->addr, from)) {
+			return sender->slot;
+		}
+	}
+	sender_t* sender = malloc(sizeof(sender_t));
+	assertp(sender, "Error allocating memory to sender");
+	sender->addr = from;
+	sender->slot = num_senders++;
+	sender->next = senders[addr_bucket(from)];
+	senders[addr_bucket(from)] = sender;
+	return sender->slot;
+}
+
+// classifies a message for the counters by its first word
+// message- message contents
+// returns its index in StatTypes, the last one if it is of none of those types
+static int stat_type(const char* message) {
+	for (int t = 0; t < NumStatTypes - 1; t++) {
+		int len = strlen(StatTypes[t]);
+		if (strncmp(message, StatTypes[t], len) == 0
+				&& (message[len] == '\0' || message[len] == ' ' || message[len] == '\n')) {
+			return t;
+		}
+	}
+	return NumStatTypes - 1;
+}
+
+// checks whether an address may ask for STATS: any port on localhost or the admin host
+// from- address of the client
+static bool is_admin(const addr_t from) {
+	if ((ntohl(from.sin_addr.s_addr) >> 24) == 127) {
+		return true;
+	}
+	return has_admin && from.sin_addr.s_addr == admin_addr.sin_addr.s_addr;
+}
+
+// sends the counters of this process, and the totals of the games it hosts
+// the answer is STATS, then one "name value" line per counter
+// to- address to send to
+void send_stats(const addr_t to) {
+	int players = 0, spectators = 0, gold = 0;
+	for (int b = 0; b < GameBuckets; b++) {
+		for (hosted_t* game = games[b]; game != NULL; game = game->next) {
+			for (int i = 0; i < game_num_players(game->engine); i++) {
+				players += game_active(game->engine, i);
+			}
+			spectators += game->watched;
+			gold += game_gold_remaining(game->engine);
+		}
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	//a line of up to 32 chars for each counter
+	char reply[(2 * NumStatTypes + 16) * 32];
+	int len = sprintf(reply, "STATS\nworker %d of %d\nuptime %.1f\n", worker_index, num_workers,
+			(now.tv_sec - stats.started.tv_sec) + (now.tv_nsec - stats.started.tv_nsec) / 1e9);
+	// types never seen in a direction are left out; the counts are as they were before this reply
+	for (int t = 0; t < NumStatTypes; t++) {
+		if (stats.in[t] > 0) {
+			len += sprintf(&reply[len], "in %s %ld\n", StatTypes[t], stats.in[t]);
+		}
+	}
+	for (int t = 0; t < NumStatTypes; t++) {
+		if (stats.out[t] > 0) {
+			len += sprintf(&reply[len], "out %s %ld\n", StatTypes[t], stats.out[t]);
+		}
+	}
+	len += sprintf(&reply[len], "bytes_out %ld\n", stats.bytes_out);
+	len += sprintf(&reply[len], "renders %ld\n", stats.renders);
+	len += sprintf(&reply[len], "views %ld\n", stats.views);
+	len += sprintf(&reply[len], "views_skipped %ld\n", stats.views_skipped);
+	len += sprintf(&reply[len], "travel_steps %ld\n", stats.travel_steps);
+	len += sprintf(&reply[len], "travelers %d\n", num_travelers);
+	len += sprintf(&reply[len], "render_mean_us %.1f\n", (stats.renders > 0) ? stats.render_total / stats.renders * 1e6 : 0);
+	len += sprintf(&reply[len], "render_max_us %.1f\n", stats.render_max * 1e6);
+	len += sprintf(&reply[len], "games %d\n", num_games);
+	len += sprintf(&reply[len], "players %d\n", players);
+	len += sprintf(&reply[len], "spectators %d\n", spectators);
+	sprintf(&reply[len], "gold_remaining %d", gold);
+	send_message(to, reply);
+}
+
+#ifdef PROBES
+// ends the timing of a phase of the message being handled
+// phase- the phase timed
+// start- probe_now when it began
+static void probe_end(int phase, uint64_t start) {
+	uint64_t end = probe_now();
+	probe_add(&probes[phase], end - start);
+	probe_spent += end - start;
+	if (probe_trace != NULL) {
+		probe_trace_event(probe_trace, probes[phase].name, start, end, probe_pid, 0, NULL, NULL);
+	}
+}
+
+// ends the timing of a message or a travel tick, counting its time outside the
+// other phases as parse or travel; every phase is timed within one of the two
+// phase- ProbeParse or ProbeTravel
+// start- probe_now when the message or tick began
+// name- name of its trace event
+// type- the message's type, for the trace, or NULL
+static void probe_rest(int phase, uint64_t start, const char* name, const char* type) {
+	uint64_t end = probe_now();
+	probe_add(&probes[phase], end - start - probe_spent);
+	probe_spent = 0;
+	if (probe_trace != NULL) {
+		probe_trace_event(probe_trace, name, start, end, probe_pid, 0, (type == NULL) ? NULL : "type", type);
+	}
+}
+#endif
+
+/* ***************** parse_game_id ********************** */
+/*
+ * Parse the optional game ID at the front of a PLAY/SPECTATE argument,
+ * written as '#' followed by a nonnegative integer, e.g. "#12 alice".
+ * Without one, the ID is 0, the default game; a '#' not followed by a
+ * digit starts a name instead, so "#foo" plays game 0 as "#foo".
+ * Returns a pointer to the text following the ID (and one space),
+ * or NULL if the ID is malformed.
+ */
+static const char* parse_game_id(const char* str, int* id)
+{
+	*id = 0;
+	const char* p = str;
+	while (*p == ' ') {
+		p++;
+	}
+	if (*p != '#' || !isdigit((unsigned char)p[1])) {
+		return str;
+	}
+	str = p;
+
+	// copy out the digits so str2int can reject any trailing junk
+	char digits[12];
+	int len = strcspn(++str, " ");
+	if (len == 0 || len >= sizeof(digits)) {
+		return NULL;
+	}
+	strncpy(digits, str, len);
+	digits[len] = '\0';
+	if (!str2int(digits, id) || *id < 0) {
+		return NULL;
+	}
+	str += len;
+	return (*str == ' ') ? str + 1 : str;
+}
 
 
 
@@ -521,3 +1658,192 @@ static bool str2int(const char string[], int *number)
   char nextchar;
   return (sscanf(string, "%d%c", number, &nextchar) == 1);
 }
+
+
+#ifdef REPLAY
+/* ***************** replay ********************** */
+/*
+ * Feeds a recording made with ./server -R back through handle_message,
+ * as fast as possible or, with -t, with the recorded delays. Nothing is
+ * sent: send_message only counts what would have been. Each sender is
+ * given a made-up loopback address from its slot number. With -m, the
+ * games are built from another map than the one recorded. Travel steps
+ * are taken by the recorded time, before the message they came due
+ * ahead of; an entry with no text takes those due by its time, as the
+ * server did when no message came.
+ * Prints how long each phase took: starting the default game, handling
+ * each kind of message, and freeing the games at the end.
+ * Exits 1 if the recording cannot be read, 2 on usage error, 4 if the
+ * map cannot be loaded.
+ */
+
+//time spent in one phase of a replay
+typedef struct phase {
+  const char* name;
+  long count;    // times the phase ran
+  double total;  // seconds, in all
+  double max;    // seconds, longest
+} phase_t;
+
+static const char ReplayUsage[] = "usage: ./replay [-t] [-m mapfile] recording\n";
+
+static void phase_add(phase_t* phase, double seconds);
+static void phase_print(const phase_t* phase);
+static double elapsed(const struct timespec* since);
+
+int
+main(int argc, const char *argv[])
+{
+	bool real_time = false;
+	const char* map_override = NULL;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-t") == 0) {
+			real_time = true;
+		}
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			map_override = argv[++i];
+		}
+		else {
+			printf("%s", ReplayUsage);
+			return 2;
+		}
+	}
+	if (i != argc - 1) {
+		printf("%s", ReplayUsage);
+		return 2;
+	}
+
+	FILE* fp = fopen(argv[i], "r");
+	if (fp == NULL) {
+		printf("Recording %s is not readable!\n", argv[i]);
+		return 1;
+	}
+	record_header_t header;
+	if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, RecordMagic, sizeof(RecordMagic)) != 0
+			|| header.version != RecordVersion || header.map_length > 4096) {
+		printf("%s is not a recording!\n", argv[i]);
+		fclose(fp);
+		return 1;
+	}
+	char recorded_map[header.map_length + 1];
+	if (fread(recorded_map, 1, header.map_length, fp) != header.map_length) {
+		printf("%s is not a recording!\n", argv[i]);
+		fclose(fp);
+		return 1;
+	}
+	recorded_map[header.map_length] = '\0';
+	map_path = (map_override != NULL) ? (char*)map_override : recorded_map;
+	base_seed = header.seed;
+
+	phase_t phases[] = {
+		{ "startup" }, { "PLAY" }, { "SPECTATE" }, { "KEY" }, { "TRAVEL" }, { "other" }, { "ticks" }, { "teardown" },
+	};
+	enum { Startup, Play, Spectate, Key, Travel, Other, Ticks, Teardown };
+	struct timespec start, begin;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// as the server does, the default game is started before any message
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	if (start_game(0) == NULL) {
+		fclose(fp);
+		return 4;
+	}
+	phase_add(&phases[Startup], elapsed(&begin));
+
+	char* message = malloc(MaxBytes + 1);
+	assertp(message, "Error allocating memory to message");
+	record_entry_t entry;
+	long due = 0;	// microseconds from the start at which the next entry was recorded
+	long num_messages = 0;
+	while (fread(&entry, sizeof(entry), 1, fp) == 1) {
+		if (entry.length > MaxBytes || fread(message, 1, entry.length, fp) != entry.length) {
+			printf("Recording %s is truncated after %ld messages\n", argv[i], num_messages);
+			break;
+		}
+		message[entry.length] = '\0';
+		addr_t from = message_noAddr();
+		from.sin_family = AF_INET;
+		from.sin_addr.s_addr = htonl(0x7f000000 | (entry.slot >> 16));	// 127.0.0.0/8, a port per slot
+		from.sin_port = htons(entry.slot & 0xffff);
+
+		due += entry.delay;
+		serve_time = due; // travel steps follow the recorded time
+		double ahead = due / 1e6 - elapsed(&start);
+		if (real_time && ahead > 0) {
+			struct timespec nap = { (time_t)ahead, (long)((ahead - (time_t)ahead) * 1e9) };
+			nanosleep(&nap, NULL);
+		}
+
+		// travel steps the server took while no message came
+		if (entry.length == 0) {
+			clock_gettime(CLOCK_MONOTONIC, &begin);
+			travel_ticks();
+			phase_add(&phases[Ticks], elapsed(&begin));
+			continue;
+		}
+
+		int kind = Other;
+		if (strncmp(message, "PLAY ", strlen("PLAY ")) == 0) {
+			kind = Play;
+		}
+		else if (strncmp(message, "SPECTATE", strlen("SPECTATE")) == 0) {
+			kind = Spectate;
+		}
+		else if (strncmp(message, "KEY ", strlen("KEY ")) == 0) {
+			kind = Key;
+		}
+		else if (strcmp(message, "TRAVEL") == 0) {
+			kind = Travel;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		handle_message(NULL, from, message);
+		phase_add(&phases[kind], elapsed(&begin));
+		num_messages++;
+	}
+	free(message);
+	fclose(fp);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	free_games();
+	phase_add(&phases[Teardown], elapsed(&begin));
+
+	printf("Replayed %ld messages on %s, seed %d, in %.3f s\n", num_messages, map_path, base_seed, elapsed(&start));
+	printf("%-10s %8s %12s %12s %12s\n", "phase", "count", "total ms", "mean us", "max us");
+	for (int p = 0; p < sizeof(phases) / sizeof(phases[0]); p++) {
+		phase_print(&phases[p]);
+	}
+	long sent = 0;
+	for (int t = 0; t < NumStatTypes; t++) {
+		sent += stats.out[t];
+	}
+	printf("Sent %ld messages, %ld bytes\n", sent, stats.bytes_out);
+	PROBE_PRINT();
+	return 0;
+}
+
+// returns the seconds since a time on the monotonic clock
+static double elapsed(const struct timespec* since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+// adds one run of a phase
+static void phase_add(phase_t* phase, double seconds) {
+	phase->count++;
+	phase->total += seconds;
+	if (seconds > phase->max) {
+		phase->max = seconds;
+	}
+}
+
+// prints a phase's line of the report, if it ran
+static void phase_print(const phase_t* phase) {
+	if (phase->count == 0) {
+		return;
+	}
+	printf("%-10s %8ld %12.3f %12.1f %12.1f\n", phase->name, phase->count,
+			phase->total * 1e3, phase->total / phase->count * 1e6, phase->max * 1e6);
+}
+#endif // REPLAY
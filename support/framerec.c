@@ -0,0 +1,437 @@
+/*
+ * framerec - compact recordings of a stream of fixed-size text frames
+ *
+ * See framerec.h for detailed interface description for each function.
+ *
+ * A recording is a file_header followed by frames, each a frame_header
+ * and a payload.  A keyframe's payload is the whole frame.  A diff's
+ * payload is a list of runs, each the number of bytes left unchanged
+ * since the end of the previous run, the number of bytes in the run
+ * (both as LEB128 varints), and the run's new bytes.  Unchanged gaps of
+ * a couple of bytes are folded into the runs around them, since a new
+ * run would cost more.  Integers are in the writing machine's byte order.
+ *
+ * foobarbaz, May 2019
+ */
+
+#define _DEFAULT_SOURCE     // for clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "framerec.h"
+
+/**************** local types ****************/
+typedef struct file_header {
+  char magic[8];         // FrameMagic
+  uint32_t version;      // FrameVersion
+  uint32_t size;         // bytes in every frame
+} file_header_t;
+
+typedef struct frame_header {
+  uint32_t time;         // milliseconds since the recording started
+  int32_t number;        // the number that goes with the frame
+  uint32_t length;       // bytes of payload following
+  uint32_t kind;         // KeyFrame or DiffFrame
+} frame_header_t;
+
+struct framerec {
+  FILE *fp;
+  int size;              // bytes in every frame
+  char *last;            // the last frame added
+  int lastNumber;        // and its number
+  unsigned char *diff;   // scratch for encoding a diff; size bytes
+  int sinceKey;          // frames added since the last keyframe
+  long frames;           // frames added
+  struct timespec start; // when the recording started
+};
+
+struct frameplay {
+  char *data;            // the whole file
+  size_t length;
+  int size;              // bytes in every frame
+  int count;             // frames in the recording
+  size_t *offsets;       // offset of each frame's header in data
+  char *frame;           // the current frame, null-terminated
+  int number;            // and its number
+  int current;           // index of the current frame, -1 if none yet
+};
+
+static const char FrameMagic[8] = "NUGFRAM";
+static const uint32_t FrameVersion = 1;
+static const uint32_t KeyFrame = 'K';
+static const uint32_t DiffFrame = 'D';
+static const int KeyInterval = 256;  // a keyframe at least this often
+static const int MaxGap = 2;         // unchanged bytes folded into a run
+
+/**************** local functions ****************/
+static int encode_diff(framerec_t *rec, const char *frame);
+static int put_varint(unsigned char *out, uint32_t value);
+static bool get_varint(const unsigned char **in, const unsigned char *end, uint32_t *value);
+static frame_header_t header_at(frameplay_t *play, const int i);
+static void apply_frame(frameplay_t *play, const int i);
+
+/**************** framerec_new ****************/
+/* see framerec.h for description */
+framerec_t *
+framerec_new(const char *path, const int size)
+{
+  if (size < 1) {
+    return NULL;
+  }
+  framerec_t *rec = malloc(sizeof(framerec_t));
+  if (rec == NULL) {
+    return NULL;
+  }
+  rec->size = size;
+  rec->last = malloc(size);
+  rec->diff = malloc(size);
+  rec->fp = fopen(path, "w");
+  if (rec->last == NULL || rec->diff == NULL || rec->fp == NULL) {
+    framerec_delete(rec);
+    return NULL;
+  }
+  rec->lastNumber = 0;
+  rec->sinceKey = 0;
+  rec->frames = 0;
+  clock_gettime(CLOCK_MONOTONIC, &rec->start);
+
+  file_header_t header = { .version = FrameVersion, .size = size };
+  memcpy(header.magic, FrameMagic, sizeof(header.magic));
+  if (fwrite(&header, sizeof(header), 1, rec->fp) != 1) {
+    framerec_delete(rec);
+    return NULL;
+  }
+  return rec;
+}
+
+/**************** framerec_add ****************/
+/* see framerec.h for description */
+bool
+framerec_add(framerec_t *rec, const char *frame, const int number)
+{
+  if (rec->frames > 0 && number == rec->lastNumber
+      && memcmp(frame, rec->last, rec->size) == 0) {
+    return true;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  frame_header_t header;
+  header.time = (now.tv_sec - rec->start.tv_sec) * 1000
+    + (now.tv_nsec - rec->start.tv_nsec) / 1000000;
+  header.number = number;
+
+  // a diff, unless a keyframe is due or the diff would be no smaller
+  int length = -1;
+  if (rec->frames > 0 && rec->sinceKey < KeyInterval) {
+    length = encode_diff(rec, frame);
+  }
+  const void *payload;
+  if (length < 0) {
+    header.kind = KeyFrame;
+    header.length = rec->size;
+    payload = frame;
+    rec->sinceKey = 0;
+  } else {
+    header.kind = DiffFrame;
+    header.length = length;
+    payload = rec->diff;
+  }
+  rec->sinceKey++;
+  rec->frames++;
+  memcpy(rec->last, frame, rec->size);
+  rec->lastNumber = number;
+
+  if (fwrite(&header, sizeof(header), 1, rec->fp) != 1
+      || (header.length > 0 && fwrite(payload, header.length, 1, rec->fp) != 1)) {
+    return false;
+  }
+  return fflush(rec->fp) == 0;
+}
+
+/**************** encode_diff ****************/
+/* Encode the runs that differ from the last frame into rec->diff.
+ * Return their length, or -1 if they would not fit in a frame's size.
+ */
+static int
+encode_diff(framerec_t *rec, const char *frame)
+{
+  const char *last = rec->last;
+  int size = rec->size;
+  int length = 0;
+  int end = 0;  // end of the previous run
+  for (int i = 0; i < size; ) {
+    if (frame[i] == last[i]) {
+      i++;
+      continue;
+    }
+    // extend the run over changes, and over short gaps between them
+    int j = i + 1;
+    while (j < size) {
+      if (frame[j] != last[j]) {
+        j++;
+        continue;
+      }
+      int k = j;
+      while (k < size && k - j < MaxGap && frame[k] == last[k]) {
+        k++;
+      }
+      if (k == size || frame[k] == last[k]) {
+        break;
+      }
+      j = k;
+    }
+
+    if (length + 10 + (j - i) > size) {
+      return -1;
+    }
+    length += put_varint(&rec->diff[length], i - end);
+    length += put_varint(&rec->diff[length], j - i);
+    memcpy(&rec->diff[length], &frame[i], j - i);
+    length += j - i;
+    end = i = j;
+  }
+  return length;
+}
+
+/**************** put_varint ****************/
+/* Write value seven bits at a time, low first, with the high bit set on
+ * every byte but the last.  Return the number of bytes written.
+ */
+static int
+put_varint(unsigned char *out, uint32_t value)
+{
+  int n = 0;
+  while (value >= 0x80) {
+    out[n++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = value;
+  return n;
+}
+
+/**************** framerec_delete ****************/
+/* see framerec.h for description */
+void
+framerec_delete(framerec_t *rec)
+{
+  if (rec == NULL) {
+    return;
+  }
+  if (rec->fp != NULL) {
+    fclose(rec->fp);
+  }
+  free(rec->last);
+  free(rec->diff);
+  free(rec);
+}
+
+/**************** frameplay_open ****************/
+/* see framerec.h for description */
+frameplay_t *
+frameplay_open(const char *path)
+{
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    return NULL;
+  }
+  frameplay_t *play = calloc(1, sizeof(frameplay_t));
+  if (play == NULL || fseek(fp, 0, SEEK_END) != 0) {
+    free(play);
+    fclose(fp);
+    return NULL;
+  }
+  long length = ftell(fp);
+  rewind(fp);
+  play->data = (length > 0) ? malloc(length) : NULL;
+  if (play->data == NULL || fread(play->data, length, 1, fp) != 1) {
+    fclose(fp);
+    frameplay_close(play);
+    return NULL;
+  }
+  fclose(fp);
+  play->length = length;
+
+  file_header_t header;
+  if (play->length < sizeof(header)) {
+    frameplay_close(play);
+    return NULL;
+  }
+  memcpy(&header, play->data, sizeof(header));
+  if (memcmp(header.magic, FrameMagic, sizeof(FrameMagic)) != 0
+      || header.version != FrameVersion || header.size < 1) {
+    frameplay_close(play);
+    return NULL;
+  }
+  play->size = header.size;
+  play->frame = malloc(play->size + 1);
+  if (play->frame == NULL) {
+    frameplay_close(play);
+    return NULL;
+  }
+  memset(play->frame, ' ', play->size);
+  play->frame[play->size] = '\0';
+  play->current = -1;
+
+  // index the frames; the first must be a keyframe
+  int capacity = 0;
+  size_t offset = sizeof(header);
+  while (play->length - offset >= sizeof(frame_header_t)) {
+    frame_header_t frame;
+    memcpy(&frame, play->data + offset, sizeof(frame));
+    if (frame.length > play->length - offset - sizeof(frame)
+        || (frame.kind != KeyFrame && frame.kind != DiffFrame)
+        || (frame.kind == KeyFrame && frame.length != play->size)
+        || (play->count == 0 && frame.kind != KeyFrame)) {
+      break;
+    }
+    if (play->count == capacity) {
+      capacity = (capacity == 0) ? 1024 : capacity * 2;
+      size_t *offsets = realloc(play->offsets, capacity * sizeof(size_t));
+      if (offsets == NULL) {
+        break;
+      }
+      play->offsets = offsets;
+    }
+    play->offsets[play->count++] = offset;
+    offset += sizeof(frame) + frame.length;
+  }
+  return play;
+}
+
+/**************** frameplay_size ****************/
+/* see framerec.h for description */
+int
+frameplay_size(frameplay_t *play)
+{
+  return play->size;
+}
+
+/**************** frameplay_count ****************/
+/* see framerec.h for description */
+int
+frameplay_count(frameplay_t *play)
+{
+  return play->count;
+}
+
+/**************** frameplay_time ****************/
+/* see framerec.h for description */
+long
+frameplay_time(frameplay_t *play, const int i)
+{
+  return header_at(play, i).time;
+}
+
+/**************** frameplay_find ****************/
+/* see framerec.h for description */
+int
+frameplay_find(frameplay_t *play, const long ms)
+{
+  // times never decrease, so search for the first frame after ms
+  int low = 0;
+  int high = play->count;
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (frameplay_time(play, mid) <= ms) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return (low > 0) ? low - 1 : 0;
+}
+
+/**************** frameplay_seek ****************/
+/* see framerec.h for description */
+const char *
+frameplay_seek(frameplay_t *play, const int i, int *number)
+{
+  if (i < play->current || play->current < 0) {
+    int key = i;
+    while (key > 0 && header_at(play, key).kind != KeyFrame) {
+      key--;
+    }
+    play->current = key - 1;
+  }
+  while (play->current < i) {
+    apply_frame(play, ++play->current);
+  }
+  if (number != NULL) {
+    *number = play->number;
+  }
+  return play->frame;
+}
+
+/**************** header_at ****************/
+/* Return the header of frame i. */
+static frame_header_t
+header_at(frameplay_t *play, const int i)
+{
+  frame_header_t header;
+  memcpy(&header, play->data + play->offsets[i], sizeof(header));
+  return header;
+}
+
+/**************** apply_frame ****************/
+/* Apply frame i to the current frame: copy a keyframe over it, or copy
+ * in a diff's runs.  A run past the end of the frame is ignored.
+ */
+static void
+apply_frame(frameplay_t *play, const int i)
+{
+  frame_header_t header = header_at(play, i);
+  const unsigned char *in = (const unsigned char *)play->data + play->offsets[i] + sizeof(header);
+  const unsigned char *end = in + header.length;
+  play->number = header.number;
+  if (header.kind == KeyFrame) {
+    memcpy(play->frame, in, play->size);
+    return;
+  }
+
+  uint32_t pos = 0;
+  uint32_t skip, length;
+  while (get_varint(&in, end, &skip) && get_varint(&in, end, &length)) {
+    if (length > end - in || skip > play->size - pos || length > play->size - pos - skip) {
+      return;
+    }
+    pos += skip;
+    memcpy(&play->frame[pos], in, length);
+    pos += length;
+    in += length;
+  }
+}
+
+/**************** get_varint ****************/
+/* Read a varint written by put_varint, advancing *in past it.
+ * Return false if it runs past end or is too long.
+ */
+static bool
+get_varint(const unsigned char **in, const unsigned char *end, uint32_t *value)
+{
+  *value = 0;
+  for (int shift = 0; *in < end && shift < 35; shift += 7) {
+    unsigned char byte = *(*in)++;
+    *value |= (uint32_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**************** frameplay_close ****************/
+/* see framerec.h for description */
+void
+frameplay_close(frameplay_t *play)
+{
+  if (play == NULL) {
+    return;
+  }
+  free(play->data);
+  free(play->offsets);
+  free(play->frame);
+  free(play);
+}
@@ -0,0 +1,106 @@
+/*
+ * framerec - compact recordings of a stream of fixed-size text frames
+ *
+ * A recording holds, for each frame added, the time it was added and a
+ * number that goes with it (the server records the gold left).  Most
+ * frames are stored as the runs of bytes that changed since the frame
+ * before; every so often a whole frame (a keyframe) is stored instead,
+ * so a reader can seek to any frame by going back to the keyframe
+ * before it and applying at most a few hundred diffs.
+ *
+ * The writer is used by the server to record the spectator's view of a
+ * game, and the reader by the player's playback mode.
+ *
+ * foobarbaz, May 2019
+ */
+
+#ifndef __FRAMEREC_H
+#define __FRAMEREC_H
+
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct framerec framerec_t;    // a recording being written; opaque
+typedef struct frameplay frameplay_t;  // a recording being read; opaque
+
+/**************** framerec_new ****************/
+/* Create a recording, replacing any file of that name.
+ * Caller provides:
+ *   path of the file to write, and the size in bytes of every frame.
+ * We return:
+ *   pointer to the new recording, or NULL if the file cannot be created.
+ * Caller is responsible for:
+ *   later calling framerec_delete.
+ */
+framerec_t *framerec_new(const char *path, const int size);
+
+/**************** framerec_add ****************/
+/* Append a frame, stamped with the milliseconds since framerec_new.
+ * A frame identical to the last one, with the same number, is skipped.
+ * The frame is flushed to the file before we return.
+ * Caller provides:
+ *   valid recording, the frame (size bytes), and the number that goes with it.
+ * We return:
+ *   false if the file could not be written.
+ */
+bool framerec_add(framerec_t *rec, const char *frame, const int number);
+
+/**************** framerec_delete ****************/
+/* Close the file and free the recording.
+ * Caller provides:
+ *   valid recording pointer, or NULL (ignored).
+ */
+void framerec_delete(framerec_t *rec);
+
+/**************** frameplay_open ****************/
+/* Read a whole recording into memory and index its frames.
+ * A frame cut short at the end of the file (the writer was killed) is dropped.
+ * Caller provides:
+ *   path of the recording.
+ * We return:
+ *   pointer to the recording, positioned before its first frame,
+ *   or NULL if the file cannot be read or is not a recording.
+ * Caller is responsible for:
+ *   later calling frameplay_close.
+ */
+frameplay_t *frameplay_open(const char *path);
+
+/**************** frameplay_size ****************/
+/* Return the size in bytes of every frame. */
+int frameplay_size(frameplay_t *play);
+
+/**************** frameplay_count ****************/
+/* Return the number of frames in the recording. */
+int frameplay_count(frameplay_t *play);
+
+/**************** frameplay_time ****************/
+/* Return the milliseconds from the start of the recording to frame i,
+ * which must be 0..frameplay_count-1.
+ */
+long frameplay_time(frameplay_t *play, const int i);
+
+/**************** frameplay_find ****************/
+/* Return the last frame recorded at or before ms milliseconds from the
+ * start, or 0 if none was.
+ */
+int frameplay_find(frameplay_t *play, const long ms);
+
+/**************** frameplay_seek ****************/
+/* Rebuild frame i, which must be 0..frameplay_count-1.  Moving forward
+ * applies the diffs from the current frame; moving back starts again
+ * from the keyframe before i.
+ * Caller provides:
+ *   valid recording, frame index, and where to store the frame's number (or NULL).
+ * We return:
+ *   the frame, null-terminated; it is overwritten by the next seek.
+ */
+const char *frameplay_seek(frameplay_t *play, const int i, int *number);
+
+/**************** frameplay_close ****************/
+/* Free the recording.
+ * Caller provides:
+ *   valid recording pointer, or NULL (ignored).
+ */
+void frameplay_close(frameplay_t *play);
+
+#endif // __FRAMEREC_H
@@ -14,16 +14,22 @@
  * David Kotz - May 2019
  */
 
+#define _DEFAULT_SOURCE     // for SO_REUSEPORT
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <strings.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <math.h>
+#ifdef __linux__
+#include <linux/filter.h>   // for the reuseport steering program
+#endif
 #include "message.h"
 #include "log.h"
 
@@ -35,71 +41,243 @@
 static const int MinPort = 1024;
 static const int MaxPort = 65535;
 
+/**************** file-local types ****************/
+/* A messaging context: one socket and everything that goes with it.
+ * Each context is used by one thread at a time, so nothing in it is locked;
+ * threads that want their own endpoint each open their own context.
+ */
+struct message_ctx {
+  int socket;                     // socket on which to receive messages
+  int port;                       // port number the socket is bound to
+  int inputFd;                    // descriptor watched for handleInput
+  char *buf;                      // buffer for reading data from socket
+  message_stats_t stats;          // traffic through this context
+};
+
 /**************** file-local global variables ****************/
 /* This is an example of a judicious use of a global variable.
- * This module provides init() and done() functions that allow it
- * to initialize and cleanup; specifically, it needs to open and close
- * a socket it will use for all the messaging operations. We keep the
- * socket number (a file descriptor) here inside the module, unseen by
- * any code outside this module, but convenient for use internally.
- * One disadvantage to this approach is that all users of this module
- * must work with the same socket, and thus the same port number,
- * but a more flexible approach would require a much more complex interface.
+ * The original interface (message_init, message_send, message_loop,
+ * message_done) implicitly works with a single socket; we keep the
+ * context for that socket here inside the module, unseen by any code
+ * outside this module.  Programs that need more than one socket, or
+ * one socket per thread, use the message_ctx_* functions instead.
  */
-static int ourSocket = 0;     // socket on which to receive messages
+static message_ctx_t *ourCtx = NULL;  // default context
+
+/**************** local functions ****************/
+static bool attach_steering(const int sock);
 
 /***********************************************************************/
 /**************** message_init ****************/
 /* 
- * Set up a socket on which to receive messages; return the port number.
- * Invariant: ourSocket = 0 if we return with error, else ourSocket > 0.
+ * Set up the default context; return the port number.
+ * Invariant: ourCtx = NULL if we return with error, else ourCtx != NULL.
  * Log error and return zero if any error.
  * See message.h for detailed description.
  */
 int
 message_init(FILE *logFP)
 {
-  log_init(logFP);
-
   // Have we already been initialized?
-  if (ourSocket != 0) {
+  if (ourCtx != NULL) {
+    log_init(logFP);
     log_v("message_init: called again, when already initialized");
     return 0;
   }
 
-  // Create socket on which to listen (file descriptor)
-  ourSocket = socket(AF_INET, SOCK_DGRAM, 0);
-  if (ourSocket < 0) {
-    log_e("message_init: error opening datagram socket");
-    ourSocket = 0;
+  ourCtx = message_ctx_new(logFP, 0, false);
+  return ourCtx == NULL ? 0 : ourCtx->port;
+}
+
+/**************** message_initShared ****************/
+/* 
+ * Set up the default context on a port shared through SO_REUSEPORT.
+ * Log error and return zero if any error.
+ * See message.h for detailed description.
+ */
+int
+message_initShared(FILE *logFP, const int port)
+{
+  // Have we already been initialized?
+  if (ourCtx != NULL) {
+    log_init(logFP);
+    log_v("message_initShared: called again, when already initialized");
     return 0;
   }
 
+  ourCtx = message_ctx_new(logFP, port, true);
+  return ourCtx == NULL ? 0 : ourCtx->port;
+}
+
+/**************** message_ctx_new ****************/
+/* 
+ * Create a context with a socket bound to the given port (0 means any
+ * port), optionally shared with other sockets through SO_REUSEPORT;
+ * every socket in a shared group (re)installs the same steering program.
+ * Log error and return NULL if any error.
+ * See message.h for detailed description.
+ */
+message_ctx_t *
+message_ctx_new(FILE *logFP, const int port, const bool shared)
+{
+  log_init(logFP);
+
+  if (port < 0 || port > MaxPort) {
+    log_d("message_ctx_new: illegal port number '%d'", port);
+    return NULL;
+  }
+
+  message_ctx_t *ctx = calloc(1, sizeof(message_ctx_t));
+  char *buf = malloc(message_MaxBytes);
+  if (ctx == NULL || buf == NULL) {
+    log_v("message_ctx_new: out of memory");
+    free(ctx);
+    free(buf);
+    return NULL;
+  }
+  ctx->buf = buf;
+  ctx->inputFd = 0;       // stdin
+
+  // Create socket on which to listen (file descriptor)
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    log_e("message_ctx_new: error opening datagram socket");
+    message_ctx_delete(ctx);
+    return NULL;
+  }
+  ctx->socket = sock;
+
+  // Let other sockets bind the same port, if asked to
+  int one = 1;
+  if (shared && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+                           &one, sizeof(one))) {
+    log_e("message_ctx_new: setting SO_REUSEPORT");
+    message_ctx_delete(ctx);
+    return NULL;
+  }
+
   // Name socket using wildcards
   struct sockaddr_in self;  // our address
   self.sin_family = AF_INET;
   self.sin_addr.s_addr = INADDR_ANY;
-  self.sin_port = 0;
-  if (bind(ourSocket, (struct sockaddr *) &self, sizeof(self))) {
-    log_e("message_init: binding socket name");
-    close(ourSocket);
-    ourSocket = 0;
-    return 0;
+  self.sin_port = htons(port);
+  if (bind(sock, (struct sockaddr *) &self, sizeof(self))) {
+    log_e("message_ctx_new: binding socket name");
+    message_ctx_delete(ctx);
+    return NULL;
   }
 
   // get our assigned address
   socklen_t selflen = sizeof(self); // length of our address
-  if (getsockname(ourSocket, (struct sockaddr *) &self, &selflen)) {
-    log_e("message_init: getting socket name");
-    close(ourSocket);
-    ourSocket = 0;
-    return 0;
+  if (getsockname(sock, (struct sockaddr *) &self, &selflen)) {
+    log_e("message_ctx_new: getting socket name");
+    message_ctx_delete(ctx);
+    return NULL;
   }
+
+  if (shared && !attach_steering(sock)) {
+    message_ctx_delete(ctx);
+    return NULL;
+  }
+
   // extract our port number
-  int port = ntohs(self.sin_port);
-  log_d("message_init: ready at port '%d'", port);
+  ctx->port = ntohs(self.sin_port);
+  log_d("message_init: ready at port '%d'", ctx->port);
 
-  return port;
+  return ctx;
+}
+
+/**************** attach_steering ****************/
+/* 
+ * Attach a classic BPF program to the reuseport group of the socket.
+ * For UDP the program sees the payload: if it begins with
+ * message_SteerByte, the next byte (offset by '0') is the index of the
+ * socket, in bind order, that receives the datagram.  The program
+ * returns an out-of-range index for anything else, which makes the
+ * kernel fall back to spreading datagrams by the sender's address.
+ * Return false, after logging, if the program cannot be attached.
+ */
+static bool
+attach_steering(const int sock)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 0),                 // A = byte 0
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, message_SteerByte, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0xffffffff),                    // not steered
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 1),                 // A = byte 1
+    BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, '0'),                 // A = index
+    BPF_STMT(BPF_RET | BPF_A, 0),
+  };
+  struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                 &prog, sizeof(prog))) {
+    log_e("message_initShared: attaching steering program");
+    return false;
+  }
+  return true;
+#else
+  log_v("message_initShared: steering is not supported on this platform");
+  return false;
+#endif
+}
+
+/**************** message_ctx_port ****************/
+/* 
+ * Return the port number the context's socket is bound to.
+ * See message.h for detailed description.
+ */
+int
+message_ctx_port(const message_ctx_t *ctx)
+{
+  return ctx == NULL ? 0 : ctx->port;
+}
+
+/**************** message_ctx_fd ****************/
+/* 
+ * Return the descriptor of the context's socket.
+ * See message.h for detailed description.
+ */
+int
+message_ctx_fd(const message_ctx_t *ctx)
+{
+  return ctx == NULL ? -1 : ctx->socket;
+}
+
+/**************** message_ctx_setInput ****************/
+/* 
+ * Choose the file descriptor whose input triggers handleInput.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_setInput(message_ctx_t *ctx, const int fd)
+{
+  if (ctx != NULL && fd >= 0) {
+    ctx->inputFd = fd;
+  }
+}
+
+/**************** message_ctx_stats ****************/
+/* 
+ * Return the traffic statistics of the context.
+ * See message.h for detailed description.
+ */
+message_stats_t
+message_ctx_stats(const message_ctx_t *ctx)
+{
+  message_stats_t none = {0};
+  return ctx == NULL ? none : ctx->stats;
+}
+
+/**************** message_stats ****************/
+/* 
+ * Return the traffic statistics of the default context.
+ * See message.h for detailed description.
+ */
+message_stats_t
+message_stats(void)
+{
+  return message_ctx_stats(ourCtx);
 }
 
 /**************** message_noAddr ****************/
@@ -190,31 +368,50 @@ message_setAddr(const char *hostname, const char *portString, addr_t *addr)
 
 /**************** message_send ****************/
 /* 
- * Send a string message to the correspondent address.
+ * Send a string message to the correspondent address,
+ * through the default context.
  * See message.h for detailed description.
  */
 void
 message_send(const addr_t to, const char *message)
 {
-  if (ourSocket == 0) {
+  if (ourCtx == NULL) {
     log_v("message_send called before message_init");
     return; // error in usage of this function.
   }
+  message_ctx_send(ourCtx, to, message);
+}
+
+/**************** message_ctx_send ****************/
+/* 
+ * Send a string message to the correspondent address.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_send(message_ctx_t *ctx, const addr_t to, const char *message)
+{
+  if (ctx == NULL) {
+    log_v("message_ctx_send called with null context");
+    return; // error in usage of this function.
+  }
   if (message == NULL) {
     log_v("message_send called with null message");
     return; // error in usage of this function.
   }
-  if (sendto(ourSocket, message, strlen(message), 0,
+  size_t len = strlen(message);
+  if (sendto(ctx->socket, message, len, 0,
 	     (struct sockaddr *) &to, sizeof(to)) < 0) {
     log_e("message_send: error sending to datagram socket");
+    ctx->stats.sendErrors++;
+  } else {
+    ctx->stats.messagesSent++;
+    ctx->stats.bytesSent += len;
   }
 }
 
 /**************** message_loop ****************/
 /* 
- * Loop forever, calling handler functions for stdin or socket,
- * as input is available from either.
- * Returns false on error or true if any of the handlers return true.
+ * Loop forever on the default context.
  * See message.h for detailed description.
  */
 bool
@@ -225,10 +422,33 @@ message_loop(void *arg, const float timeout,
                                    const addr_t from, const char *buf))
 {
   // check parameters
-  if (ourSocket == 0) {
+  if (ourCtx == NULL) {
     log_v("message_loop called before message_init");
     return false; // error in usage of this function.
   }
+  return message_ctx_loop(ourCtx, arg, timeout,
+                          handleTimeout, handleInput, handleMessage);
+}
+
+/**************** message_ctx_loop ****************/
+/* 
+ * Loop forever, calling handler functions for stdin or socket,
+ * as input is available from either.
+ * Returns false on error or true if any of the handlers return true.
+ * See message.h for detailed description.
+ */
+bool
+message_ctx_loop(message_ctx_t *ctx, void *arg, const float timeout,
+                 bool (*handleTimeout)(void *arg),
+                 bool (*handleInput)  (void *arg),
+                 bool (*handleMessage)(void *arg, 
+                                       const addr_t from, const char *buf))
+{
+  // check parameters
+  if (ctx == NULL) {
+    log_v("message_ctx_loop called with null context");
+    return false; // error in usage of this function.
+  }
 
   // set up for timeouts, if desired
   struct timeval *timerp = NULL; // stays null if no timeout desired
@@ -236,7 +456,7 @@ message_loop(void *arg, const float timeout,
   struct timeval timeoutval;     // timeval equivalent of parameter 'timeout'
   if (timeout > 0.0) {
     timeoutval.tv_sec  = floor(timeout);
-    timeoutval.tv_usec = timeout - floor(timeout);
+    timeoutval.tv_usec = (timeout - floor(timeout)) * 1e6;
   }
 
   // loop until error or some handler indicates time to quit looping
@@ -244,16 +464,19 @@ message_loop(void *arg, const float timeout,
     // for use with select()
     fd_set rfds;        // set of file descriptors we want to read
     
-    // Watch stdin (fd 0) and the socket to see when either has input.
+    // Watch the input (normally stdin, fd 0) and the socket to see when
+    // either has input.
     int nfds = 0;	      // number of file descriptors to monitor
     FD_ZERO(&rfds);	      // default to none
     if (handleInput != NULL) {
-      FD_SET(0, &rfds);	      // monitor stdin
-      nfds = 1;
+      FD_SET(ctx->inputFd, &rfds);	// monitor the input
+      nfds = ctx->inputFd+1;
     }
-    if (handleMessage != NULL && ourSocket != 0) {
-      FD_SET(ourSocket, &rfds); // monitor the socket
-      nfds = ourSocket+1;	// highest-numbered fd in rfds
+    if (handleMessage != NULL) {
+      FD_SET(ctx->socket, &rfds); // monitor the socket
+      if (ctx->socket >= nfds) {
+        nfds = ctx->socket+1;	// highest-numbered fd in rfds
+      }
     }
     if (timeout > 0.0) {      // is timeout desired?
       timer = timeoutval;     // set the timer to the timeout value
@@ -279,27 +502,30 @@ message_loop(void *arg, const float timeout,
     } else if (select_response > 0) {
       // some data is ready on either source, or both
 
-      if (FD_ISSET(0, &rfds)) {
-        // stdin has input ready
+      if (handleInput != NULL && FD_ISSET(ctx->inputFd, &rfds)) {
+        // stdin (or the chosen input) has input ready
 	log_v("message_loop: input ready on stdin");
-        if (handleInput != NULL && (*handleInput)(arg)) {
+        if ((*handleInput)(arg)) {
           break; // handler says to exit loop 
         }
       }
-      if (FD_ISSET(ourSocket, &rfds)) {
+      if (handleMessage != NULL && FD_ISSET(ctx->socket, &rfds)) {
         // socket has input ready
 	log_v("message_loop: message ready on socket");
         struct sockaddr_in sender;     // sender of this message
         struct sockaddr *senderp = (struct sockaddr *) &sender;
         socklen_t senderlen = sizeof(sender);  // must pass address to length
-        char buf[message_MaxBytes]; // buffer for reading data from socket
-        int nbytes = recvfrom(ourSocket, buf, message_MaxBytes-1, 
+        char *buf = ctx->buf; // buffer for reading data from socket
+        int nbytes = recvfrom(ctx->socket, buf, message_MaxBytes-1, 
                               0, senderp, &senderlen);
         if (nbytes < 0) {
           // error, ignore it
           log_e("message_loop: receiving from socket");
+          ctx->stats.receiveErrors++;
         } else {
           buf[nbytes] = '\0';     // null terminate message string
+          ctx->stats.messagesReceived++;
+          ctx->stats.bytesReceived += nbytes;
           // where was it from?
           if (sender.sin_family != AF_INET) {
             // ignore it
@@ -309,7 +535,7 @@ message_loop(void *arg, const float timeout,
             log_s("message_loop: from host %s", inet_ntoa(sender.sin_addr));
             log_d("message_loop: from port %d", ntohs(sender.sin_port));
             log_s("message_loop: content:\n%s\n", buf);
-            if (handleMessage != NULL && (*handleMessage)(arg, sender, buf)) {
+            if ((*handleMessage)(arg, sender, buf)) {
               break; // handler says to exit loop 
             }
           }
@@ -320,6 +546,39 @@ message_loop(void *arg, const float timeout,
   return true;
 }
 
+/**************** message_ctx_receive ****************/
+/* 
+ * Read one waiting datagram, if any, without blocking.
+ * See message.h for detailed description.
+ */
+const char *
+message_ctx_receive(message_ctx_t *ctx, addr_t *from)
+{
+  if (ctx == NULL || from == NULL) {
+    log_v("message_ctx_receive called with null context or address");
+    return NULL; // error in usage of this function.
+  }
+  while (true) {
+    socklen_t senderlen = sizeof(*from);  // must pass address to length
+    int nbytes = recvfrom(ctx->socket, ctx->buf, message_MaxBytes-1,
+                          MSG_DONTWAIT, (struct sockaddr *) from, &senderlen);
+    if (nbytes < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        log_e("message_ctx_receive: receiving from socket");
+        ctx->stats.receiveErrors++;
+      }
+      return NULL;
+    }
+    ctx->buf[nbytes] = '\0';     // null terminate message string
+    ctx->stats.messagesReceived++;
+    ctx->stats.bytesReceived += nbytes;
+    if (from->sin_family == AF_INET) {
+      return ctx->buf;
+    }
+    log_d("message_ctx_receive: non-Internet family %d\n", from->sin_family);
+  }
+}
+
 /**************** message_done ****************/
 /* 
  * Clean up the message module, prior to exit.
@@ -328,13 +587,28 @@ message_loop(void *arg, const float timeout,
 void
 message_done(void)
 {
-  if (ourSocket != 0) {
-    close(ourSocket);
-    ourSocket = 0;
-  }
+  message_ctx_delete(ourCtx);
+  ourCtx = NULL;
   log_v("message_done: message module closing down.");
 }
 
+/**************** message_ctx_delete ****************/
+/* 
+ * Close the context's socket and free the context.
+ * See message.h for detailed description.
+ */
+void
+message_ctx_delete(message_ctx_t *ctx)
+{
+  if (ctx != NULL) {
+    if (ctx->socket > 0) {
+      close(ctx->socket);
+    }
+    free(ctx->buf);
+    free(ctx);
+  }
+}
+
 
 /* ****************************************************************** */
 /* ************************* UNIT_TEST ****************************** */
@@ -15,6 +15,15 @@
  *   message_loop(arg, timeout, handleTimeout, handleStdin, handleMessage);
  *   message_done();
  *
+ * The functions above share one socket, the module's default context.
+ * A program needing several sockets, e.g. one per thread, opens a
+ * context for each and uses the message_ctx_* functions:
+ *   message_ctx_t *ctx = message_ctx_new(stderr, 0, false);
+ *   message_ctx_loop(ctx, arg, timeout, handleTimeout, NULL, handleMessage);
+ *   message_ctx_delete(ctx);
+ * A context must be used by one thread at a time; distinct contexts
+ * may be used concurrently without locking.
+ *
  * David Kotz - May 2019
  */
 
@@ -39,11 +48,31 @@
  */
 typedef struct sockaddr_in addr_t;
 
+/* An opaque messaging context, owning a socket and its receive buffer.
+ */
+typedef struct message_ctx message_ctx_t;
+
+/* Traffic statistics kept by each context.
+ * Bytes count message payloads only, not UDP/IP headers.
+ */
+typedef struct message_stats {
+  unsigned long messagesSent;
+  unsigned long messagesReceived;
+  unsigned long bytesSent;
+  unsigned long bytesReceived;
+  unsigned long sendErrors;
+  unsigned long receiveErrors;
+} message_stats_t;
+
 /****************** constants *********************/
 // Maximum payload size for UDP messages, according to
 // https://en.wikipedia.org/wiki/User_Datagram_Protocol
 static const int message_MaxBytes = 65507;
 
+// First byte of a datagram that names the shared socket to deliver it to;
+// see message_initShared.  Text messages never begin with this byte.
+static const char message_SteerByte = '\001';
+
 /****************** global functions *********************/
 
 /******************************************/
@@ -58,6 +87,28 @@ static const int message_MaxBytes = 65507;
  */
 int message_init(FILE *logFP);
 
+/******************************************/
+/* message_initShared: initialize the module on a port shared by several
+ * sockets, typically one in each of several forked worker processes.
+ * Caller provides:
+ *   file pointer(fp), passed through to log_init();
+ *   port number to bind, or 0 to have one assigned.
+ * Function returns:
+ *   port number where messages can be sent; zero on error.
+ * Notes:
+ *   Pass the returned port to later calls so all sockets share it.
+ *   Sockets are numbered 0, 1, ... in the order they were bound.
+ *   A datagram beginning with message_SteerByte followed by the
+ *   character '0'+k is delivered to socket k; all other datagrams are
+ *   spread over the sockets by a hash of the sender's address, so one
+ *   sender keeps reaching the same socket.
+ *   Linux only: returns zero where the steering program is unsupported.
+ * Caller expectations:
+ *   call message_done() later when all messaging operations complete.
+ * Logs: information about errors; the port number.
+ */
+int message_initShared(FILE *logFP, const int port);
+
 /******************************************/
 /* message_noAddr: return an addr_t representing "no address".
  * Logs: nothing.
@@ -156,5 +207,97 @@ bool message_loop(void *arg, const float timeout,
  */
 void message_done(void);
 
+/******************************************/
+/* message_stats: traffic statistics of the default context.
+ * Function returns: the counts so far, or all zeros before message_init.
+ * Logs: nothing.
+ */
+message_stats_t message_stats(void);
+
+/******************************************/
+/* message_ctx_new: open a new context with its own socket.
+ * Caller provides:
+ *   file pointer(fp), passed through to log_init();
+ *   port number to bind, or 0 to have one assigned;
+ *   whether to share the port as described in message_initShared.
+ * Function returns:
+ *   the new context, or NULL on error.
+ * Caller expectations:
+ *   call message_ctx_delete() later when done with the context.
+ * Logs: information about errors; the port number.
+ */
+message_ctx_t *message_ctx_new(FILE *logFP, const int port, const bool shared);
+
+/******************************************/
+/* message_ctx_port: the port number a context's socket is bound to.
+ * Function returns: the port number; zero if ctx is NULL.
+ * Logs: nothing.
+ */
+int message_ctx_port(const message_ctx_t *ctx);
+
+/******************************************/
+/* message_ctx_send: like message_send, through the given context.
+ */
+void message_ctx_send(message_ctx_t *ctx, const addr_t to, const char *message);
+
+/******************************************/
+/* message_ctx_loop: like message_loop, on the given context's socket.
+ */
+bool message_ctx_loop(message_ctx_t *ctx, void *arg, const float timeout,
+		      bool (*handleTimeout)(void *arg),
+		      bool (*handleInput)  (void *arg),
+		      bool (*handleMessage)(void *arg, 
+					    const addr_t from, 
+					    const char *message));
+
+/******************************************/
+/* message_ctx_fd: the socket descriptor of a context.
+ * Function returns: the descriptor; -1 if ctx is NULL.
+ * Notes:
+ *   For a program waiting on many contexts at once with poll(),
+ *   which then reads each ready one with message_ctx_receive.
+ * Logs: nothing.
+ */
+int message_ctx_fd(const message_ctx_t *ctx);
+
+/******************************************/
+/* message_ctx_receive: receive one message without waiting.
+ * Caller provides: a context, and where to store the sender's address.
+ * Function returns:
+ *   the message, null-terminated, valid until the next receive on ctx;
+ *   NULL if no message is waiting, or on error.
+ * Notes:
+ *   Messages from other than Internet addresses are skipped.
+ *   Counted in the context's statistics like those message_ctx_loop reads.
+ * Logs: information about errors.
+ */
+const char *message_ctx_receive(message_ctx_t *ctx, addr_t *from);
+
+/******************************************/
+/* message_ctx_setInput: watch another descriptor in place of stdin.
+ * Caller provides: a context and an open file descriptor.
+ * Notes:
+ *   message_ctx_loop calls handleInput when fd is readable; handleInput
+ *   must then read from fd.  A pipe written by another thread lets
+ *   that thread wake the loop.
+ * Logs: nothing.
+ */
+void message_ctx_setInput(message_ctx_t *ctx, const int fd);
+
+/******************************************/
+/* message_ctx_stats: traffic statistics of the given context.
+ * Function returns: the counts so far; all zeros if ctx is NULL.
+ * Logs: nothing.
+ */
+message_stats_t message_ctx_stats(const message_ctx_t *ctx);
+
+/******************************************/
+/* message_ctx_delete: close a context's socket and free it.
+ * Caller provides: a context from message_ctx_new, or NULL (ignored).
+ * Assumptions: no thread is still looping or sending on it.
+ * Logs: nothing.
+ */
+void message_ctx_delete(message_ctx_t *ctx);
+
 
 #endif // _MESSAGE_H_
@@ -0,0 +1,420 @@
+/*
+ * messagebench - throughput and latency benchmark of the message module
+ *
+ * Runs two contexts over loopback in one process: the main thread sends,
+ * and a second thread receives with message_ctx_loop.  For each payload
+ * size, two tests:
+ *   pingpong - the receiver echoes each message; the sender waits for the
+ *              echo, with message_ctx_loop, before sending the next.
+ *              Latency is the round trip.
+ *   stream   - the sender sends as fast as it can; the receiver counts.
+ *              Each payload starts with its send time, so latency is the
+ *              one-way time, queueing included.  Messages the kernel
+ *              dropped from a full socket buffer show as loss.
+ * Each test runs for count messages or seconds, whichever comes first.
+ *
+ * The benchmark is linked with --wrap for the socket calls the module
+ * makes (see the Makefile), so it counts the system calls behind each
+ * message: a change of loop backend or batching shows up there first.
+ *
+ * usage: ./messagebench [-n count] [-t seconds] [-s size[,size...]] [pingpong|stream]
+ *   count   - most messages per test (default 100000)
+ *   seconds - most time per test (default 1)
+ *   size    - payload bytes (default 6,64,512,2048,16384,65506: a KEY
+ *             message up to the largest datagram the module receives)
+ *   With neither pingpong nor stream, runs both.
+ *
+ * foobarbaz, May 2019
+ */
+
+#define _DEFAULT_SOURCE     // for clock_gettime and nanosleep
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include "message.h"
+
+/**************** local types ****************/
+typedef struct receiver {
+  message_ctx_t *ctx;       // the receiving context
+  bool echo;                // pingpong: send each message back
+  bool stamped;             // stream: payloads start with their send time
+  double last;              // when the last message was received
+  long received;            // messages received, but for the end marker
+  long bytes;
+  double *latencies;        // stream: one-way microseconds of each message
+  long maxLatencies;
+} receiver_t;
+
+typedef struct result {
+  long sent;
+  long received;
+  double seconds;           // from the first send to the last receive
+  double *latencies;        // microseconds, sorted
+  long numLatencies;
+  unsigned long syscalls;   // by both sides, during the test
+} result_t;
+
+/**************** local constants ****************/
+static const char Usage[] = "usage: ./messagebench [-n count] [-t seconds] [-s size[,size...]] [pingpong|stream]\n";
+static const int DefaultSizes[] = { 6, 64, 512, 2048, 16384, 65506 };
+static const int MaxSizes = 32;
+static const char EndMarker[] = "END";
+static const int EndRepeats = 10;       // end markers sent, as any may be lost
+static const float IdleTimeout = 1.0;   // seconds of silence that end a test
+
+/**************** system call counts ****************/
+/* The Makefile links with -Wl,--wrap=sendto and so on, so the module's
+ * calls to sendto come here, and we pass them on to the real one.
+ */
+static atomic_ulong syscalls;
+
+ssize_t __real_sendto(int fd, const void *buf, size_t len, int flags,
+                      const struct sockaddr *to, socklen_t tolen);
+ssize_t __real_recvfrom(int fd, void *buf, size_t len, int flags,
+                        struct sockaddr *from, socklen_t *fromlen);
+int __real_select(int nfds, fd_set *rfds, fd_set *wfds, fd_set *efds,
+                  struct timeval *timeout);
+int __real_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+ssize_t
+__wrap_sendto(int fd, const void *buf, size_t len, int flags,
+              const struct sockaddr *to, socklen_t tolen)
+{
+  atomic_fetch_add(&syscalls, 1);
+  return __real_sendto(fd, buf, len, flags, to, tolen);
+}
+
+ssize_t
+__wrap_recvfrom(int fd, void *buf, size_t len, int flags,
+                struct sockaddr *from, socklen_t *fromlen)
+{
+  atomic_fetch_add(&syscalls, 1);
+  return __real_recvfrom(fd, buf, len, flags, from, fromlen);
+}
+
+int
+__wrap_select(int nfds, fd_set *rfds, fd_set *wfds, fd_set *efds,
+              struct timeval *timeout)
+{
+  atomic_fetch_add(&syscalls, 1);
+  return __real_select(nfds, rfds, wfds, efds, timeout);
+}
+
+int
+__wrap_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+  atomic_fetch_add(&syscalls, 1);
+  return __real_poll(fds, nfds, timeout);
+}
+
+/**************** local functions ****************/
+static result_t pingpong(message_ctx_t *ctx, const addr_t to, receiver_t *rx,
+                         char *payload, long count, double limit);
+static result_t stream(message_ctx_t *ctx, const addr_t to, receiver_t *rx,
+                       char *payload, long count, double limit);
+static void drain(message_ctx_t *ctx);
+static void *receiver_thread(void *arg);
+static bool rx_handleMessage(void *arg, const addr_t from, const char *message);
+static bool tx_handleMessage(void *arg, const addr_t from, const char *message);
+static bool handleTimeout(void *arg);
+static void report(const char *test, int size, result_t *result);
+static double now(void);
+static int compare_doubles(const void *a, const void *b);
+
+int
+main(const int argc, char *argv[])
+{
+  long count = 100000;
+  double limit = 1.0;
+  int sizes[MaxSizes];
+  int numSizes = sizeof(DefaultSizes) / sizeof(DefaultSizes[0]);
+  memcpy(sizes, DefaultSizes, sizeof(DefaultSizes));
+  bool runPingpong = true;
+  bool runStream = true;
+
+  int i = 1;
+  for (; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc
+        && sscanf(argv[i+1], "%ld", &count) == 1 && count > 0) {
+      i++;
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc
+               && sscanf(argv[i+1], "%lf", &limit) == 1 && limit > 0) {
+      i++;
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      // a comma-separated list of sizes, 1 to the largest datagram received
+      const char *list = argv[++i];
+      int used = 0;
+      for (numSizes = 0; *list != '\0'; numSizes++) {
+        if (numSizes == MaxSizes || sscanf(list, "%d%n", &sizes[numSizes], &used) != 1
+            || sizes[numSizes] < 1 || sizes[numSizes] > message_MaxBytes - 1
+            || (list[used] != '\0' && list[used] != ',')) {
+          fprintf(stderr, "%s", Usage);
+          return 2;
+        }
+        list += used + (list[used] == ',');
+      }
+    } else if (strcmp(argv[i], "pingpong") == 0 && runStream && runPingpong) {
+      runStream = false;
+    } else if (strcmp(argv[i], "stream") == 0 && runStream && runPingpong) {
+      runPingpong = false;
+    } else {
+      fprintf(stderr, "%s", Usage);
+      return 2;
+    }
+  }
+
+  // the receiving context, and the sending one with the receiver's address
+  receiver_t rx = { message_ctx_new(NULL, 0, false) };
+  message_ctx_t *tx = message_ctx_new(NULL, 0, false);
+  if (rx.ctx == NULL || tx == NULL) {
+    fprintf(stderr, "cannot open sockets\n");
+    return 1;
+  }
+  char port[12];
+  sprintf(port, "%d", message_ctx_port(rx.ctx));
+  addr_t to;
+  if (!message_setAddr("localhost", port, &to)) {
+    return 1;
+  }
+  char *payload = malloc(message_MaxBytes);
+  if (payload == NULL) {
+    return 1;
+  }
+
+  printf("%-8s %6s %9s %9s %8s %11s %11s %9s %9s %9s %9s %9s\n", "test", "bytes",
+         "sent", "received", "loss %", "msgs/s", "MB/s", "calls/msg",
+         "p50 us", "p99 us", "p999 us", "max us");
+  for (int s = 0; s < numSizes; s++) {
+    // the payload is text, as the module sends strings
+    memset(payload, 'x', sizes[s]);
+    payload[sizes[s]] = '\0';
+    if (runPingpong) {
+      drain(rx.ctx);
+      drain(tx);
+      result_t result = pingpong(tx, to, &rx, payload, count, limit);
+      report("pingpong", sizes[s], &result);
+    }
+    if (runStream) {
+      drain(rx.ctx);
+      drain(tx);
+      result_t result = stream(tx, to, &rx, payload, count, limit);
+      report("stream", sizes[s], &result);
+    }
+  }
+
+  free(payload);
+  free(rx.latencies);
+  message_ctx_delete(tx);
+  message_ctx_delete(rx.ctx);
+  return 0;
+}
+
+/**************** pingpong ****************/
+/* Send each message and wait for its echo; a lost one ends its wait
+ * after IdleTimeout and is counted as not received.
+ */
+static result_t
+pingpong(message_ctx_t *ctx, const addr_t to, receiver_t *rx,
+         char *payload, long count, double limit)
+{
+  result_t result = { 0 };
+  result.latencies = malloc(count * sizeof(double));
+  if (result.latencies == NULL) {
+    return result;
+  }
+  rx->echo = true;
+  rx->received = rx->bytes = 0;
+  atomic_store(&syscalls, 0);
+  pthread_t thread;
+  pthread_create(&thread, NULL, receiver_thread, rx);
+
+  double start = now();
+  double end = start;
+  while (result.sent < count && end - start < limit) {
+    double sent = now();
+    message_ctx_send(ctx, to, payload);
+    result.sent++;
+    bool echoed = false;
+    message_ctx_loop(ctx, &echoed, IdleTimeout, handleTimeout, NULL, tx_handleMessage);
+    end = now();
+    if (echoed) {
+      result.latencies[result.numLatencies++] = (end - sent) * 1e6;
+    }
+  }
+  result.syscalls = atomic_load(&syscalls);
+  result.seconds = end - start;
+  result.received = result.numLatencies;
+
+  for (int i = 0; i < EndRepeats; i++) {
+    message_ctx_send(ctx, to, EndMarker);
+  }
+  pthread_join(thread, NULL);
+  return result;
+}
+
+/**************** stream ****************/
+/* Send as fast as possible, each payload stamped with its send time,
+ * then end-markers; the receiver stops at the first marker, or when
+ * nothing arrives for IdleTimeout.
+ */
+static result_t
+stream(message_ctx_t *ctx, const addr_t to, receiver_t *rx,
+       char *payload, long count, double limit)
+{
+  result_t result = { 0 };
+  int size = strlen(payload);
+  char stamp[32];
+  rx->echo = false;
+  rx->stamped = snprintf(stamp, sizeof(stamp), "%.9f ", now()) <= size;
+  rx->received = rx->bytes = 0;
+  rx->last = now();
+  if (rx->maxLatencies < count) {
+    free(rx->latencies);
+    rx->maxLatencies = count;
+    rx->latencies = malloc(count * sizeof(double));
+    if (rx->latencies == NULL) {
+      return result;
+    }
+  }
+  atomic_store(&syscalls, 0);
+  pthread_t thread;
+  pthread_create(&thread, NULL, receiver_thread, rx);
+
+  double start = now();
+  while (result.sent < count && now() - start < limit) {
+    // overwrite the front of the payload with the time, when it fits
+    if (rx->stamped) {
+      int len = snprintf(stamp, sizeof(stamp), "%.9f ", now());
+      memcpy(payload, stamp, len < size ? len : size);
+    }
+    message_ctx_send(ctx, to, payload);
+    result.sent++;
+  }
+  for (int i = 0; i < EndRepeats; i++) {
+    message_ctx_send(ctx, to, EndMarker);
+  }
+  pthread_join(thread, NULL);
+  result.syscalls = atomic_load(&syscalls);
+  result.seconds = rx->last - start;
+  result.received = rx->received;
+
+  memset(payload, 'x', size);   // restore the payload for the next test
+  result.latencies = malloc((rx->received + 1) * sizeof(double));
+  if (result.latencies != NULL) {
+    memcpy(result.latencies, rx->latencies, rx->received * sizeof(double));
+    result.numLatencies = rx->stamped ? rx->received : 0;
+  }
+  return result;
+}
+
+/**************** drain ****************/
+/* Throw away what a test left behind: the end markers after the first,
+ * and echoes that came back too late.
+ */
+static void
+drain(message_ctx_t *ctx)
+{
+  addr_t from;
+  while (message_ctx_receive(ctx, &from) != NULL) {
+  }
+}
+
+/**************** receiver_thread ****************/
+static void *
+receiver_thread(void *arg)
+{
+  receiver_t *rx = arg;
+  message_ctx_loop(rx->ctx, rx, IdleTimeout, handleTimeout, NULL, rx_handleMessage);
+  return NULL;
+}
+
+/**************** rx_handleMessage ****************/
+/* Count a message, and echo it or note its latency; return true at
+ * the end marker.
+ */
+static bool
+rx_handleMessage(void *arg, const addr_t from, const char *message)
+{
+  receiver_t *rx = arg;
+  if (strcmp(message, EndMarker) == 0) {
+    return true;
+  }
+  if (rx->echo) {
+    message_ctx_send(rx->ctx, from, message);
+  } else if (rx->stamped && rx->received < rx->maxLatencies) {
+    rx->latencies[rx->received] = (now() - atof(message)) * 1e6;
+  }
+  rx->last = now();
+  rx->received++;
+  rx->bytes += strlen(message);
+  return false;
+}
+
+/**************** tx_handleMessage ****************/
+/* The echo came back: note it, and leave the loop. */
+static bool
+tx_handleMessage(void *arg, const addr_t from, const char *message)
+{
+  *(bool *)arg = true;
+  return true;
+}
+
+/**************** handleTimeout ****************/
+/* Nothing arrived for IdleTimeout: give up waiting. */
+static bool
+handleTimeout(void *arg)
+{
+  return true;
+}
+
+/**************** report ****************/
+/* Print a test's line, and free its latencies. */
+static void
+report(const char *test, int size, result_t *result)
+{
+  qsort(result->latencies, result->numLatencies, sizeof(double), compare_doubles);
+  double p[4] = { 0, 0, 0, 0 };
+  if (result->numLatencies > 0) {
+    long last = result->numLatencies - 1;
+    p[0] = result->latencies[last * 50 / 100];
+    p[1] = result->latencies[last * 99 / 100];
+    p[2] = result->latencies[last * 999 / 1000];
+    p[3] = result->latencies[last];
+  }
+  double loss = (result->sent > 0) ? 100.0 * (result->sent - result->received) / result->sent : 0;
+  double rate = (result->seconds > 0) ? result->received / result->seconds : 0;
+  // pingpong moves each message twice
+  long messages = (strcmp(test, "pingpong") == 0) ? 2 * result->sent : result->sent;
+  double calls = (messages > 0) ? (double)result->syscalls / messages : 0;
+  printf("%-8s %6d %9ld %9ld %8.3f %11.0f %11.2f %9.2f %9.1f %9.1f %9.1f %9.1f\n", test, size,
+         result->sent, result->received, loss, rate, rate * size / 1e6, calls,
+         p[0], p[1], p[2], p[3]);
+  fflush(stdout);
+  free(result->latencies);
+}
+
+/**************** now ****************/
+/* Seconds on the monotonic clock. */
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**************** compare_doubles ****************/
+static int
+compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
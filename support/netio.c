@@ -0,0 +1,312 @@
+/* 
+ * netio - a network I/O thread for a messaging context
+ *
+ * See netio.h for detailed interface description for each function.
+ *
+ * The I/O thread runs message_ctx_loop on the context, watching the
+ * socket and the read end of the 'outWake' pipe.  Each received message
+ * is copied into a packet, pushed on the inbound ring, and announced by
+ * a byte on the 'inWake' pipe, which the consumer thread blocks on.
+ * Packets to send are pushed on the outbound ring by the consumer, which
+ * writes one byte on 'outWake' after each handled message that sent any.
+ *
+ * foobarbaz, May 2019
+ */
+
+#define _DEFAULT_SOURCE     // for sched_yield
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include "netio.h"
+#include "ring.h"
+#include "log.h"
+
+/**************** local types ****************/
+typedef struct packet {
+  addr_t addr;              // sender of an inbound, recipient of an outbound
+  char text[];              // null-terminated message
+} packet_t;
+
+struct netio {
+  message_ctx_t *ctx;       // context owned by the I/O thread
+  pthread_t thread;         // the I/O thread
+  ring_t *inbound;          // I/O thread -> consumer
+  ring_t *outbound;         // consumer -> I/O thread
+  int inWake[2];            // pipe: I/O thread wakes consumer
+  int outWake[2];           // pipe: consumer wakes I/O thread
+  bool pending;             // consumer queued packets since its last wake-up
+  atomic_bool stopping;     // netio_delete has asked the I/O thread to stop
+  atomic_ulong dropped;     // inbound messages dropped on a full ring
+};
+
+/**************** local functions ****************/
+static void *io_thread(void *arg);
+static bool io_handleInput(void *arg);
+static bool io_handleMessage(void *arg, const addr_t from, const char *message);
+static packet_t *packet_new(const addr_t addr, const char *message);
+static void wake(const int fd);
+static void handed(netio_t *io);
+
+/**************** netio_new ****************/
+/* see netio.h for description */
+netio_t *
+netio_new(message_ctx_t *ctx, const int capacity)
+{
+  netio_t *io = calloc(1, sizeof(netio_t));
+  if (ctx == NULL || io == NULL) {
+    free(io);
+    return NULL;
+  }
+  io->ctx = ctx;
+  io->inbound = ring_new(capacity);
+  io->outbound = ring_new(capacity);
+  if (io->inbound == NULL || io->outbound == NULL) {
+    ring_delete(io->inbound);
+    ring_delete(io->outbound);
+    free(io);
+    return NULL;
+  }
+  if (pipe(io->inWake) != 0) {
+    ring_delete(io->inbound);
+    ring_delete(io->outbound);
+    free(io);
+    return NULL;
+  }
+  if (pipe(io->outWake) != 0) {
+    close(io->inWake[0]);
+    close(io->inWake[1]);
+    ring_delete(io->inbound);
+    ring_delete(io->outbound);
+    free(io);
+    return NULL;
+  }
+  // a full pipe already holds plenty of wake-ups; never block writing one
+  fcntl(io->inWake[1], F_SETFL, O_NONBLOCK);
+  fcntl(io->outWake[1], F_SETFL, O_NONBLOCK);
+  atomic_init(&io->stopping, false);
+  atomic_init(&io->dropped, 0);
+
+  message_ctx_setInput(ctx, io->outWake[0]);
+  // the I/O thread starts with every signal blocked, so signals go to the
+  // consumer, and never interrupt the I/O thread's select
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  int started = pthread_create(&io->thread, NULL, io_thread, io);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (started != 0) {
+    close(io->inWake[0]);
+    close(io->inWake[1]);
+    close(io->outWake[0]);
+    close(io->outWake[1]);
+    ring_delete(io->inbound);
+    ring_delete(io->outbound);
+    free(io);
+    return NULL;
+  }
+  return io;
+}
+
+/**************** netio_loop ****************/
+/* see netio.h for description */
+bool
+netio_loop(netio_t *io, void *arg, const float timeout,
+           bool (*handleTimeout)(void *arg),
+           bool (*handleMessage)(void *arg,
+                                 const addr_t from,
+                                 const char *message))
+{
+  char wakes[64];
+  struct pollfd fd = { .fd = io->inWake[0], .events = POLLIN };
+  int wait = (timeout > 0.0) ? (int)(timeout * 1000) : -1;   // milliseconds
+  while (true) {
+    // block until the I/O thread announces something, or the timeout
+    int ready = poll(&fd, 1, wait);
+    if (ready < 0 && errno != EINTR) {
+      return false;
+    }
+    if (ready <= 0) {
+      if (ready == 0 && handleTimeout != NULL) {
+        bool done = (*handleTimeout)(arg);
+        handed(io);
+        if (done) {
+          return true;
+        }
+      }
+      continue;
+    }
+    // EOF means the I/O thread stopped
+    if (read(io->inWake[0], wakes, sizeof(wakes)) <= 0) {
+      return false;
+    }
+    // drain everything queued, not just one message per wake-up
+    packet_t *packet;
+    while ((packet = ring_pop(io->inbound)) != NULL) {
+      bool done = (*handleMessage)(arg, packet->addr, packet->text);
+      free(packet);
+      handed(io);
+      if (done) {
+        return true;
+      }
+    }
+  }
+}
+
+/**************** netio_send ****************/
+/* see netio.h for description */
+void
+netio_send(netio_t *io, const addr_t to, const char *message)
+{
+  if (io == NULL || message == NULL) {
+    return;
+  }
+  packet_t *packet = packet_new(to, message);
+  if (packet == NULL) {
+    return;
+  }
+  while (!ring_push(io->outbound, packet)) {
+    // full: make sure the I/O thread is draining, and give it the CPU
+    wake(io->outWake[1]);
+    sched_yield();
+  }
+  io->pending = true;
+}
+
+/**************** netio_dropped ****************/
+/* see netio.h for description */
+unsigned long
+netio_dropped(netio_t *io)
+{
+  return io == NULL ? 0 : atomic_load(&io->dropped);
+}
+
+/**************** netio_delete ****************/
+/* see netio.h for description */
+void
+netio_delete(netio_t *io)
+{
+  if (io == NULL) {
+    return;
+  }
+  atomic_store(&io->stopping, true);
+  wake(io->outWake[1]);
+  pthread_join(io->thread, NULL);
+
+  // free whatever the two sides left behind
+  packet_t *packet;
+  while ((packet = ring_pop(io->inbound)) != NULL) {
+    free(packet);
+  }
+  while ((packet = ring_pop(io->outbound)) != NULL) {
+    free(packet);
+  }
+  close(io->inWake[0]);
+  close(io->outWake[0]);
+  close(io->outWake[1]);
+  ring_delete(io->inbound);
+  ring_delete(io->outbound);
+  free(io);
+}
+
+/**************** io_thread ****************/
+/* The I/O thread: loop on the context until stopped or a fatal error,
+ * then close the consumer's wake-up pipe so netio_loop sees EOF.
+ */
+static void *
+io_thread(void *arg)
+{
+  netio_t *io = arg;
+  message_ctx_loop(io->ctx, io, 0, NULL, io_handleInput, io_handleMessage);
+  close(io->inWake[1]);
+  return NULL;
+}
+
+/**************** io_handleInput ****************/
+/* The consumer woke us: send everything on the outbound ring.
+ * Return true if netio_delete asked us to stop.
+ */
+static bool
+io_handleInput(void *arg)
+{
+  netio_t *io = arg;
+  char wakes[64];
+  if (read(io->outWake[0], wakes, sizeof(wakes)) < 0) {
+    log_e("netio: reading wake-up pipe");
+  }
+
+  packet_t *packet;
+  while ((packet = ring_pop(io->outbound)) != NULL) {
+    message_ctx_send(io->ctx, packet->addr, packet->text);
+    free(packet);
+  }
+  return atomic_load(&io->stopping);
+}
+
+/**************** io_handleMessage ****************/
+/* A message arrived: queue a copy for the consumer and wake it.
+ * The message is dropped if the consumer is too far behind.
+ */
+static bool
+io_handleMessage(void *arg, const addr_t from, const char *message)
+{
+  netio_t *io = arg;
+  packet_t *packet = packet_new(from, message);
+  if (packet == NULL) {
+    return false;
+  }
+  if (!ring_push(io->inbound, packet)) {
+    free(packet);
+    atomic_fetch_add(&io->dropped, 1);
+    return false;
+  }
+  wake(io->inWake[1]);
+  return false;
+}
+
+/**************** packet_new ****************/
+/* Copy an address and message into a new packet; NULL if out of memory.
+ */
+static packet_t *
+packet_new(const addr_t addr, const char *message)
+{
+  size_t len = strlen(message);
+  packet_t *packet = malloc(sizeof(packet_t) + len + 1);
+  if (packet == NULL) {
+    log_v("netio: out of memory for packet");
+    return NULL;
+  }
+  packet->addr = addr;
+  memcpy(packet->text, message, len + 1);
+  return packet;
+}
+
+/**************** wake ****************/
+/* Write one wake-up byte to a pipe; a full pipe needs no more.
+ */
+static void
+wake(const int fd)
+{
+  if (write(fd, "", 1) < 0 && errno != EAGAIN) {
+    log_e("netio: writing wake-up pipe");
+  }
+}
+
+/**************** handed ****************/
+/* After a handler returns, wake the I/O thread if it queued anything to send.
+ */
+static void
+handed(netio_t *io)
+{
+  if (io->pending) {
+    io->pending = false;
+    wake(io->outWake[1]);
+  }
+}
@@ -0,0 +1,88 @@
+/* 
+ * netio - a network I/O thread for a messaging context
+ *
+ * Moves all receiving and sending on a message context onto a dedicated
+ * thread, so that a slow consumer (e.g., a server rendering a frame)
+ * never delays the next recvfrom.  Received messages are passed to the
+ * consumer thread, and messages to send are passed back to the I/O
+ * thread, through lock-free single-producer/single-consumer rings;
+ * pipes carry only wake-ups.
+ *
+ * Typical server sequence looks like this:
+ *   message_ctx_t *ctx = message_ctx_new(stderr, 0, false);
+ *   netio_t *io = netio_new(ctx, 4096);
+ *   netio_loop(io, arg, 0, NULL, handleMessage);  // handleMessage calls netio_send
+ *   netio_delete(io);
+ *   message_ctx_delete(ctx);
+ *
+ * foobarbaz, May 2019
+ */
+
+#ifndef __NETIO_H
+#define __NETIO_H
+
+#include <stdbool.h>
+#include "message.h"
+
+/**************** global types ****************/
+typedef struct netio netio_t;  // opaque to users of the module
+
+/**************** netio_new ****************/
+/* Start an I/O thread on the given context.
+ * Caller provides:
+ *   a context no other thread uses from now until netio_delete;
+ *   the number of messages each ring can hold.
+ * We return:
+ *   pointer to the new netio, or NULL if error.
+ * Notes:
+ *   Messages arriving while the inbound ring is full are dropped and
+ *   counted, as the kernel would drop them from a full socket buffer.
+ *   The I/O thread blocks all signals, so a process-directed signal is
+ *   handled on another thread, such as the one in netio_loop, whose
+ *   timeout handler can then end the loop.
+ * Caller is responsible for:
+ *   later calling netio_delete.
+ */
+netio_t *netio_new(message_ctx_t *ctx, const int capacity);
+
+/**************** netio_loop ****************/
+/* Loop on the calling thread, handing each received message to a handler.
+ * Caller provides:
+ *   a netio, an arg passed through to the handlers, a timeout in seconds
+ *   (0 for none), a handler for the timeout (or NULL), and the message handler.
+ * We return:
+ *   true, in the normal case when a handler returns true;
+ *   false, when the I/O thread has stopped on an error.
+ * Notes:
+ *   The handlers are as for message_loop: handleTimeout is called when
+ *   no message came for timeout seconds.  Messages they send with
+ *   netio_send are handed to the I/O thread when they return.
+ */
+bool netio_loop(netio_t *io, void *arg, const float timeout,
+                bool (*handleTimeout)(void *arg),
+                bool (*handleMessage)(void *arg,
+                                      const addr_t from,
+                                      const char *message));
+
+/**************** netio_send ****************/
+/* Queue a message for the I/O thread to send; consumer thread only.
+ * Caller provides:
+ *   a netio, a valid address, a string containing the message.
+ * Notes:
+ *   The message is copied.  If the outbound ring is full, we wait
+ *   for the I/O thread to make room.
+ */
+void netio_send(netio_t *io, const addr_t to, const char *message);
+
+/**************** netio_dropped ****************/
+/* Return the number of received messages dropped on a full ring.
+ */
+unsigned long netio_dropped(netio_t *io);
+
+/**************** netio_delete ****************/
+/* Stop the I/O thread, after it sends what is queued, and free the netio.
+ * The context is left open for the caller to delete.
+ */
+void netio_delete(netio_t *io);
+
+#endif // __NETIO_H
@@ -0,0 +1,256 @@
+/* 
+ * pool - a fixed pool of worker threads for fork/join loops
+ *
+ * See pool.h for detailed interface description for each function.
+ *
+ * Each thread taking part in a run (the workers plus the caller, in
+ * slot 0) owns a range of task indices packed into one 64-bit atomic,
+ * 'begin' in the low half and 'end' in the high half.  The owner takes
+ * tasks from the front by advancing 'begin'; thieves take from the back
+ * by retreating 'end'; both use compare-and-swap on the whole word, so
+ * every index is claimed exactly once.  A run ends when the caller finds
+ * every range empty and no worker is still inside the run.
+ *
+ * foobarbaz, May 2019
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "pool.h"
+
+/**************** local types ****************/
+typedef struct slot {
+  _Alignas(64) atomic_uint_least64_t range;   // end << 32 | begin
+} slot_t;
+
+typedef struct worker {
+  pool_t *pool;
+  int index;                 // slot used by this worker
+  pthread_t thread;
+} worker_t;
+
+struct pool {
+  int nslots;                // workers + 1, for the calling thread
+  slot_t *slots;
+  worker_t *workers;
+  pthread_mutex_t runLock;   // one pool_run at a time
+  pthread_mutex_t lock;      // guards everything below
+  pthread_cond_t start;      // workers wait here for the next run
+  pthread_cond_t done;       // pool_run waits here for workers to leave
+  unsigned long generation;  // number of runs started so far
+  int active;                // workers inside the current run
+  bool stopping;             // pool_delete was called
+  void (*task)(void *arg, const int index);
+  void *arg;
+};
+
+/**************** local functions ****************/
+static void *worker_main(void *arg);
+static void run_tasks(pool_t *pool, const int self);
+static bool take_front(slot_t *slot, int *index);
+static bool take_back(slot_t *slot, int *index);
+
+/**************** pool_new ****************/
+/* see pool.h for description */
+pool_t *
+pool_new(const int workers)
+{
+  if (workers < 0) {
+    return NULL;
+  }
+  pool_t *pool = calloc(1, sizeof(pool_t));
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->nslots = workers + 1;
+  pool->slots = aligned_alloc(64, pool->nslots * sizeof(slot_t));
+  pool->workers = calloc(workers + 1, sizeof(worker_t));
+  if (pool->slots == NULL || pool->workers == NULL) {
+    free(pool->slots);
+    free(pool->workers);
+    free(pool);
+    return NULL;
+  }
+  for (int i = 0; i < pool->nslots; i++) {
+    atomic_init(&pool->slots[i].range, 0);
+  }
+  pthread_mutex_init(&pool->runLock, NULL);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  for (int i = 0; i < workers; i++) {
+    worker_t *worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->index = i + 1;
+    if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+      pool->nslots = i + 1;   // only these workers exist; stop them
+      pool_delete(pool);
+      return NULL;
+    }
+  }
+  return pool;
+}
+
+/**************** pool_run ****************/
+/* see pool.h for description */
+void
+pool_run(pool_t *pool, const int ntasks,
+         void (*task)(void *arg, const int index), void *arg)
+{
+  if (pool == NULL || pool->nslots == 1) {
+    for (int i = 0; i < ntasks; i++) {
+      (*task)(arg, i);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool->runLock);
+  pthread_mutex_lock(&pool->lock);
+  // a worker that woke too late for the last run may still be leaving it
+  while (pool->active > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+
+  // deal the indices out evenly, then start the workers
+  for (int i = 0; i < pool->nslots; i++) {
+    uint64_t begin = (uint64_t)ntasks * i / pool->nslots;
+    uint64_t end = (uint64_t)ntasks * (i + 1) / pool->nslots;
+    atomic_store(&pool->slots[i].range, end << 32 | begin);
+  }
+  pool->task = task;
+  pool->arg = arg;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  run_tasks(pool, 0);
+
+  // barrier: every index is claimed; wait for workers still running one
+  pthread_mutex_lock(&pool->lock);
+  while (pool->active > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  pthread_mutex_unlock(&pool->runLock);
+}
+
+/**************** pool_delete ****************/
+/* see pool.h for description */
+void
+pool_delete(pool_t *pool)
+{
+  if (pool == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->nslots - 1; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+
+  pthread_mutex_destroy(&pool->runLock);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  free(pool->slots);
+  free(pool->workers);
+  free(pool);
+}
+
+/**************** worker_main ****************/
+/* A worker: wait for each run to start, take part, and report leaving.
+ */
+static void *
+worker_main(void *arg)
+{
+  worker_t *worker = arg;
+  pool_t *pool = worker->pool;
+  unsigned long seen = 0;     // last run this worker took part in
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (!pool->stopping && pool->generation == seen) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->stopping) {
+      break;
+    }
+    seen = pool->generation;
+    pool->active++;
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tasks(pool, worker->index);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->active == 0) {
+      pthread_cond_broadcast(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/**************** run_tasks ****************/
+/* Run our own share of the tasks, then steal from the others until
+ * every range is empty.
+ */
+static void
+run_tasks(pool_t *pool, const int self)
+{
+  int index;
+  while (take_front(&pool->slots[self], &index)) {
+    (*pool->task)(pool->arg, index);
+  }
+  for (int i = 1; i < pool->nslots; i++) {
+    slot_t *victim = &pool->slots[(self + i) % pool->nslots];
+    while (take_back(victim, &index)) {
+      (*pool->task)(pool->arg, index);
+    }
+  }
+}
+
+/**************** take_front ****************/
+/* Claim the first index of a range, as its owner; false if empty.
+ */
+static bool
+take_front(slot_t *slot, int *index)
+{
+  uint64_t range = atomic_load(&slot->range);
+  while (true) {
+    uint32_t begin = (uint32_t)range, end = (uint32_t)(range >> 32);
+    if (begin >= end) {
+      return false;
+    }
+    if (atomic_compare_exchange_weak(&slot->range, &range,
+                                     (uint64_t)end << 32 | (begin + 1))) {
+      *index = begin;
+      return true;
+    }
+  }
+}
+
+/**************** take_back ****************/
+/* Claim the last index of a range, as a thief; false if empty.
+ */
+static bool
+take_back(slot_t *slot, int *index)
+{
+  uint64_t range = atomic_load(&slot->range);
+  while (true) {
+    uint32_t begin = (uint32_t)range, end = (uint32_t)(range >> 32);
+    if (begin >= end) {
+      return false;
+    }
+    if (atomic_compare_exchange_weak(&slot->range, &range,
+                                     (uint64_t)(end - 1) << 32 | begin)) {
+      *index = end - 1;
+      return true;
+    }
+  }
+}
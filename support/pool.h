@@ -0,0 +1,50 @@
+/* 
+ * pool - a fixed pool of worker threads for fork/join loops
+ *
+ * pool_run(pool, n, task, arg) calls task(arg, i) once for every i in
+ * [0, n), spread over the pool's workers and the calling thread, and
+ * returns only when all n calls have finished; it is a barrier.
+ * The indices are split evenly among the threads up front, and a thread
+ * that runs out steals from the far end of another thread's share, so
+ * uneven tasks still keep every thread busy.
+ *
+ * foobarbaz, May 2019
+ */
+
+#ifndef __POOL_H
+#define __POOL_H
+
+/**************** global types ****************/
+typedef struct pool pool_t;  // opaque to users of the module
+
+/**************** pool_new ****************/
+/* Start a pool of worker threads.
+ * Caller provides:
+ *   the number of workers, in addition to the thread calling pool_run.
+ * We return:
+ *   pointer to the new pool, or NULL if error.
+ * Caller is responsible for:
+ *   later calling pool_delete.
+ */
+pool_t *pool_new(const int workers);
+
+/**************** pool_run ****************/
+/* Call task(arg, i) for each i in [0, ntasks), in parallel; wait for all.
+ * Caller provides:
+ *   valid pool pointer (or NULL, to run every task on the calling thread),
+ *   the number of tasks, the task function, and its arg.
+ * Notes:
+ *   Calls with the same pool from different threads take turns.
+ *   Tasks must not call pool_run on the same pool.
+ */
+void pool_run(pool_t *pool, const int ntasks,
+              void (*task)(void *arg, const int index), void *arg);
+
+/**************** pool_delete ****************/
+/* Stop the workers and free the pool.
+ * Caller provides:
+ *   valid pool pointer, or NULL (ignored); no pool_run in progress.
+ */
+void pool_delete(pool_t *pool);
+
+#endif // __POOL_H
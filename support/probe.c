@@ -0,0 +1,218 @@
+/*
+ * probe - log-bucketed timing histograms and a Chrome trace writer
+ *
+ * See probe.h for detailed interface description for each function.
+ *
+ * Bucket i < 4 holds the duration i.  Above that, a duration whose top
+ * bit is bit e goes in one of four buckets for that power of two, picked
+ * by the two bits below the top one: bucket 4(e-1) + those two bits.
+ *
+ * A trace is a JSON array of events.  Timestamps are microseconds since
+ * the trace was created.
+ *
+ * foobarbaz, May 2019
+ */
+
+#define _DEFAULT_SOURCE     // for clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "probe.h"
+
+/**************** local types ****************/
+struct probe_trace {
+  FILE *fp;
+  uint64_t start;        // probe_now when the trace was created
+  long events;           // events written
+};
+
+/**************** local functions ****************/
+static int bucket_of(const uint64_t ns);
+static uint64_t bucket_low(const int bucket);
+static uint64_t bucket_high(const int bucket);
+static void print_escaped(FILE *fp, const char *str);
+
+/**************** probe_now ****************/
+uint64_t
+probe_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+/**************** probe_add ****************/
+void
+probe_add(probe_hist_t *hist, const uint64_t ns)
+{
+  hist->count++;
+  hist->total += ns;
+  if (ns > hist->max) {
+    hist->max = ns;
+  }
+  hist->buckets[bucket_of(ns)]++;
+}
+
+/**************** probe_percentile ****************/
+uint64_t
+probe_percentile(const probe_hist_t *hist, const double share)
+{
+  if (hist->count == 0) {
+    return 0;
+  }
+  long rank = (long)(share * hist->count + 0.5);   // durations at or under the answer
+  if (rank < 1) {
+    rank = 1;
+  }
+  long seen = 0;
+  for (int b = 0; b < ProbeBuckets; b++) {
+    seen += hist->buckets[b];
+    if (seen >= rank) {
+      uint64_t high = bucket_high(b);
+      return (high < hist->max) ? high : hist->max;
+    }
+  }
+  return hist->max;
+}
+
+/**************** probe_print ****************/
+void
+probe_print(FILE *fp, const probe_hist_t *hists, const int num)
+{
+  fprintf(fp, "%-10s %10s %12s %12s %12s %12s %12s\n",
+          "phase", "count", "mean ns", "p50 ns", "p90 ns", "p99 ns", "max ns");
+  for (int h = 0; h < num; h++) {
+    const probe_hist_t *hist = &hists[h];
+    if (hist->count > 0) {
+      fprintf(fp, "%-10s %10ld %12.0f %12lu %12lu %12lu %12lu\n", hist->name, hist->count,
+              (double)hist->total / hist->count,
+              (unsigned long)probe_percentile(hist, 0.5), (unsigned long)probe_percentile(hist, 0.9),
+              (unsigned long)probe_percentile(hist, 0.99), (unsigned long)hist->max);
+    }
+  }
+
+  // a bar of up to 40 #s for each bucket, scaled to the fullest bucket
+  for (int h = 0; h < num; h++) {
+    const probe_hist_t *hist = &hists[h];
+    long most = 0;
+    for (int b = 0; b < ProbeBuckets; b++) {
+      if (hist->buckets[b] > most) {
+        most = hist->buckets[b];
+      }
+    }
+    if (most == 0) {
+      continue;
+    }
+    fprintf(fp, "%s:\n", hist->name);
+    for (int b = 0; b < ProbeBuckets; b++) {
+      if (hist->buckets[b] > 0) {
+        int bar = (int)((hist->buckets[b] * 40 + most - 1) / most);
+        fprintf(fp, "  %12lu - %-12lu %10ld %.*s\n", (unsigned long)bucket_low(b),
+                (unsigned long)bucket_high(b), hist->buckets[b], bar,
+                "########################################");
+      }
+    }
+  }
+}
+
+/**************** probe_trace_new ****************/
+probe_trace_t *
+probe_trace_new(const char *path)
+{
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    return NULL;
+  }
+  probe_trace_t *trace = malloc(sizeof(probe_trace_t));
+  if (trace == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+  trace->fp = fp;
+  trace->start = probe_now();
+  trace->events = 0;
+  fprintf(fp, "[\n");
+  return trace;
+}
+
+/**************** probe_trace_event ****************/
+void
+probe_trace_event(probe_trace_t *trace, const char *name,
+                  const uint64_t start, const uint64_t end,
+                  const int pid, const int tid,
+                  const char *argName, const char *arg)
+{
+  FILE *fp = trace->fp;
+  fprintf(fp, "%s{\"name\":\"", (trace->events++ > 0) ? ",\n" : "");
+  print_escaped(fp, name);
+  fprintf(fp, "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+          (start - trace->start) / 1e3, (end - start) / 1e3, pid, tid);
+  if (argName != NULL) {
+    fprintf(fp, ",\"args\":{\"");
+    print_escaped(fp, argName);
+    fprintf(fp, "\":\"");
+    print_escaped(fp, arg);
+    fprintf(fp, "\"}");
+  }
+  fprintf(fp, "}");
+}
+
+/**************** probe_trace_delete ****************/
+void
+probe_trace_delete(probe_trace_t *trace)
+{
+  if (trace == NULL) {
+    return;
+  }
+  fprintf(trace->fp, "\n]\n");
+  fclose(trace->fp);
+  free(trace);
+}
+
+/**************** bucket_of ****************/
+/* The bucket a duration is counted in. */
+static int
+bucket_of(const uint64_t ns)
+{
+  if (ns < 4) {
+    return (int)ns;
+  }
+  int top = 63 - __builtin_clzll(ns);
+  return 4 * (top - 1) + (int)((ns >> (top - 2)) & 3);
+}
+
+/**************** bucket_low ****************/
+/* The shortest duration in a bucket. */
+static uint64_t
+bucket_low(const int bucket)
+{
+  if (bucket < 4) {
+    return bucket;
+  }
+  int top = bucket / 4 + 1;
+  return (uint64_t)(4 + bucket % 4) << (top - 2);
+}
+
+/**************** bucket_high ****************/
+/* The longest duration in a bucket. */
+static uint64_t
+bucket_high(const int bucket)
+{
+  return (bucket == ProbeBuckets - 1) ? UINT64_MAX : bucket_low(bucket + 1) - 1;
+}
+
+/**************** print_escaped ****************/
+/* Print a string as the inside of a JSON string, dropping control characters. */
+static void
+print_escaped(FILE *fp, const char *str)
+{
+  for (const char *p = str; *p != '\0'; p++) {
+    if (*p == '"' || *p == '\\') {
+      fputc('\\', fp);
+    }
+    if ((unsigned char)*p >= ' ') {
+      fputc(*p, fp);
+    }
+  }
+}
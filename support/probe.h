@@ -0,0 +1,101 @@
+/*
+ * probe - log-bucketed timing histograms and a Chrome trace writer,
+ *   for timing probes on a hot path
+ *
+ * A histogram counts durations in nanoseconds, in four buckets to each
+ * power of two, so a bucket is at most a quarter wider than its lower
+ * bound.  It is a fixed-size struct, so it can be a static with nothing
+ * to allocate, and adding to it is a few instructions.  Percentiles are
+ * read from the buckets, rounded up to a bucket's upper bound.
+ *
+ * A trace is a file of Chrome trace events, one "complete" event for
+ * each span timed, which chrome://tracing and Perfetto can open.
+ *
+ * The server compiles its probes in only when built with -DPROBES, so
+ * without them there is no cost at all.
+ *
+ * foobarbaz, May 2019
+ */
+
+#ifndef __PROBE_H
+#define __PROBE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**************** global types ****************/
+#define ProbeBuckets 252               // enough for any uint64_t duration
+
+typedef struct probe_hist {
+  const char *name;
+  long count;                  // durations added
+  uint64_t total;              // their sum, in ns
+  uint64_t max;                // the longest, in ns
+  long buckets[ProbeBuckets];  // durations counted in each bucket
+} probe_hist_t;
+
+typedef struct probe_trace probe_trace_t;  // a trace being written; opaque
+
+/**************** probe_now ****************/
+/* Return the monotonic clock, in nanoseconds. */
+uint64_t probe_now(void);
+
+/**************** probe_add ****************/
+/* Add a duration to a histogram.
+ * Caller provides:
+ *   valid histogram (zeroed before first use, apart from its name), and
+ *   a duration in nanoseconds.
+ */
+void probe_add(probe_hist_t *hist, const uint64_t ns);
+
+/**************** probe_percentile ****************/
+/* Return the duration, in ns, that a given share of those added are
+ * at or under, rounded up to a bucket's upper bound (but never past the max).
+ * Caller provides:
+ *   valid histogram, and the share, between 0 and 1.
+ * We return:
+ *   the duration, or 0 if the histogram is empty.
+ */
+uint64_t probe_percentile(const probe_hist_t *hist, const double share);
+
+/**************** probe_print ****************/
+/* Print histograms: a table of the count, mean, p50, p90, p99 and max
+ * of each, then the buckets of each that are not empty, as bars.
+ * Empty histograms are left out.
+ * Caller provides:
+ *   file to print to, an array of histograms, and their number.
+ */
+void probe_print(FILE *fp, const probe_hist_t *hists, const int num);
+
+/**************** probe_trace_new ****************/
+/* Create a trace file, replacing any file of that name.
+ * Caller provides:
+ *   path of the file to write.
+ * We return:
+ *   pointer to the new trace, or NULL if the file cannot be created.
+ * Caller is responsible for:
+ *   later calling probe_trace_delete, which ends the file.
+ */
+probe_trace_t *probe_trace_new(const char *path);
+
+/**************** probe_trace_event ****************/
+/* Append a complete event: a span of time on one thread of a process.
+ * Spans within another on the same thread show nested under it.
+ * Caller provides:
+ *   valid trace, the event's name, its start and end from probe_now,
+ *   the process and thread IDs to show it under, and an argument to
+ *   attach, named argName, or NULL for none.
+ */
+void probe_trace_event(probe_trace_t *trace, const char *name,
+                       const uint64_t start, const uint64_t end,
+                       const int pid, const int tid,
+                       const char *argName, const char *arg);
+
+/**************** probe_trace_delete ****************/
+/* End the trace file, close it and free the trace.
+ * Caller provides:
+ *   valid trace pointer, or NULL (ignored).
+ */
+void probe_trace_delete(probe_trace_t *trace);
+
+#endif // __PROBE_H
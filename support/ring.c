@@ -0,0 +1,109 @@
+/* 
+ * ring - a lock-free single-producer/single-consumer queue of pointers
+ *
+ * See ring.h for detailed interface description for each function.
+ *
+ * The producer owns 'tail' and the consumer owns 'head'; each reads the
+ * other's index with acquire ordering and publishes its own with release
+ * ordering, so a slot's contents are visible before the index that covers
+ * it.  Indices run freely and are masked into the slot array, so
+ * tail - head is always the number of queued items.  Each side also
+ * caches the other's index to avoid touching its cache line on every call.
+ *
+ * foobarbaz, May 2019
+ */
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "ring.h"
+
+/**************** local types ****************/
+#define CacheLine 64
+
+struct ring {
+  void **slots;              // capacity item pointers
+  size_t mask;               // capacity - 1; capacity is a power of two
+  // producer's cache line
+  _Alignas(CacheLine) atomic_size_t tail;  // next slot to fill
+  size_t headCache;          // producer's last view of head
+  // consumer's cache line
+  _Alignas(CacheLine) atomic_size_t head;  // next slot to drain
+  size_t tailCache;          // consumer's last view of tail
+};
+
+/**************** ring_new ****************/
+/* see ring.h for description */
+ring_t *
+ring_new(const int capacity)
+{
+  if (capacity < 1) {
+    return NULL;
+  }
+  size_t size = 1;
+  while (size < (size_t)capacity) {
+    size <<= 1;
+  }
+
+  ring_t *ring = aligned_alloc(CacheLine, sizeof(ring_t));
+  if (ring == NULL) {
+    return NULL;
+  }
+  ring->slots = calloc(size, sizeof(void *));
+  if (ring->slots == NULL) {
+    free(ring);
+    return NULL;
+  }
+  ring->mask = size - 1;
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->head, 0);
+  ring->headCache = 0;
+  ring->tailCache = 0;
+  return ring;
+}
+
+/**************** ring_push ****************/
+/* see ring.h for description */
+bool
+ring_push(ring_t *ring, void *item)
+{
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if (tail - ring->headCache > ring->mask) {
+    // looks full; refresh our view of the consumer's progress
+    ring->headCache = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - ring->headCache > ring->mask) {
+      return false;
+    }
+  }
+  ring->slots[tail & ring->mask] = item;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+/**************** ring_pop ****************/
+/* see ring.h for description */
+void *
+ring_pop(ring_t *ring)
+{
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head == ring->tailCache) {
+    // looks empty; refresh our view of the producer's progress
+    ring->tailCache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == ring->tailCache) {
+      return NULL;
+    }
+  }
+  void *item = ring->slots[head & ring->mask];
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return item;
+}
+
+/**************** ring_delete ****************/
+/* see ring.h for description */
+void
+ring_delete(ring_t *ring)
+{
+  if (ring != NULL) {
+    free(ring->slots);
+    free(ring);
+  }
+}
@@ -0,0 +1,56 @@
+/* 
+ * ring - a lock-free single-producer/single-consumer queue of pointers
+ *
+ * One thread pushes and one (other) thread pops; no locks are taken,
+ * and neither side ever blocks.  The producer learns the ring is full
+ * when ring_push fails, and the consumer learns it is empty when
+ * ring_pop returns NULL; waiting, if wanted, is up to the caller.
+ *
+ * foobarbaz, May 2019
+ */
+
+#ifndef __RING_H
+#define __RING_H
+
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct ring ring_t;  // opaque to users of the module
+
+/**************** ring_new ****************/
+/* Create a new, empty ring.
+ * Caller provides:
+ *   the number of items it must hold; rounded up to a power of two.
+ * We return:
+ *   pointer to the new ring, or NULL if error.
+ * Caller is responsible for:
+ *   later calling ring_delete.
+ */
+ring_t *ring_new(const int capacity);
+
+/**************** ring_push ****************/
+/* Add an item at the tail of the ring; producer thread only.
+ * Caller provides:
+ *   valid ring pointer, non-NULL item.
+ * We return:
+ *   true if the item was queued, false if the ring is full.
+ */
+bool ring_push(ring_t *ring, void *item);
+
+/**************** ring_pop ****************/
+/* Remove the item at the head of the ring; consumer thread only.
+ * Caller provides:
+ *   valid ring pointer.
+ * We return:
+ *   the oldest item, or NULL if the ring is empty.
+ */
+void *ring_pop(ring_t *ring);
+
+/**************** ring_delete ****************/
+/* Free the ring; items still queued are not freed.
+ * Caller provides:
+ *   valid ring pointer, or NULL (ignored); no thread may be using it.
+ */
+void ring_delete(ring_t *ring);
+
+#endif // __RING_H